@@ -1,6 +1,32 @@
 #pragma once
 
 #include <cmath>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// SIMD 支持：x86/x64 上默认启用 SSE2，AVX2 在运行时检测后使用
+// 定义 MICRO3D_NO_SIMD 可强制只使用标量路径
+#if !defined(MICRO3D_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define MICRO3D_SSE2 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define MICRO3D_TARGET_AVX2
+#else
+#define MICRO3D_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
 
 typedef struct {
     float x, y, z, w;
@@ -16,43 +42,491 @@ typedef struct {
     matrix_t projection;
 } transform_t;
 
+typedef struct binner_t binner_t;
+typedef struct dirty_t dirty_t;
+typedef struct hiz_t hiz_t;
+typedef struct lazy_clear_t lazy_clear_t;
+typedef struct msaa_t msaa_t;
+typedef struct stats_t stats_t;
+typedef struct texture_t texture_t;
+
+// 深度比较函数：新像素的深度与深度缓冲中的值比较，通过才写入
+typedef enum {
+    DEPTH_LESS = 0, // 默认：更近（z 更小）的像素通过
+    DEPTH_LEQUAL,
+    DEPTH_GREATER,
+    DEPTH_GEQUAL,
+    DEPTH_EQUAL,
+    DEPTH_ALWAYS
+} depth_func_t;
+
+// 面剔除：按三角形在屏幕空间（y 向下）中的绕序剔除，在图元装配阶段、三角形建立之前进行
+typedef enum {
+    CULL_NONE = 0, // 默认：两种绕序都绘制
+    CULL_CW,       // 剔除顺时针的三角形（cross_product_2d > 0）
+    CULL_CCW       // 剔除逆时针的三角形
+} cull_mode_t;
+
+// 颜色混合：写入颜色缓冲时新颜色（源 s）与已有颜色（目标 d）的合成方式。颜色为 0xAARRGGBB，源 alpha（a）为非预乘的不透明度。
+// 逐通道用 8 位整数计算，除以 255 时四舍五入，标量与 SIMD 路径的结果逐位相同。
+// 整个管线的颜色（纯色参数、CUBE_COLORS、着色器输出、纹理、清屏颜色）都是 0xAARRGGBB：alpha 为 0 即完全透明，
+// 不透明的颜色要写出 0xFF 的 alpha；BLEND_NONE 时 alpha 原样写入颜色缓冲
+typedef enum {
+    BLEND_NONE = 0, // 默认：直接覆盖
+    BLEND_OVER,     // 源覆盖（src-over）：c = s * a + d * (1 - a)，alpha = a + da * (1 - a)
+    BLEND_ADD,      // 加法：c = d + s * a，alpha = da + a，饱和到 255
+    BLEND_MULTIPLY  // 正片叠底：c = d * (s * a + 1 - a)，alpha 保持 da
+} blend_mode_t;
+
+// 像素矩形 [x0, x1] x [y0, y1]，包含边界
+typedef struct {
+    int x0, y0, x1, y1;
+} rect_t;
+
 typedef struct {
     int width;
     int height;
     unsigned int* buffer;
+    binner_t* binner; // 分块模式：非空时 triangle() 只分箱，由 binner_flush() 多线程光栅化
+
+    // 深度缓冲（可选）：width * height 个 float，0 为近平面、1 为远平面；为空时不做深度测试
+    float* zbuffer;
+    depth_func_t depth_func; // 深度比较函数，默认 DEPTH_LESS
+    bool depth_readonly;     // 为 true 时只做深度测试，不写入深度
+    hiz_t* hiz;              // 分层深度（可选，需要 zbuffer），用于整块/整个图元的遮挡剔除
+    lazy_clear_t* lazy_clear; // 延迟清除（可选）：非空时 clear_color/clear_depth 只记录清除值，tile 在首次写入时才清除
+    msaa_t* msaa;             // 多重采样抗锯齿（可选）：非空时三角形逐采样计算覆盖和深度，帧末由 msaa_resolve 写回 buffer
+
+    cull_mode_t cull_mode; // 面剔除，作用于 draw_triangle/draw_indexed；triangle() 不做面剔除
+    blend_mode_t blend_mode; // 颜色混合，作用于三角形、线段、pixel 和 blit；默认 BLEND_NONE
+    bool scissor_test;       // 裁剪测试：为 true 时三角形、线段、pixel、blit 和清除只写入 scissor 内的像素
+    rect_t scissor;
+
+    dirty_t* dirty; // 脏矩形（可选）：非空时 render3d 只重绘上次绘制这个 device 以来画面变化的区域
+    stats_t* stats; // 统计（可选）：非空时记录各阶段的计数和耗时
 } device_t;
 
+// 统计：device->stats 为空时每个统计点只有一次判断；定义 MICRO3D_NO_STATS 时统计代码不参与编译。
+// 计数在多次绘制之间累加，需要单帧数据时每帧开始前调用 stats_reset
+typedef enum {
+    STATS_RENDER3D = 0, // render3d 整帧
+    STATS_CLEAR,        // 清空颜色/深度缓冲
+    STATS_DRAW_CUBE,    // draw_cube
+    STATS_DRAW_INDEXED, // draw_indexed（包含顶点处理和图元装配）
+    STATS_TRANSFORM,    // 顶点变换、外码、透视除法和视口变换
+    STATS_TRIANGLE,     // triangle()：建立 + 光栅化（分块模式下只到分箱）
+    STATS_SETUP,        // 三角形建立
+    STATS_FILL,         // 直接光栅化
+    STATS_FLUSH,        // 分块光栅化（等待所有线程完成）
+    STATS_TILES,        // 分块光栅化中每个线程的工作时间
+    STATS_LINE,         // line()
+    STATS_EXECUTE,      // command_buffer_execute
+    STATS_SCENE,        // scene_draw/scene_draw_dirty（micro3d_scene.h）：BVH 剔除 + 绘制可见实例
+    STATS_TIMER_COUNT
+} stats_timer_id_t;
+
+static const char* const STATS_TIMER_NAMES[STATS_TIMER_COUNT] = {
+    "render3d", "clear", "draw_cube", "draw_indexed", "transform", "triangle", "setup", "fill", "flush", "tiles", "line", "execute", "scene"
+};
+
+// 调用频繁的计时器只累计，不产生 trace 事件
+static const bool STATS_TIMER_TRACED[STATS_TIMER_COUNT] = {
+    true, true, true, true, true, false, false, false, true, true, false, true, true
+};
+
+typedef struct {
+    unsigned long long calls;
+    long long ns;
+} stats_timer_t;
+
+// Chrome trace 的 "X"（完整事件），时间单位为纳秒，导出时换算为微秒
+typedef struct {
+    stats_timer_id_t timer;
+    int thread;
+    long long start_ns;
+    long long duration_ns;
+} stats_event_t;
+
+struct stats_t {
+    unsigned long long frames;
+
+    unsigned long long triangles_submitted;        // 进入图元装配（draw_triangle/draw_indexed）
+    unsigned long long triangles_culled_frustum;   // 平凡剔除：三个顶点在同一视锥平面外
+    unsigned long long triangles_culled_backface;  // 被面剔除（cull_mode）
+    unsigned long long triangles_clipped;          // 需要多边形裁剪
+    unsigned long long triangles_setup;            // 进入 triangle()（包括裁剪后拆出的三角形）
+    unsigned long long triangles_culled_degenerate; // 面积为 0 或不覆盖任何像素
+    unsigned long long triangles_culled_hiz;       // 整个三角形被 Hi-Z 剔除
+    unsigned long long triangles_rasterized;       // 进入光栅化或分箱
+    unsigned long long meshes_culled;              // draw_indexed 整个网格被剔除
+    unsigned long long instances_culled;           // scene_draw 中被 BVH 视锥剔除的实例
+
+    unsigned long long pixels_tested;      // 在三角形内的像素（参与深度测试）
+    unsigned long long pixels_written;     // 通过深度测试并写入颜色的像素
+    unsigned long long hiz_blocks_culled;  // 光栅化时被 Hi-Z 整块跳过的 8x8 块
+
+    unsigned long long lines;
+    unsigned long long line_pixels;
+
+    unsigned long long dirty_rects;  // 脏矩形模式下重绘的矩形
+    unsigned long long dirty_pixels; // 重绘矩形的总像素数（与 frames * 屏幕像素数相比即重绘比例）
+
+    stats_timer_t timers[STATS_TIMER_COUNT];
+
+    bool trace;                         // 是否记录 trace 事件
+    size_t max_events;                  // 事件数上限，超出后丢弃并计数
+    unsigned long long dropped_events;
+    std::vector<stats_event_t> events;
+    long long epoch_ns;                 // trace 时间起点
+    std::mutex mutex;                   // 分块光栅化的工作线程合并统计时使用
+};
+
+inline long long stats_now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline void stats_reset(stats_t* stats)
+{
+    stats->frames = 0;
+    stats->triangles_submitted = 0;
+    stats->triangles_culled_frustum = 0;
+    stats->triangles_culled_backface = 0;
+    stats->triangles_clipped = 0;
+    stats->triangles_setup = 0;
+    stats->triangles_culled_degenerate = 0;
+    stats->triangles_culled_hiz = 0;
+    stats->triangles_rasterized = 0;
+    stats->meshes_culled = 0;
+    stats->instances_culled = 0;
+    stats->pixels_tested = 0;
+    stats->pixels_written = 0;
+    stats->hiz_blocks_culled = 0;
+    stats->lines = 0;
+    stats->line_pixels = 0;
+    stats->dirty_rects = 0;
+    stats->dirty_pixels = 0;
+    for (int i = 0; i < STATS_TIMER_COUNT; i++) {
+        stats->timers[i].calls = 0;
+        stats->timers[i].ns = 0;
+    }
+    stats->dropped_events = 0;
+    stats->events.clear();
+    stats->epoch_ns = stats_now();
+}
+
+// trace 为 true 时同时记录 Chrome trace 事件（最多 max_events 个）
+inline stats_t* stats_create(bool trace)
+{
+    stats_t* stats = new stats_t;
+    stats->trace = trace;
+    stats->max_events = 1 << 20;
+    stats_reset(stats);
+    return stats;
+}
+
+inline void stats_destroy(stats_t* stats)
+{
+    delete stats;
+}
+
+// 记录一次计时；thread 为分块光栅化的线程编号（调用线程为 0）
+inline void stats_record(stats_t* stats, stats_timer_id_t timer, int thread, long long start_ns, long long end_ns)
+{
+    stats->timers[timer].calls++;
+    stats->timers[timer].ns += end_ns - start_ns;
+    if (stats->trace && STATS_TIMER_TRACED[timer]) {
+        if (stats->events.size() < stats->max_events) {
+            stats_event_t event = { timer, thread, start_ns, end_ns - start_ns };
+            stats->events.push_back(event);
+        } else {
+            stats->dropped_events++;
+        }
+    }
+}
+
+// 作用域计时：构造时开始，析构时记录
+struct stats_scope_t {
+    stats_t* stats;
+    stats_timer_id_t timer;
+    long long start_ns;
+
+    stats_scope_t(stats_t* s, stats_timer_id_t t) : stats(s), timer(t), start_ns(s ? stats_now() : 0) {}
+    ~stats_scope_t()
+    {
+        if (stats) {
+            stats_record(stats, timer, 0, start_ns, stats_now());
+        }
+    }
+};
+
+#ifndef MICRO3D_NO_STATS
+#define MICRO3D_STATS_ADD(device, field, n) do { if ((device)->stats) { (device)->stats->field += (n); } } while (0)
+#define MICRO3D_STATS_SCOPE(device, timer) stats_scope_t stats_scope_##timer((device)->stats, timer)
+#else
+#define MICRO3D_STATS_ADD(device, field, n) ((void)0)
+#define MICRO3D_STATS_SCOPE(device, timer) ((void)0)
+#endif
+
+// 导出为 JSON：计数、平均每帧的覆盖率（overdraw = 写入像素数 / 屏幕像素数）和各计时器的累计耗时
+inline void stats_write_json(const stats_t* stats, const device_t* device, FILE* file)
+{
+    double screen = (double)device->width * device->height * (double)(stats->frames ? stats->frames : 1);
+    fprintf(file, "{\n");
+    fprintf(file, "  \"frames\": %llu,\n", stats->frames);
+    fprintf(file, "  \"triangles\": {\"submitted\": %llu, \"culled_frustum\": %llu, \"culled_backface\": %llu, "
+                  "\"clipped\": %llu, \"setup\": %llu, \"culled_degenerate\": %llu, \"culled_hiz\": %llu, \"rasterized\": %llu},\n",
+            stats->triangles_submitted, stats->triangles_culled_frustum, stats->triangles_culled_backface,
+            stats->triangles_clipped, stats->triangles_setup,
+            stats->triangles_culled_degenerate, stats->triangles_culled_hiz, stats->triangles_rasterized);
+    fprintf(file, "  \"meshes_culled\": %llu,\n", stats->meshes_culled);
+    fprintf(file, "  \"instances_culled\": %llu,\n", stats->instances_culled);
+    fprintf(file, "  \"pixels\": {\"tested\": %llu, \"written\": %llu, \"overdraw\": %.4f, \"hiz_blocks_culled\": %llu},\n",
+            stats->pixels_tested, stats->pixels_written, (double)stats->pixels_written / screen, stats->hiz_blocks_culled);
+    fprintf(file, "  \"lines\": {\"count\": %llu, \"pixels\": %llu},\n", stats->lines, stats->line_pixels);
+    fprintf(file, "  \"dirty\": {\"rects\": %llu, \"pixels\": %llu, \"redrawn\": %.4f},\n",
+            stats->dirty_rects, stats->dirty_pixels, (double)stats->dirty_pixels / screen);
+    fprintf(file, "  \"timers_ns\": {");
+    for (int i = 0; i < STATS_TIMER_COUNT; i++) {
+        const stats_timer_t* t = &stats->timers[i];
+        fprintf(file, "%s\n    \"%s\": {\"calls\": %llu, \"total\": %lld, \"average\": %.1f}", i ? "," : "",
+                STATS_TIMER_NAMES[i], t->calls, t->ns, t->calls ? (double)t->ns / (double)t->calls : 0.0);
+    }
+    fprintf(file, "\n  },\n");
+    fprintf(file, "  \"dropped_trace_events\": %llu\n", stats->dropped_events);
+    fprintf(file, "}\n");
+}
+
+// 导出为 Chrome trace（chrome://tracing、Perfetto 可直接打开）
+inline void stats_write_trace(const stats_t* stats, FILE* file)
+{
+    fprintf(file, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [");
+    for (size_t i = 0; i < stats->events.size(); i++) {
+        const stats_event_t* e = &stats->events[i];
+        fprintf(file, "%s\n  {\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+                i ? "," : "", STATS_TIMER_NAMES[e->timer], e->thread,
+                (double)(e->start_ns - stats->epoch_ns) * 1e-3, (double)e->duration_ns * 1e-3);
+    }
+    fprintf(file, "\n]}\n");
+}
+
+inline void lazy_clear_touch(device_t* device, int x0, int y0, int x1, int y1);
+inline void fill_words(void* dst, uint32_t value, size_t count, bool stream);
+inline void msaa_write(device_t* device, int x, int y, int mask, unsigned int clr);
+inline void msaa_blend(device_t* device, int x, int y, int mask, unsigned int clr, blend_mode_t mode);
+inline unsigned int blend_pixel(unsigned int src, unsigned int dst, blend_mode_t mode);
+
+// 可以写入的像素矩形：屏幕，启用裁剪测试时再与 scissor 取交集（可能为空）
+inline rect_t scissor_rect(const device_t* device)
+{
+    rect_t r = { 0, 0, device->width - 1, device->height - 1 };
+    if (device->scissor_test) {
+        r.x0 = std::max(r.x0, device->scissor.x0);
+        r.y0 = std::max(r.y0, device->scissor.y0);
+        r.x1 = std::min(r.x1, device->scissor.x1);
+        r.y1 = std::min(r.y1, device->scissor.y1);
+    }
+    return r;
+}
+
+inline bool scissor_contains(const device_t* device, int x, int y)
+{
+    const rect_t* s = &device->scissor;
+    return !device->scissor_test || (x >= s->x0 && x <= s->x1 && y >= s->y0 && y <= s->y1);
+}
+
 inline void pixel(device_t* device, int x, int y, unsigned int clr)
 {
-    if (x >= 0 && x < device->width && y >= 0 && y < device->height) {
-        device->buffer[x + y * device->width] = clr;
+    if (x >= 0 && x < device->width && y >= 0 && y < device->height && scissor_contains(device, x, y)) {
+        if (device->lazy_clear) {
+            lazy_clear_touch(device, x, y, x, y);
+        }
+        if (device->msaa) {
+            msaa_blend(device, x, y, 0xF, clr, device->blend_mode);
+            return;
+        }
+        unsigned int* p = &device->buffer[x + y * device->width];
+        *p = device->blend_mode == BLEND_NONE ? clr : blend_pixel(clr, *p, device->blend_mode);
+    }
+}
+
+inline void binner_flush(device_t* device);
+
+// 把屏幕坐标线段裁剪到视口 [0, width - 1] x [0, height - 1]（Liang-Barsky，浮点）。
+// 线段完全在视口外或坐标不是有限值时返回 false；端点远在屏幕外的线段也只在视口内的部分步进
+inline bool line_clip(const device_t* device, float* x1, float* y1, float* x2, float* y2)
+{
+    float max_x = (float)(device->width - 1);
+    float max_y = (float)(device->height - 1);
+    float dx = *x2 - *x1;
+    float dy = *y2 - *y1;
+    // v - v 只在 v 为有限值时等于 0：排除 NaN、无穷大和相减溢出
+    if (!(*x1 - *x1 == 0.0f && *y1 - *y1 == 0.0f && dx - dx == 0.0f && dy - dy == 0.0f)) {
+        return false;
+    }
+    float p[4] = { -dx, dx, -dy, dy };
+    float q[4] = { *x1, max_x - *x1, *y1, max_y - *y1 };
+    float t0 = 0.0f, t1 = 1.0f;
+    for (int i = 0; i < 4; i++) {
+        if (p[i] == 0.0f) {
+            if (q[i] < 0.0f) {
+                return false;
+            }
+        } else if (p[i] < 0.0f) {
+            t0 = fmaxf(t0, q[i] / p[i]);
+        } else {
+            t1 = fminf(t1, q[i] / p[i]);
+        }
+    }
+    if (t0 > t1) {
+        return false;
+    }
+    float x0 = *x1, y0 = *y1;
+    if (t1 < 1.0f) {
+        *x2 = x0 + t1 * dx;
+        *y2 = y0 + t1 * dy;
     }
+    if (t0 > 0.0f) {
+        *x1 = x0 + t0 * dx;
+        *y1 = y0 + t0 * dy;
+    }
+    // 舍入误差可能使交点略微越界
+    *x1 = fminf(fmaxf(*x1, 0.0f), max_x);
+    *y1 = fminf(fmaxf(*y1, 0.0f), max_y);
+    *x2 = fminf(fmaxf(*x2, 0.0f), max_x);
+    *y2 = fminf(fmaxf(*y2, 0.0f), max_y);
+    return true;
 }
 
-inline void line(device_t* device, int x1, int y1, int x2, int y2, unsigned int clr)
+// 光栅化两个端点都在视口内的线段，不做逐像素的边界检查，像素与逐点 Bresenham 相同。
+// 水平线整段填充；以 x 为主方向且斜率不超过 1/2 时同一行的像素连成一段（run），
+// 由误差项直接算出整段长度后连续写入（run-slice）；其余情况逐像素步进，用地址增量代替坐标计算。
+// 裁剪测试只在线段跨过 scissor 边界时逐像素检查，像素仍是整条线段的 Bresenham 像素
+inline void line_raster(device_t* device, int x1, int y1, int x2, int y2, unsigned int clr)
 {
     int dx = (x1 < x2) ? (x2 - x1) : (x1 - x2);
     int dy = (y1 < y2) ? (y2 - y1) : (y1 - y2);
     int sx = (x1 < x2) ? 1 : -1;
-    int sy = (y1 < y2) ? 1 : -1;
-    int err = (dx > dy ? dx : -dy) >> 1;
-    int err2;
-    while (1) {
-        pixel(device, x1, y1, clr);
-        if (x1 == x2 && y1 == y2)
+    int step_y = (y1 < y2) ? device->width : -device->width;
+    rect_t bounds = { std::min(x1, x2), std::min(y1, y2), std::max(x1, x2), std::max(y1, y2) };
+    bool clipped = false;
+    if (device->scissor_test) {
+        const rect_t* s = &device->scissor;
+        if (bounds.x1 < s->x0 || bounds.x0 > s->x1 || bounds.y1 < s->y0 || bounds.y0 > s->y1) {
+            return;
+        }
+        clipped = bounds.x0 < s->x0 || bounds.x1 > s->x1 || bounds.y0 < s->y0 || bounds.y1 > s->y1;
+        bounds.x0 = std::max(bounds.x0, s->x0);
+        bounds.y0 = std::max(bounds.y0, s->y0);
+        bounds.x1 = std::min(bounds.x1, s->x1);
+        bounds.y1 = std::min(bounds.y1, s->y1);
+    }
+    MICRO3D_STATS_ADD(device, line_pixels, (dx > dy ? dx : dy) + 1);
+    if (device->lazy_clear) {
+        lazy_clear_touch(device, bounds.x0, bounds.y0, bounds.x1, bounds.y1);
+    }
+
+    if (device->msaa || device->blend_mode != BLEND_NONE || clipped) {
+        // 多重采样、混合或跨过 scissor 边界时逐像素写入：线段不做抗锯齿，像素的 4 个采样都为线段颜色；每个像素只合成一次
+        int err = (dx > dy ? dx : -dy) / 2;
+        int sy = (y1 < y2) ? 1 : -1;
+        for (;;) {
+            if (clipped && !scissor_contains(device, x1, y1)) {
+                // scissor 外的像素不写入，继续步进
+            } else if (device->msaa) {
+                msaa_blend(device, x1, y1, 0xF, clr, device->blend_mode);
+            } else {
+                unsigned int* q = device->buffer + (size_t)y1 * device->width + x1;
+                *q = blend_pixel(clr, *q, device->blend_mode);
+            }
+            if (x1 == x2 && y1 == y2) {
+                break;
+            }
+            int err2 = err;
+            if (err2 > -dx) {
+                err -= dy;
+                x1 += sx;
+            }
+            if (err2 < dy) {
+                err += dx;
+                y1 += sy;
+            }
+        }
+        return;
+    }
+
+    unsigned int* p = device->buffer + (size_t)y1 * device->width + x1;
+    if (dy == 0) {
+        fill_words(sx > 0 ? p : p - dx, clr, (size_t)dx + 1, false);
+        return;
+    }
+    if (dx >= 2 * dy) {
+        // 每前进一列误差减 dy，误差小于 dy 时换行（误差加 dx），所以本行的像素数为 err / dy + 1
+        int err = dx / 2;
+        int remaining = dx + 1;
+        while (remaining > 0) {
+            int run = (err >= 0 ? err / dy : 0) + 1;
+            run = run < remaining ? run : remaining;
+            unsigned int* span = sx > 0 ? p : p - run + 1;
+            if (run < 8) {
+                for (int i = 0; i < run; i++) {
+                    span[i] = clr;
+                }
+            } else {
+                fill_words(span, clr, (size_t)run, false);
+            }
+            p += sx * run;
+            p += step_y;
+            err += dx - run * dy;
+            remaining -= run;
+        }
+        return;
+    }
+
+    int err = (dx > dy ? dx : -dy) / 2;
+    for (int n = (dx > dy ? dx : dy) + 1; ; ) {
+        *p = clr;
+        if (--n == 0) {
             break;
-        err2 = err;
+        }
+        int err2 = err;
         if (err2 > -dx) {
             err -= dy;
-            x1 += sx;
+            p += sx;
         }
         if (err2 < dy) {
             err += dx;
-            y1 += sy;
+            p += step_y;
         }
     }
 }
 
+// 屏幕坐标线段：先裁剪到视口再光栅化（端点截断为整数，与 pixel 相同）
+inline void line_screen(device_t* device, float x1, float y1, float x2, float y2, unsigned int clr)
+{
+    if (line_clip(device, &x1, &y1, &x2, &y2)) {
+        line_raster(device, (int)x1, (int)y1, (int)x2, (int)y2, clr);
+    }
+}
+
+inline void line(device_t* device, int x1, int y1, int x2, int y2, unsigned int clr)
+{
+    // 分块模式下先画完已分箱的三角形，保持绘制顺序
+    binner_flush(device);
+    MICRO3D_STATS_SCOPE(device, STATS_LINE);
+    MICRO3D_STATS_ADD(device, lines, 1);
+
+    if ((unsigned)x1 < (unsigned)device->width && (unsigned)x2 < (unsigned)device->width &&
+        (unsigned)y1 < (unsigned)device->height && (unsigned)y2 < (unsigned)device->height) {
+        line_raster(device, x1, y1, x2, y2, clr);
+        return;
+    }
+    float fx1 = (float)x1, fy1 = (float)y1, fx2 = (float)x2, fy2 = (float)y2;
+    if (line_clip(device, &fx1, &fy1, &fx2, &fy2)) {
+        line_raster(device, (int)(fx1 + 0.5f), (int)(fy1 + 0.5f), (int)(fx2 + 0.5f), (int)(fy2 + 0.5f), clr);
+    }
+}
+
 // 向量 AB 和向量 AC 的二维叉积
 // 公式：(Bx - Ax)*(Cy - Ay) - (By - Ay)*(Cx - Ax)
 // 正值：AB 正旋转(即逆时针)到 AC 小于 180 度
@@ -63,459 +537,4667 @@ inline float cross_product_2d(const vec4_t* a, const vec4_t* b, const vec4_t* c)
     return (b->x - a->x) * (c->y - a->y) - (b->y - a->y) * (c->x - a->x);
 }
 
-inline void triangle(device_t* device, vec4_t* v1, vec4_t* v2, vec4_t* v3, unsigned int clr)
-{
-    // 计算三角形的边界框
-    int min_x = (int)fminf(fminf(v1->x, v2->x), v3->x);
-    int max_x = (int)fmaxf(fmaxf(v1->x, v2->x), v3->x);
-    int min_y = (int)fminf(fminf(v1->y, v2->y), v3->y);
-    int max_y = (int)fmaxf(fmaxf(v1->y, v2->y), v3->y);
+// 三角形建立时顶点吸附到 1/256 像素的定点坐标（24.8），边函数用整数精确计算：
+// 覆盖结果不受浮点舍入和编译器优化的影响，共享边的两个三角形不重叠也没有缝隙
+static const int SUBPIXEL_BITS = 8;
+static const int SUBPIXEL_ONE = 1 << SUBPIXEL_BITS;
+// 顶点坐标的绝对值上限（像素）：保证边的增量乘以 8 仍在 int32 范围内，超出时三角形不绘制。
+// draw_triangle 裁剪到保护带后的坐标远小于这个值
+static const float SUBPIXEL_MAX_COORD = 65536.0f;
 
-    // 限制在屏幕范围内
-    min_x = fmax(min_x, 0);
-    max_x = fmin(max_x, device->width - 1);
-    min_y = fmax(min_y, 0);
-    max_y = fmin(max_y, device->height - 1);
+inline int subpixel_snap(float v)
+{
+    return (int)floorf(v * (float)SUBPIXEL_ONE + 0.5f);
+}
 
-    // 计算整个三角形的有向面积
-    float area = cross_product_2d(v1, v2, v3);
+// 三个顶点的坐标都在定点范围内；取反的比较同时排除 NaN
+inline bool subpixel_in_range(const vec4_t* v1, const vec4_t* v2, const vec4_t* v3)
+{
+    return fabsf(v1->x) <= SUBPIXEL_MAX_COORD && fabsf(v1->y) <= SUBPIXEL_MAX_COORD &&
+           fabsf(v2->x) <= SUBPIXEL_MAX_COORD && fabsf(v2->y) <= SUBPIXEL_MAX_COORD &&
+           fabsf(v3->x) <= SUBPIXEL_MAX_COORD && fabsf(v3->y) <= SUBPIXEL_MAX_COORD;
+}
 
-    // 如果面积为0，说明是退化三角形，不绘制
-    if (fabsf(area) < 1e-8f) {
-        return;
+// 顶点吸附到亚像素网格后的有向面积（亚像素单位，与 cross_product_2d 同号），与 triangle_setup 的计算相同；
+// 坐标超出定点范围时返回 0（triangle_setup 也不会绘制）
+inline long long triangle_snapped_area(const vec4_t* v1, const vec4_t* v2, const vec4_t* v3)
+{
+    if (!subpixel_in_range(v1, v2, v3)) {
+        return 0;
     }
+    int x1 = subpixel_snap(v1->x), y1 = subpixel_snap(v1->y);
+    int x2 = subpixel_snap(v2->x), y2 = subpixel_snap(v2->y);
+    int x3 = subpixel_snap(v3->x), y3 = subpixel_snap(v3->y);
+    return (long long)(x2 - x1) * (y3 - y1) - (long long)(y2 - y1) * (x3 - x1);
+}
 
-    // 遍历边界框内的每个像素
-    for (int y = min_y; y <= max_y; y++) {
-        for (int x = min_x; x <= max_x; x++) {
-            // 当前像素位置（使用像素中心）
-            vec4_t p = { (float)x + 0.5f, (float)y + 0.5f, 0, 1 };
+// 边函数：亚像素坐标下 E(X, Y) = (y0 - y1) * (X - x0) + (x1 - x0) * (Y - y0)，即 cross_product_2d(v0, v1, p)。
+// 像素 (x, y) 的中心为 X = x * 256 + 128，E 可以写成 256 * (a * x + b * y) + C；把填充规则的偏置并入 C 后，
+// E >= 0 当且仅当 w(x, y) = a * x + b * y + floor(C / 256) >= 0。
+// 因此按像素整数坐标求值：x 方向每前进一个像素加 a，y 方向每前进一行加 b，像素在三条边内当且仅当三个 w 都不小于 0
+typedef struct {
+    int a, b;    // x、y 方向的增量
+    long long c; // w(0, 0)
+} edge_t;
 
-            float cp0 = cross_product_2d(v2, v3, &p);
-            float cp1 = cross_product_2d(v3, v1, &p);
-            float cp2 = cross_product_2d(v1, v2, &p);
+// 采样点相对像素中心偏移 (dx, dy)（亚像素）时的 w(0, 0)，(x0, y0) 为边的起点；像素中心即 dx = dy = 0
+inline long long edge_constant(const edge_t* e, int x0, int y0, int dx, int dy)
+{
+    // 填充规则：恰好落在边上（E == 0）的像素只归上边/左边所在的三角形。
+    // 左边：向上走的边；上边：水平且向右走的边
+    bool top_left = e->a > 0 || (e->a == 0 && e->b > 0);
+    long long c = (long long)e->a * (SUBPIXEL_ONE / 2 + dx - x0) + (long long)e->b * (SUBPIXEL_ONE / 2 + dy - y0) - (top_left ? 0 : 1);
+    return c >> SUBPIXEL_BITS; // 算术右移即向下取整
+}
 
-            // 检查像素是否在三角形内
-            if (cp0 >= 0 && cp1 >= 0 && cp2 >= 0) {
-                pixel(device, x, y, clr);
-            }
-        }
-    }
+// 参数为亚像素坐标，要求三角形已调整为正面积（屏幕坐标 y 向下时即顺时针）
+inline void edge_setup(edge_t* e, int x0, int y0, int x1, int y1)
+{
+    e->a = y0 - y1;
+    e->b = x1 - x0;
+    e->c = edge_constant(e, x0, y0, 0, 0);
 }
 
-//线框模式
-inline void triangle_wireframe(device_t* device, vec4_t* v1, vec4_t* v2, vec4_t* v3, unsigned int clr)
+inline long long edge_eval(const edge_t* e, int x, int y)
 {
-    line(device, (int)v1->x, (int)v1->y, (int)v2->x, (int)v2->y, clr);
-    line(device, (int)v2->x, (int)v2->y, (int)v3->x, (int)v3->y, clr);
-    line(device, (int)v3->x, (int)v3->y, (int)v1->x, (int)v1->y, clr);
+    return (long long)e->a * x + (long long)e->b * y + e->c;
 }
 
-inline void matrix_look_at(matrix_t* view, vec4_t* eye, vec4_t* target, vec4_t* up)
+// 三条边的值都不小于 0 时像素被覆盖
+inline bool edges_inside(long long w0, long long w1, long long w2)
 {
-    // 计算前向向量 (forward = target - eye)
-    vec4_t forward = {
-        target->x - eye->x,
-        target->y - eye->y,
-        target->z - eye->z,
-        0.0f
-    };
+    return (w0 | w1 | w2) >= 0;
+}
 
-    // 归一化前向向量
-    float length = sqrtf(forward.x * forward.x + forward.y * forward.y + forward.z * forward.z);
-    if (length > 0) {
-        forward.x /= length;
-        forward.y /= length;
-        forward.z /= length;
-    }
+// 把边函数值限制到 int32 范围内：只关心符号，而同一组 SIMD 通道内的增量远小于 2^30，限制不会改变各通道的符号
+inline int edge_clamp(long long w)
+{
+    const long long limit = 1 << 30;
+    return (int)(w < -limit ? -limit : (w > limit ? limit : w));
+}
 
-    // 计算右向量 (right = forward × up)
-    vec4_t right = {
-        forward.y * up->z - forward.z * up->y,
-        forward.z * up->x - forward.x * up->z,
-        forward.x * up->y - forward.y * up->x,
-        0.0f
-    };
+// 4x 多重采样的采样位置：相对像素中心的亚像素偏移，旋转网格（水平、竖直方向上的 4 个位置各不相同），
+// 接近水平或竖直的边也能得到 5 级覆盖
+static const int MSAA_SAMPLES = 4;
+static const int MSAA_SAMPLE_X[MSAA_SAMPLES] = { -32, 96, -96, 32 };
+static const int MSAA_SAMPLE_Y[MSAA_SAMPLES] = { -96, -32, 32, 96 };
+static const int MSAA_SAMPLE_EXTENT = 96; // 采样偏移的最大绝对值
 
-    // 归一化右向量
-    length = sqrtf(right.x * right.x + right.y * right.y + right.z * right.z);
-    if (length > 0) {
-        right.x /= length;
-        right.y /= length;
-        right.z /= length;
+// 深度测试：z 为新像素的深度，old 为深度缓冲中的值
+inline bool depth_test(depth_func_t func, float z, float old)
+{
+    switch (func) {
+    case DEPTH_LESS: return z < old;
+    case DEPTH_LEQUAL: return z <= old;
+    case DEPTH_GREATER: return z > old;
+    case DEPTH_GEQUAL: return z >= old;
+    case DEPTH_EQUAL: return z == old;
+    default: return true;
     }
+}
 
-    // 计算上向量 (up = right × forward)
-    vec4_t new_up = {
-        right.y * forward.z - right.z * forward.y,
-        right.z * forward.x - right.x * forward.z,
-        right.x * forward.y - right.y * forward.x,
-        0.0f
-    };
+// 光栅化计数（统计用），为空时不计数
+typedef struct {
+    unsigned long long tested;      // 在三角形内的像素
+    unsigned long long written;     // 通过深度测试并写入的像素
+    unsigned long long hiz_blocks_culled;
+} fill_counts_t;
 
-    // 构建视图矩阵 (右手坐标系，相机看向 -z 方向)
-    // 旋转部分
-    view->m[0][0] = right.x;
-    view->m[0][1] = new_up.x;
-    view->m[0][2] = -forward.x;
-    view->m[0][3] = 0.0f;
+// 三角形建立阶段的结果：光栅化时只需要它，不再访问原始顶点
+// 深度和混合状态在建立时记录下来，分块模式下延后光栅化也使用提交时的状态
+typedef struct triangle_setup_t {
+    edge_t e[3];
+    int min_x, max_x, min_y, max_y; // 已限制在屏幕范围（启用裁剪测试时为 scissor）内的边界框
+    unsigned int clr;
 
-    view->m[1][0] = right.y;
-    view->m[1][1] = new_up.y;
-    view->m[1][2] = -forward.y;
-    view->m[1][3] = 0.0f;
+    // 深度平面：(zx, zy) 为吸附后的顶点 1 所在的像素，z0 为该像素中心的深度。
+    // 像素 (x, y) 的深度为 depth_row(ts, y) + dzdx * (x - zx)，所有填充路径（标量、SSE2、AVX2、多重采样、着色）
+    // 都按这一表达式逐像素求值，不做递推，输出与所走的路径无关
+    float z0, dzdx, dzdy;
+    int zx, zy;
+    float zmin, zmax; // 顶点深度范围
+    depth_func_t depth_func;
+    blend_mode_t blend_mode;
+    bool edges32; // 边函数在边界框内（含 SIMD 尾部通道）都在 int32 范围内，可以直接用 32 位整数步进
+    bool depth_write;
 
-    view->m[2][0] = right.z;
-    view->m[2][1] = new_up.z;
-    view->m[2][2] = -forward.z;
-    view->m[2][3] = 0.0f;
+    // 多重采样：采样 s 处边 i 的值为像素中心的值加 sample_dw[i][s]（精确，含填充规则），深度为像素中心的值加 sample_dz[s]；
+    // 未启用 MSAA 时全为 0
+    int sample_dw[3][MSAA_SAMPLES];
+    float sample_dz[MSAA_SAMPLES];
 
-    // 平移部分 (将世界坐标转换到相机坐标)
-    view->m[3][0] = -(right.x * eye->x + right.y * eye->y + right.z * eye->z);
-    view->m[3][1] = -(new_up.x * eye->x + new_up.y * eye->y + new_up.z * eye->z);
-    view->m[3][2] = forward.x * eye->x + forward.y * eye->y + forward.z * eye->z;
-    view->m[3][3] = 1.0f;
+    // 着色三角形（triangle_shaded）分箱后由 shade_fill 光栅化，payload 为属性平面和着色器在 binner 中的位置；
+    // 纯色三角形 shade_fill 为空
+    void (*shade_fill)(device_t* device, const struct triangle_setup_t* ts, const void* payload,
+                       int x0, int y0, int x1, int y1, fill_counts_t* counts);
+    size_t payload;
+} triangle_setup_t;
+
+// 深度平面在任意点 (px, py) 的值，只用于 Hi-Z 的块深度范围；像素的深度由 depth_row、depth_pixel 求出
+inline float depth_eval(const triangle_setup_t* ts, float px, float py)
+{
+    return ts->z0 + ts->dzdx * (px - ((float)ts->zx + 0.5f)) + ts->dzdy * (py - ((float)ts->zy + 0.5f));
 }
 
-inline void matrix_perspective_fov(matrix_t* projection, float fovY, float aspect, float zn, float zf)
+// 第 y 行的深度基值：像素 (zx, y) 中心的深度
+inline float depth_row(const triangle_setup_t* ts, int y)
 {
-    // 清除矩阵
-    for (int i = 0; i < 4; i++) {
-        for (int j = 0; j < 4; j++) {
-            projection->m[i][j] = 0.0f;
+    return ts->z0 + ts->dzdy * (float)(y - ts->zy);
+}
+
+// 第 y 行像素 x 中心的深度，zr 为 depth_row(ts, y)。x - zx 是整数，转换为浮点数是精确的，
+// SIMD 路径按通道做同样的一次乘法和一次加法，结果逐位相同
+inline float depth_pixel(const triangle_setup_t* ts, float zr, int x)
+{
+    return zr + ts->dzdx * (float)(x - ts->zx);
+}
+
+// 建立三角形，退化、完全在屏幕外或坐标超出定点范围时返回 false。
+// 顶点先吸附到亚像素网格，面积、边界框和边函数都由定点坐标精确计算，深度平面也以吸附后的位置为准
+inline bool triangle_setup(triangle_setup_t* ts, const device_t* device,
+                           const vec4_t* v1, const vec4_t* v2, const vec4_t* v3, unsigned int clr)
+{
+    if (!subpixel_in_range(v1, v2, v3)) {
+        return false;
+    }
+    int x1 = subpixel_snap(v1->x), y1 = subpixel_snap(v1->y);
+    int x2 = subpixel_snap(v2->x), y2 = subpixel_snap(v2->y);
+    int x3 = subpixel_snap(v3->x), y3 = subpixel_snap(v3->y);
+
+    // 整个三角形的有向面积（亚像素单位），为 0 时是退化三角形，不绘制
+    long long area = (long long)(x2 - x1) * (y3 - y1) - (long long)(y2 - y1) * (x3 - x1);
+    if (area == 0) {
+        return false;
+    }
+
+    // 两种绕序都接受：负面积时交换 v2、v3，统一为正面积再建立边函数
+    if (area < 0) {
+        std::swap(v2, v3);
+        std::swap(x2, x3);
+        std::swap(y2, y3);
+        area = -area;
+    }
+
+    // 计算三角形的边界框（只包含像素中心 x * 256 + 128 落在三角形范围内的像素），并限制在屏幕范围内；
+    // 多重采样时包含任一采样点落在范围内的像素
+    const int half = SUBPIXEL_ONE / 2;
+    const int extent = device->msaa ? MSAA_SAMPLE_EXTENT : 0;
+    int min_x = (std::min(std::min(x1, x2), x3) - half - extent + SUBPIXEL_ONE - 1) >> SUBPIXEL_BITS;
+    int max_x = (std::max(std::max(x1, x2), x3) - half + extent) >> SUBPIXEL_BITS;
+    int min_y = (std::min(std::min(y1, y2), y3) - half - extent + SUBPIXEL_ONE - 1) >> SUBPIXEL_BITS;
+    int max_y = (std::max(std::max(y1, y2), y3) - half + extent) >> SUBPIXEL_BITS;
+    rect_t bounds = scissor_rect(device);
+    ts->min_x = std::max(min_x, bounds.x0);
+    ts->max_x = std::min(max_x, bounds.x1);
+    ts->min_y = std::max(min_y, bounds.y0);
+    ts->max_y = std::min(max_y, bounds.y1);
+    if (ts->min_x > ts->max_x || ts->min_y > ts->max_y) {
+        return false;
+    }
+
+    // 每个三角形只建立一次边函数
+    edge_setup(&ts->e[0], x2, y2, x3, y3);
+    edge_setup(&ts->e[1], x3, y3, x1, y1);
+    edge_setup(&ts->e[2], x1, y1, x2, y2);
+    const int edge_x[3] = { x2, x3, x1 }, edge_y[3] = { y2, y3, y1 };
+    for (int i = 0; i < 3; i++) {
+        for (int k = 0; k < MSAA_SAMPLES; k++) {
+            ts->sample_dw[i][k] = device->msaa ? (int)(edge_constant(&ts->e[i], edge_x[i], edge_y[i], MSAA_SAMPLE_X[k], MSAA_SAMPLE_Y[k]) - ts->e[i].c) : 0;
+        }
+    }
+    ts->clr = clr;
+    // 边函数是线性的，极值在边界框的角上；右侧多算 8 个像素，覆盖 SIMD 路径超出行尾的通道
+    const long long limit = 1 << 30;
+    ts->edges32 = true;
+    for (int i = 0; i < 3; i++) {
+        const edge_t* e = &ts->e[i];
+        long long w[4] = { edge_eval(e, ts->min_x, ts->min_y), edge_eval(e, ts->max_x + 8, ts->min_y),
+                           edge_eval(e, ts->min_x, ts->max_y), edge_eval(e, ts->max_x + 8, ts->max_y) };
+        for (int k = 0; k < 4; k++) {
+            ts->edges32 = ts->edges32 && w[k] > -limit && w[k] < limit;
         }
     }
 
-    // 计算投影参数
-    float yScale = 1.0f / tanf(fovY * 0.5f); // cot(fovY/2)
-    float xScale = yScale / aspect;
+    // 透视除法后的 z（即 z/w）在屏幕空间中是线性的，按平面方程插值就是透视正确的深度
+    const float scale = 1.0f / (float)SUBPIXEL_ONE;
+    float dx2 = (float)(x2 - x1) * scale, dy2 = (float)(y2 - y1) * scale, dz2 = v2->z - v1->z;
+    float dx3 = (float)(x3 - x1) * scale, dy3 = (float)(y3 - y1) * scale, dz3 = v3->z - v1->z;
+    float farea = (float)area * (scale * scale);
+    ts->dzdx = (dz2 * dy3 - dz3 * dy2) / farea;
+    ts->dzdy = (dz3 * dx2 - dz2 * dx3) / farea;
+    ts->zx = x1 >> SUBPIXEL_BITS;
+    ts->zy = y1 >> SUBPIXEL_BITS;
+    ts->z0 = v1->z + ts->dzdx * ((float)(ts->zx * SUBPIXEL_ONE + SUBPIXEL_ONE / 2 - x1) * scale) +
+             ts->dzdy * ((float)(ts->zy * SUBPIXEL_ONE + SUBPIXEL_ONE / 2 - y1) * scale);
+    for (int k = 0; k < MSAA_SAMPLES; k++) {
+        ts->sample_dz[k] = device->msaa ? (ts->dzdx * (float)MSAA_SAMPLE_X[k] + ts->dzdy * (float)MSAA_SAMPLE_Y[k]) * scale : 0.0f;
+    }
+    ts->zmin = fminf(fminf(v1->z, v2->z), v3->z);
+    ts->zmax = fmaxf(fmaxf(v1->z, v2->z), v3->z);
+    ts->depth_func = device->depth_func;
+    ts->depth_write = !device->depth_readonly;
+    ts->blend_mode = device->blend_mode;
+    ts->shade_fill = nullptr;
+    ts->payload = 0;
+    return true;
+}
 
-    // 构建左手透视投影矩阵    左手系：+Z 指向屏幕内
-    projection->m[0][0] = xScale; // 缩放 x 坐标
-    projection->m[1][1] = yScale; // 缩放 y 坐标
-    projection->m[2][2] = zf / (zf - zn); // 深度映射
-    projection->m[2][3] = 1.0f; // 透视除法
-    projection->m[3][2] = -zn * zf / (zf - zn); // 深度平移
+inline int bit_count(unsigned int v)
+{
+    v = v - ((v >> 1) & 0x55555555u);
+    v = (v & 0x33333333u) + ((v >> 2) & 0x33333333u);
+    return (int)((((v + (v >> 4)) & 0x0F0F0F0Fu) * 0x01010101u) >> 24);
 }
 
-// 矩阵乘法：result = a * b
-inline void matrix_multiply(matrix_t* result, const matrix_t* a, const matrix_t* b)
+// v / 255 四舍五入，v 不超过 255 * 255
+inline unsigned int blend_div255(unsigned int v)
 {
-    for (int i = 0; i < 4; i++) {
-        for (int j = 0; j < 4; j++) {
-            result->m[i][j] = 0;
-            for (int k = 0; k < 4; k++) {
-                result->m[i][j] += a->m[i][k] * b->m[k][j];
-            }
+    v += 128;
+    return (v + (v >> 8)) >> 8;
+}
+
+// 标量混合：src 按 mode 合成到 dst 上。alpha 通道的源系数为 1（BLEND_MULTIPLY 为 0），其余通道为源 alpha
+inline unsigned int blend_pixel(unsigned int src, unsigned int dst, blend_mode_t mode)
+{
+    unsigned int a = src >> 24;
+    unsigned int out = 0;
+    for (int shift = 0; shift < 32; shift += 8) {
+        unsigned int s = (src >> shift) & 0xFF, d = (dst >> shift) & 0xFF;
+        unsigned int f = shift == 24 ? 255 : a;
+        unsigned int c;
+        switch (mode) {
+        case BLEND_OVER: c = blend_div255(s * f + d * (255 - a)); break;
+        case BLEND_ADD: c = std::min(d + blend_div255(s * f), 255u); break;
+        case BLEND_MULTIPLY:
+            f = shift == 24 ? 0 : a;
+            c = blend_div255(blend_div255(s * f + 255 * (255 - f)) * d);
+            break;
+        default: c = s; break;
         }
+        out |= c << shift;
     }
+    return out;
 }
 
-// 向量与矩阵乘法：result = v * m
-inline void vector_transform(vec4_t* result, const vec4_t* v, const matrix_t* m)
+#ifdef MICRO3D_SSE2
+// SIMD 混合：像素的 4 个通道扩展为 16 位后一起计算，乘积和不超过 255 * 255，不会溢出 16 位；
+// 加法的结果最大为 510，打包回 8 位时饱和
+inline __m128i blend_div255_sse2(__m128i v)
 {
-    result->x = v->x * m->m[0][0] + v->y * m->m[1][0] + v->z * m->m[2][0] + v->w * m->m[3][0];
-    result->y = v->x * m->m[0][1] + v->y * m->m[1][1] + v->z * m->m[2][1] + v->w * m->m[3][1];
-    result->z = v->x * m->m[0][2] + v->y * m->m[1][2] + v->z * m->m[2][2] + v->w * m->m[3][2];
-    result->w = v->x * m->m[0][3] + v->y * m->m[1][3] + v->z * m->m[2][3] + v->w * m->m[3][3];
+    v = _mm_add_epi16(v, _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(v, _mm_srli_epi16(v, 8)), 8);
 }
 
-// 透视除法：将齐次坐标转换为屏幕坐标
-inline void perspective_divide(vec4_t* v)
+// 2 个像素（8 个 16 位通道，每个像素为 b、g、r、a）的混合
+inline __m128i blend_epi16_sse2(__m128i s, __m128i d, blend_mode_t mode)
 {
-    if (v->w != 0.0f) {
-        v->x /= v->w;
-        v->y /= v->w;
-        v->z /= v->w;
+    const __m128i alpha_lanes = _mm_set_epi16(255, 0, 0, 0, 255, 0, 0, 0);
+    const __m128i full = _mm_set1_epi16(255);
+    __m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s, 0xFF), 0xFF);
+    switch (mode) {
+    case BLEND_OVER:
+        return blend_div255_sse2(_mm_add_epi16(_mm_mullo_epi16(s, _mm_or_si128(a, alpha_lanes)),
+                                               _mm_mullo_epi16(d, _mm_sub_epi16(full, a))));
+    case BLEND_ADD:
+        return _mm_add_epi16(d, blend_div255_sse2(_mm_mullo_epi16(s, _mm_or_si128(a, alpha_lanes))));
+    case BLEND_MULTIPLY: {
+        __m128i f = _mm_andnot_si128(alpha_lanes, a);
+        __m128i t = blend_div255_sse2(_mm_add_epi16(_mm_mullo_epi16(s, f), _mm_mullo_epi16(full, _mm_sub_epi16(full, f))));
+        return blend_div255_sse2(_mm_mullo_epi16(t, d));
+    }
+    default: return s;
     }
 }
 
-// 将标准化设备坐标转换为屏幕坐标
-inline void viewport_transform(vec4_t* v, int screen_width, int screen_height)
+// 4 个像素的混合
+inline __m128i blend_sse2(__m128i src, __m128i dst, blend_mode_t mode)
 {
-    v->x = (v->x + 1.0f) * 0.5f * screen_width;
-    v->y = (1.0f - v->y) * 0.5f * screen_height; // Y轴翻转
+    const __m128i zero = _mm_setzero_si128();
+    __m128i lo = blend_epi16_sse2(_mm_unpacklo_epi8(src, zero), _mm_unpacklo_epi8(dst, zero), mode);
+    __m128i hi = blend_epi16_sse2(_mm_unpackhi_epi8(src, zero), _mm_unpackhi_epi8(dst, zero), mode);
+    return _mm_packus_epi16(lo, hi);
 }
 
-// 创建单位矩阵
-inline void matrix_identity(matrix_t* m)
+MICRO3D_TARGET_AVX2 inline __m256i blend_div255_avx2(__m256i v)
 {
-    for (int i = 0; i < 4; i++) {
-        for (int j = 0; j < 4; j++) {
-            m->m[i][j] = (i == j) ? 1.0f : 0.0f;
-        }
-    }
+    v = _mm256_add_epi16(v, _mm256_set1_epi16(128));
+    return _mm256_srli_epi16(_mm256_add_epi16(v, _mm256_srli_epi16(v, 8)), 8);
 }
 
-// 创建平移矩阵
-inline void matrix_translation(matrix_t* m, float tx, float ty, float tz)
+MICRO3D_TARGET_AVX2 inline __m256i blend_epi16_avx2(__m256i s, __m256i d, blend_mode_t mode)
 {
-    matrix_identity(m);
+    const __m256i alpha_lanes = _mm256_set_epi16(255, 0, 0, 0, 255, 0, 0, 0, 255, 0, 0, 0, 255, 0, 0, 0);
+    const __m256i full = _mm256_set1_epi16(255);
+    __m256i a = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(s, 0xFF), 0xFF);
+    switch (mode) {
+    case BLEND_OVER:
+        return blend_div255_avx2(_mm256_add_epi16(_mm256_mullo_epi16(s, _mm256_or_si256(a, alpha_lanes)),
+                                                  _mm256_mullo_epi16(d, _mm256_sub_epi16(full, a))));
+    case BLEND_ADD:
+        return _mm256_add_epi16(d, blend_div255_avx2(_mm256_mullo_epi16(s, _mm256_or_si256(a, alpha_lanes))));
+    case BLEND_MULTIPLY: {
+        __m256i f = _mm256_andnot_si256(alpha_lanes, a);
+        __m256i t = blend_div255_avx2(_mm256_add_epi16(_mm256_mullo_epi16(s, f), _mm256_mullo_epi16(full, _mm256_sub_epi16(full, f))));
+        return blend_div255_avx2(_mm256_mullo_epi16(t, d));
+    }
+    default: return s;
+    }
+}
+
+// 8 个像素的混合：解包和打包都在 128 位的两半内进行，像素顺序不变
+MICRO3D_TARGET_AVX2 inline __m256i blend_avx2(__m256i src, __m256i dst, blend_mode_t mode)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i lo = blend_epi16_avx2(_mm256_unpacklo_epi8(src, zero), _mm256_unpacklo_epi8(dst, zero), mode);
+    __m256i hi = blend_epi16_avx2(_mm256_unpackhi_epi8(src, zero), _mm256_unpackhi_epi8(dst, zero), mode);
+    return _mm256_packus_epi16(lo, hi);
+}
+#endif
+
+// 把 src[k] 合成到 dst[k]（只处理 mask 第 k 位为 1 的像素，k = 0..3）；
+// full 为 true 时 4 个像素都可以读写，一次 SIMD 混合后按掩码写回
+inline void blend_masked4(unsigned int* dst, const unsigned int* src, int mask, bool full, blend_mode_t mode)
+{
+#ifdef MICRO3D_SSE2
+    if (full) {
+        const __m128i bits = _mm_set_epi32(8, 4, 2, 1);
+        __m128i m = _mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(mask), bits), bits);
+        __m128i old = _mm_loadu_si128((const __m128i*)dst);
+        __m128i c = blend_sse2(_mm_loadu_si128((const __m128i*)src), old, mode);
+        _mm_storeu_si128((__m128i*)dst, _mm_or_si128(_mm_and_si128(m, c), _mm_andnot_si128(m, old)));
+        return;
+    }
+#else
+    (void)full;
+#endif
+    for (int k = 0; k < 4; k++) {
+        if (mask & (1 << k)) {
+            dst[k] = blend_pixel(src[k], dst[k], mode);
+        }
+    }
+}
+
+// 标量路径：填充一行中 [x, x_end] 的像素，w0/w1/w2 为 x 处像素的边函数值，zr 为本行的深度基值 depth_row
+// zrow 为空时不做深度测试；深度测试在写颜色之前完成（early-Z）
+inline void span_fill_scalar(const triangle_setup_t* ts, unsigned int* row, float* zrow, int x, int x_end,
+                             long long w0, long long w1, long long w2, float zr, fill_counts_t* counts)
+{
+    const edge_t* e = ts->e;
+    for (; x <= x_end; x++) {
+        // 检查像素是否在三角形内
+        if (edges_inside(w0, w1, w2)) {
+            float z = depth_pixel(ts, zr, x);
+            bool pass = !zrow || depth_test(ts->depth_func, z, zrow[x]);
+            if (pass) {
+                if (zrow && ts->depth_write) {
+                    zrow[x] = z;
+                }
+                row[x] = ts->blend_mode == BLEND_NONE ? ts->clr : blend_pixel(ts->clr, row[x], ts->blend_mode);
+            }
+            if (counts) {
+                counts->tested++;
+                counts->written += pass;
+            }
+        }
+        w0 += e[0].a;
+        w1 += e[1].a;
+        w2 += e[2].a;
+    }
+}
+
+#ifdef MICRO3D_SSE2
+// 运行时检测 CPU 是否支持 AVX2（同时要求操作系统保存 YMM 寄存器）
+inline bool cpu_has_avx2()
+{
+#if defined(_MSC_VER)
+    static const bool has = []() {
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7) {
+            return false;
+        }
+        __cpuid(info, 1);
+        bool osxsave = (info[2] & (1 << 27)) != 0;
+        bool avx = (info[2] & (1 << 28)) != 0;
+        if (!osxsave || !avx || (_xgetbv(0) & 6) != 6) {
+            return false;
+        }
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+    }();
+#else
+    static const bool has = __builtin_cpu_supports("avx2");
+#endif
+    return has;
+}
+
+// 4 个通道的覆盖掩码：w0、w1、w2 都不小于 0（按位或之后符号位为 0）
+inline __m128 edges_inside_sse2(__m128i w0, __m128i w1, __m128i w2)
+{
+    return _mm_castsi128_ps(_mm_cmpgt_epi32(_mm_or_si128(_mm_or_si128(w0, w1), w2), _mm_set1_epi32(-1)));
+}
+
+inline __m128 depth_test_sse2(depth_func_t func, __m128 z, __m128 old)
+{
+    switch (func) {
+    case DEPTH_LESS: return _mm_cmplt_ps(z, old);
+    case DEPTH_LEQUAL: return _mm_cmple_ps(z, old);
+    case DEPTH_GREATER: return _mm_cmpgt_ps(z, old);
+    case DEPTH_GEQUAL: return _mm_cmpge_ps(z, old);
+    case DEPTH_EQUAL: return _mm_cmpeq_ps(z, old);
+    default: return _mm_castsi128_ps(_mm_set1_epi32(-1));
+    }
+}
+
+// SSE2 路径：每次测试 4x1 个像素，按覆盖掩码写入；不足 4 个的尾部交给标量路径。
+// 边函数值通常直接用 32 位整数通道步进；超出 int32 范围的三角形（远在屏幕外的顶点）以 64 位逐组累加，
+// 每组限制到 int32 后再加上各通道的偏移 a * 0..3。深度按 depth_pixel 逐通道求值
+inline void span_fill_sse2(const triangle_setup_t* ts, unsigned int* row, float* zrow, int x, int x_end,
+                           long long w0, long long w1, long long w2, float zr, fill_counts_t* counts)
+{
+    const edge_t* e = ts->e;
+    __m128i lane0 = _mm_set_epi32(e[0].a * 3, e[0].a * 2, e[0].a, 0);
+    __m128i lane1 = _mm_set_epi32(e[1].a * 3, e[1].a * 2, e[1].a, 0);
+    __m128i lane2 = _mm_set_epi32(e[2].a * 3, e[2].a * 2, e[2].a, 0);
+    bool fast = ts->edges32;
+    __m128i vw0 = _mm_add_epi32(_mm_set1_epi32((int)w0), lane0);
+    __m128i vw1 = _mm_add_epi32(_mm_set1_epi32((int)w1), lane1);
+    __m128i vw2 = _mm_add_epi32(_mm_set1_epi32((int)w2), lane2);
+    __m128i step0 = _mm_set1_epi32(e[0].a * 4);
+    __m128i step1 = _mm_set1_epi32(e[1].a * 4);
+    __m128i step2 = _mm_set1_epi32(e[2].a * 4);
+    // 通道 k 的 x - zx（整数，精确表示为浮点数），每组加 4
+    __m128 vx = _mm_cvtepi32_ps(_mm_add_epi32(_mm_set1_epi32(x - ts->zx), _mm_set_epi32(3, 2, 1, 0)));
+    const __m128 vzr = _mm_set1_ps(zr), vdzdx = _mm_set1_ps(ts->dzdx), xstep = _mm_set1_ps(4.0f);
+    __m128i color = _mm_set1_epi32((int)ts->clr);
+    const blend_mode_t blend = ts->blend_mode;
+
+    int x_begin = x;
+    for (; x + 3 <= x_end; x += 4) {
+        if (!fast) {
+            long long k = x - x_begin;
+            vw0 = _mm_add_epi32(_mm_set1_epi32(edge_clamp(w0 + e[0].a * k)), lane0);
+            vw1 = _mm_add_epi32(_mm_set1_epi32(edge_clamp(w1 + e[1].a * k)), lane1);
+            vw2 = _mm_add_epi32(_mm_set1_epi32(edge_clamp(w2 + e[2].a * k)), lane2);
+        }
+        __m128 m = edges_inside_sse2(vw0, vw1, vw2);
+        if (counts) {
+            counts->tested += bit_count((unsigned int)_mm_movemask_ps(m));
+        }
+        if (zrow && _mm_movemask_ps(m)) {
+            __m128 vz = _mm_add_ps(vzr, _mm_mul_ps(vdzdx, vx));
+            __m128 old = _mm_loadu_ps(zrow + x);
+            m = _mm_and_ps(m, depth_test_sse2(ts->depth_func, vz, old));
+            if (ts->depth_write) {
+                _mm_storeu_ps(zrow + x, _mm_or_ps(_mm_and_ps(m, vz), _mm_andnot_ps(m, old)));
+            }
+        }
+        int bits = _mm_movemask_ps(m);
+        if (counts) {
+            counts->written += bit_count((unsigned int)bits);
+        }
+        if (bits == 0xF && blend == BLEND_NONE) {
+            _mm_storeu_si128((__m128i*)(row + x), color);
+        } else if (bits) {
+            // 4 个像素都在本行范围内，可以安全地读-改-写；混合时 4 个像素一起与原有颜色合成
+            __m128i mi = _mm_castps_si128(m);
+            __m128i old = _mm_loadu_si128((const __m128i*)(row + x));
+            __m128i src = blend == BLEND_NONE ? color : blend_sse2(color, old, blend);
+            _mm_storeu_si128((__m128i*)(row + x), _mm_or_si128(_mm_and_si128(mi, src), _mm_andnot_si128(mi, old)));
+        }
+        vw0 = _mm_add_epi32(vw0, step0);
+        vw1 = _mm_add_epi32(vw1, step1);
+        vw2 = _mm_add_epi32(vw2, step2);
+        vx = _mm_add_ps(vx, xstep);
+    }
+    if (x <= x_end) {
+        long long k = x - x_begin;
+        span_fill_scalar(ts, row, zrow, x, x_end, w0 + e[0].a * k, w1 + e[1].a * k, w2 + e[2].a * k, zr, counts);
+    }
+}
+
+// 8 个通道的覆盖掩码
+MICRO3D_TARGET_AVX2 inline __m256 edges_inside_avx2(__m256i w0, __m256i w1, __m256i w2)
+{
+    return _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_or_si256(_mm256_or_si256(w0, w1), w2), _mm256_set1_epi32(-1)));
+}
+
+// 通道 k 的偏移 a * k
+MICRO3D_TARGET_AVX2 inline __m256i edge_lanes_avx2(int a)
+{
+    return _mm256_mullo_epi32(_mm256_set1_epi32(a), _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0));
+}
+
+MICRO3D_TARGET_AVX2 inline __m256 depth_test_avx2(depth_func_t func, __m256 z, __m256 old)
+{
+    switch (func) {
+    case DEPTH_LESS: return _mm256_cmp_ps(z, old, _CMP_LT_OQ);
+    case DEPTH_LEQUAL: return _mm256_cmp_ps(z, old, _CMP_LE_OQ);
+    case DEPTH_GREATER: return _mm256_cmp_ps(z, old, _CMP_GT_OQ);
+    case DEPTH_GEQUAL: return _mm256_cmp_ps(z, old, _CMP_GE_OQ);
+    case DEPTH_EQUAL: return _mm256_cmp_ps(z, old, _CMP_EQ_OQ);
+    default: return _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+    }
+}
+
+// AVX2 路径：每次测试 8x1 个像素，尾部用 maskload/maskstore 只访问本行范围内的像素
+MICRO3D_TARGET_AVX2 inline void span_fill_avx2(const triangle_setup_t* ts, unsigned int* row, float* zrow, int x, int x_end,
+                                               long long w0, long long w1, long long w2, float zr, fill_counts_t* counts)
+{
+    const edge_t* e = ts->e;
+    const __m256i lane_i = _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+    __m256i lane0 = edge_lanes_avx2(e[0].a);
+    __m256i lane1 = edge_lanes_avx2(e[1].a);
+    __m256i lane2 = edge_lanes_avx2(e[2].a);
+    bool fast = ts->edges32;
+    __m256i vw0 = _mm256_add_epi32(_mm256_set1_epi32((int)w0), lane0);
+    __m256i vw1 = _mm256_add_epi32(_mm256_set1_epi32((int)w1), lane1);
+    __m256i vw2 = _mm256_add_epi32(_mm256_set1_epi32((int)w2), lane2);
+    __m256i step0 = _mm256_set1_epi32(e[0].a * 8);
+    __m256i step1 = _mm256_set1_epi32(e[1].a * 8);
+    __m256i step2 = _mm256_set1_epi32(e[2].a * 8);
+    __m256 vx = _mm256_cvtepi32_ps(_mm256_add_epi32(_mm256_set1_epi32(x - ts->zx), lane_i));
+    const __m256 vzr = _mm256_set1_ps(zr), vdzdx = _mm256_set1_ps(ts->dzdx), xstep = _mm256_set1_ps(8.0f);
+    __m256i color = _mm256_set1_epi32((int)ts->clr);
+    const blend_mode_t blend = ts->blend_mode;
+
+    int x_begin = x;
+    for (; x <= x_end; x += 8) {
+        if (!fast) {
+            long long k = x - x_begin;
+            vw0 = _mm256_add_epi32(_mm256_set1_epi32(edge_clamp(w0 + e[0].a * k)), lane0);
+            vw1 = _mm256_add_epi32(_mm256_set1_epi32(edge_clamp(w1 + e[1].a * k)), lane1);
+            vw2 = _mm256_add_epi32(_mm256_set1_epi32(edge_clamp(w2 + e[2].a * k)), lane2);
+        }
+        __m256 m = edges_inside_avx2(vw0, vw1, vw2);
+        bool full = x + 7 <= x_end;
+        __m256i valid = _mm256_set1_epi32(-1);
+        if (!full) {
+            // 尾部：屏蔽超出 x_end 的通道，不读也不写本行范围以外的像素
+            valid = _mm256_cmpgt_epi32(_mm256_set1_epi32(x_end - x + 1), lane_i);
+            m = _mm256_and_ps(m, _mm256_castsi256_ps(valid));
+        }
+        if (counts) {
+            counts->tested += bit_count((unsigned int)_mm256_movemask_ps(m));
+        }
+        if (zrow && _mm256_movemask_ps(m)) {
+            __m256 vz = _mm256_add_ps(vzr, _mm256_mul_ps(vdzdx, vx));
+            __m256 old = full ? _mm256_loadu_ps(zrow + x) : _mm256_maskload_ps(zrow + x, valid);
+            m = _mm256_and_ps(m, depth_test_avx2(ts->depth_func, vz, old));
+            if (ts->depth_write) {
+                if (full) {
+                    _mm256_storeu_ps(zrow + x, _mm256_blendv_ps(old, vz, m));
+                } else {
+                    _mm256_maskstore_ps(zrow + x, _mm256_castps_si256(m), vz);
+                }
+            }
+        }
+        __m256i mi = _mm256_castps_si256(m);
+        int bits = _mm256_movemask_ps(m);
+        if (counts) {
+            counts->written += bit_count((unsigned int)bits);
+        }
+        if (full && bits == 0xFF && blend == BLEND_NONE) {
+            _mm256_storeu_si256((__m256i*)(row + x), color);
+        } else if (full && bits) {
+            __m256i old = _mm256_loadu_si256((const __m256i*)(row + x));
+            __m256i src = blend == BLEND_NONE ? color : blend_avx2(color, old, blend);
+            _mm256_storeu_si256((__m256i*)(row + x), _mm256_blendv_epi8(old, src, mi));
+        } else if (bits) {
+            __m256i src = color;
+            if (blend != BLEND_NONE) {
+                src = blend_avx2(color, _mm256_maskload_epi32((const int*)(row + x), mi), blend);
+            }
+            _mm256_maskstore_epi32((int*)(row + x), mi, src);
+        }
+        vw0 = _mm256_add_epi32(vw0, step0);
+        vw1 = _mm256_add_epi32(vw1, step1);
+        vw2 = _mm256_add_epi32(vw2, step2);
+        vx = _mm256_add_ps(vx, xstep);
+    }
+}
+
+// AVX2 每次混合 8 个像素，返回处理过的像素数，不足 8 个的尾部留给调用者
+MICRO3D_TARGET_AVX2 inline int blend_row_avx2(unsigned int* dst, const unsigned int* src, int count, blend_mode_t mode)
+{
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i d = _mm256_loadu_si256((const __m256i*)(dst + i));
+        __m256i s = _mm256_loadu_si256((const __m256i*)(src + i));
+        _mm256_storeu_si256((__m256i*)(dst + i), blend_avx2(s, d, mode));
+    }
+    return i;
+}
+#endif
+
+// 把 count 个源像素按 mode 合成到 dst 上：AVX2 每次 8 个、SSE2 每次 4 个像素，尾部逐像素
+inline void blend_row(unsigned int* dst, const unsigned int* src, int count, blend_mode_t mode)
+{
+    if (mode == BLEND_NONE) {
+        memcpy(dst, src, (size_t)count * sizeof(unsigned int));
+        return;
+    }
+    int i = 0;
+#ifdef MICRO3D_SSE2
+    if (cpu_has_avx2()) {
+        i = blend_row_avx2(dst, src, count, mode);
+    }
+    for (; i + 4 <= count; i += 4) {
+        __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+        __m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+        _mm_storeu_si128((__m128i*)(dst + i), blend_sse2(s, d, mode));
+    }
+#endif
+    for (; i < count; i++) {
+        dst[i] = blend_pixel(src[i], dst[i], mode);
+    }
+}
+
+// 用 32 位值填充 count 个元素（颜色或 float 深度的位模式）。
+// stream 为 true 时使用非临时存储绕过缓存：只适合清除远大于缓存的缓冲，之后的渲染不会马上读它们
+inline void fill_words_scalar(void* dst, uint32_t value, size_t count)
+{
+    unsigned char* p = (unsigned char*)dst;
+    for (size_t i = 0; i < count; i++) {
+        memcpy(p + i * 4, &value, 4);
+    }
+}
+
+#ifdef MICRO3D_SSE2
+inline void fill_words_sse2(void* dst, uint32_t value, size_t count, bool stream)
+{
+    unsigned char* p = (unsigned char*)dst;
+    // 逐个写到 16 字节对齐（缓冲至少 4 字节对齐）
+    size_t head = ((16 - ((uintptr_t)p & 15)) & 15) / 4;
+    head = head < count ? head : count;
+    fill_words_scalar(p, value, head);
+    p += head * 4;
+    count -= head;
+
+    __m128i v = _mm_set1_epi32((int)value);
+    size_t i = 0;
+    if (stream) {
+        for (; i + 16 <= count; i += 16) {
+            _mm_stream_si128((__m128i*)(p + i * 4), v);
+            _mm_stream_si128((__m128i*)(p + i * 4 + 16), v);
+            _mm_stream_si128((__m128i*)(p + i * 4 + 32), v);
+            _mm_stream_si128((__m128i*)(p + i * 4 + 48), v);
+        }
+        _mm_sfence();
+    }
+    for (; i + 4 <= count; i += 4) {
+        _mm_store_si128((__m128i*)(p + i * 4), v);
+    }
+    fill_words_scalar(p + i * 4, value, count - i);
+}
+
+MICRO3D_TARGET_AVX2 inline void fill_words_avx2(void* dst, uint32_t value, size_t count, bool stream)
+{
+    unsigned char* p = (unsigned char*)dst;
+    size_t head = ((32 - ((uintptr_t)p & 31)) & 31) / 4;
+    head = head < count ? head : count;
+    fill_words_scalar(p, value, head);
+    p += head * 4;
+    count -= head;
+
+    __m256i v = _mm256_set1_epi32((int)value);
+    size_t i = 0;
+    if (stream) {
+        for (; i + 32 <= count; i += 32) {
+            _mm256_stream_si256((__m256i*)(p + i * 4), v);
+            _mm256_stream_si256((__m256i*)(p + i * 4 + 32), v);
+            _mm256_stream_si256((__m256i*)(p + i * 4 + 64), v);
+            _mm256_stream_si256((__m256i*)(p + i * 4 + 96), v);
+        }
+        _mm_sfence();
+    }
+    for (; i + 8 <= count; i += 8) {
+        _mm256_store_si256((__m256i*)(p + i * 4), v);
+    }
+    fill_words_scalar(p + i * 4, value, count - i);
+}
+#endif
+
+inline void fill_words(void* dst, uint32_t value, size_t count, bool stream)
+{
+#ifdef MICRO3D_SSE2
+    if (cpu_has_avx2()) {
+        fill_words_avx2(dst, value, count, stream);
+    } else {
+        fill_words_sse2(dst, value, count, stream);
+    }
+#else
+    (void)stream;
+    fill_words_scalar(dst, value, count);
+#endif
+}
+
+inline uint32_t float_bits(float f)
+{
+    uint32_t u;
+    memcpy(&u, &f, 4);
+    return u;
+}
+
+inline float float_from_bits(uint32_t u)
+{
+    float f;
+    memcpy(&f, &u, 4);
+    return f;
+}
+
+// 整个缓冲超过这个大小时清除使用非临时存储（大致为末级缓存的量级）
+static const size_t CLEAR_STREAM_BYTES = 16u << 20;
+
+// 延迟清除：按 tile 记录清除状态。clear_color/clear_depth 只把 tile 标记为待清除，
+// 绘制写入 tile 之前才填充清除值；帧结束时 lazy_clear_resolve 补齐颜色缓冲中没有被写入过的 tile。
+// 已经是清除值且之后没被写过的 tile 下一帧不再填充，大部分为空的帧只为有内容的 tile 付出清除开销
+typedef enum {
+    LAZY_TILE_DIRTY = 0, // 内容未知（被写入过）
+    LAZY_TILE_CLEARED,   // 内容就是当前清除值
+    LAZY_TILE_PENDING    // 等待填充清除值
+} lazy_tile_state_t;
+
+struct lazy_clear_t {
+    int tile_size;
+    int tiles_x, tiles_y;
+    std::vector<unsigned char> color_state;
+    std::vector<unsigned char> depth_state;
+    unsigned int color; // 最近一次清除的值
+    float depth;
+};
+
+// 分块光栅化时 binner 的 tile 大小应为 tile_size 的整数倍，才能在工作线程中并行清除
+inline lazy_clear_t* lazy_clear_create(const device_t* device, int tile_size)
+{
+    lazy_clear_t* lazy = new lazy_clear_t;
+    lazy->tile_size = tile_size;
+    lazy->tiles_x = (device->width + tile_size - 1) / tile_size;
+    lazy->tiles_y = (device->height + tile_size - 1) / tile_size;
+    lazy->color_state.assign(lazy->tiles_x * lazy->tiles_y, LAZY_TILE_DIRTY);
+    lazy->depth_state.assign(lazy->tiles_x * lazy->tiles_y, LAZY_TILE_DIRTY);
+    lazy->color = 0;
+    lazy->depth = 0;
+    return lazy;
+}
+
+inline void lazy_clear_destroy(lazy_clear_t* lazy)
+{
+    delete lazy;
+}
+
+// 把所有 tile 标记为待清除；内容已是同一清除值的 tile 保持不变
+inline void lazy_clear_mark(std::vector<unsigned char>* state, bool same_value)
+{
+    for (size_t i = 0; i < state->size(); i++) {
+        if ((*state)[i] != LAZY_TILE_CLEARED || !same_value) {
+            (*state)[i] = LAZY_TILE_PENDING;
+        }
+    }
+}
+
+// 用清除值填充一个 tile（在缓存中完成，马上就要在其上绘制）
+inline void lazy_clear_fill(device_t* device, int tile, bool depth)
+{
+    const lazy_clear_t* lazy = device->lazy_clear;
+    int x0 = (tile % lazy->tiles_x) * lazy->tile_size;
+    int y0 = (tile / lazy->tiles_x) * lazy->tile_size;
+    int x1 = std::min(x0 + lazy->tile_size, device->width);
+    int y1 = std::min(y0 + lazy->tile_size, device->height);
+    for (int y = y0; y < y1; y++) {
+        size_t offset = (size_t)y * device->width + x0;
+        if (depth) {
+            fill_words(device->zbuffer + offset, float_bits(lazy->depth), x1 - x0, false);
+        } else {
+            fill_words(device->buffer + offset, lazy->color, x1 - x0, false);
+        }
+    }
+}
+
+// 即将写入像素矩形 [x0, x1] x [y0, y1]（可超出屏幕）：先清除其中待清除的 tile，并标记为已写入。
+// 已写入的 tile 只读状态不写，不同线程处理互不重叠的 tile 时无需加锁
+inline void lazy_clear_touch(device_t* device, int x0, int y0, int x1, int y1)
+{
+    lazy_clear_t* lazy = device->lazy_clear;
+    int tx0 = std::max(x0, 0) / lazy->tile_size;
+    int ty0 = std::max(y0, 0) / lazy->tile_size;
+    int tx1 = std::min(x1, device->width - 1) / lazy->tile_size;
+    int ty1 = std::min(y1, device->height - 1) / lazy->tile_size;
+    for (int ty = ty0; ty <= ty1; ty++) {
+        for (int tx = tx0; tx <= tx1; tx++) {
+            int tile = ty * lazy->tiles_x + tx;
+            unsigned char* color = &lazy->color_state[tile];
+            if (*color != LAZY_TILE_DIRTY) {
+                if (*color == LAZY_TILE_PENDING) {
+                    lazy_clear_fill(device, tile, false);
+                }
+                *color = LAZY_TILE_DIRTY;
+            }
+            unsigned char* depth = &lazy->depth_state[tile];
+            if (*depth != LAZY_TILE_DIRTY) {
+                if (*depth == LAZY_TILE_PENDING && device->zbuffer) {
+                    lazy_clear_fill(device, tile, true);
+                }
+                *depth = LAZY_TILE_DIRTY;
+            }
+        }
+    }
+}
+
+// 帧结束时（显示或输出颜色缓冲之前）填充仍待清除的 tile。深度缓冲通常不会被读取，
+// depth 为 false 时不处理，其中没被写入过的 tile 保留旧内容
+inline void lazy_clear_resolve(device_t* device, bool depth)
+{
+    lazy_clear_t* lazy = device->lazy_clear;
+    if (!lazy) {
+        return;
+    }
+    for (size_t i = 0; i < lazy->color_state.size(); i++) {
+        if (lazy->color_state[i] == LAZY_TILE_PENDING) {
+            lazy_clear_fill(device, (int)i, false);
+            lazy->color_state[i] = LAZY_TILE_CLEARED;
+        }
+        if (depth && device->zbuffer && lazy->depth_state[i] == LAZY_TILE_PENDING) {
+            lazy_clear_fill(device, (int)i, true);
+            lazy->depth_state[i] = LAZY_TILE_CLEARED;
+        }
+    }
+}
+
+// 分层深度（Hi-Z）：把深度缓冲划分为 8x8 的块，记录每块深度的保守最大值。
+// 对 DEPTH_LESS/DEPTH_LEQUAL，新图元在块内的最小深度不小于该值时，块内像素必然无法通过深度测试，
+// 整块（或整个图元）可以在逐像素测试之前跳过
+static const int HIZ_BLOCK_SIZE = 8;
+
+struct hiz_t {
+    int blocks_x, blocks_y;
+    std::vector<float> zmax;
+};
+
+inline hiz_t* hiz_create(const device_t* device)
+{
+    hiz_t* hiz = new hiz_t;
+    hiz->blocks_x = (device->width + HIZ_BLOCK_SIZE - 1) / HIZ_BLOCK_SIZE;
+    hiz->blocks_y = (device->height + HIZ_BLOCK_SIZE - 1) / HIZ_BLOCK_SIZE;
+    hiz->zmax.assign(hiz->blocks_x * hiz->blocks_y, 1.0f);
+    return hiz;
+}
+
+inline void hiz_destroy(hiz_t* hiz)
+{
+    delete hiz;
+}
+
+// 多重采样抗锯齿（4x MSAA）：每个像素 4 个采样点，覆盖和深度逐采样计算，着色每个像素只做一次。
+// 颜色按 8x8 的 tile 压缩存储：完整覆盖的像素只有一个颜色，就保存在 device->buffer 中；
+// 只有部分覆盖的边缘像素才展开为 4 个采样颜色，保存在 tile 首次展开时从采样池分配的块中。
+// 深度逐采样保存、不压缩，device->zbuffer 非空只表示开启深度测试，其内容在 MSAA 模式下不使用（Hi-Z 照常使用）。
+// 帧结束时 msaa_resolve 把展开像素的采样平均后写回 device->buffer
+static const int MSAA_TILE_SIZE = 8;
+static const int MSAA_PAGE_TILES = 64; // 采样池每页的块数
+
+typedef struct {
+    uint64_t expanded;     // 第 i 位：tile 内第 i 个像素（行优先）已展开为 4 个采样
+    unsigned int* samples; // 64 个像素 x 4 个采样，首次展开时分配
+} msaa_tile_t;
+
+struct msaa_t {
+    int tiles_x, tiles_y;
+    std::vector<msaa_tile_t> tiles;
+    std::vector<float> zbuffer; // 逐采样深度：像素 (x, y) 的采样 s 位于 (y * width + x) * 4 + s
+    // 采样池：按页分配，页在 msaa_destroy 之前不释放也不移动，清除颜色时整体回收。
+    // 分块光栅化时各线程处理互不重叠的 tile（分箱 tile 是 8 的整数倍），只有分配需要加锁
+    std::vector<std::vector<unsigned int> > pages;
+    size_t blocks_used;
+    std::mutex mutex;
+};
+
+// 在设置好 zbuffer（如需深度测试）之后创建
+inline msaa_t* msaa_create(const device_t* device)
+{
+    msaa_t* msaa = new msaa_t;
+    msaa->tiles_x = (device->width + MSAA_TILE_SIZE - 1) / MSAA_TILE_SIZE;
+    msaa->tiles_y = (device->height + MSAA_TILE_SIZE - 1) / MSAA_TILE_SIZE;
+    msaa_tile_t empty = { 0, nullptr };
+    msaa->tiles.assign(msaa->tiles_x * msaa->tiles_y, empty);
+    if (device->zbuffer) {
+        msaa->zbuffer.assign((size_t)device->width * device->height * MSAA_SAMPLES, 1.0f);
+    }
+    msaa->blocks_used = 0;
+    return msaa;
+}
+
+inline void msaa_destroy(msaa_t* msaa)
+{
+    delete msaa;
+}
+
+// 采样颜色占用的内存（字节），不含逐采样深度
+inline size_t msaa_sample_bytes(const msaa_t* msaa)
+{
+    return msaa->blocks_used * MSAA_TILE_SIZE * MSAA_TILE_SIZE * MSAA_SAMPLES * sizeof(unsigned int);
+}
+
+// 展开为 4 个采样的像素数
+inline size_t msaa_expanded_pixels(const msaa_t* msaa)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < msaa->tiles.size(); i++) {
+        count += bit_count((unsigned int)msaa->tiles[i].expanded) + bit_count((unsigned int)(msaa->tiles[i].expanded >> 32));
+    }
+    return count;
+}
+
+inline unsigned int* msaa_alloc_block(msaa_t* msaa)
+{
+    std::lock_guard<std::mutex> lock(msaa->mutex);
+    const size_t block = MSAA_TILE_SIZE * MSAA_TILE_SIZE * MSAA_SAMPLES;
+    size_t page = msaa->blocks_used / MSAA_PAGE_TILES;
+    if (page == msaa->pages.size()) {
+        msaa->pages.push_back(std::vector<unsigned int>(block * MSAA_PAGE_TILES));
+    }
+    unsigned int* samples = &msaa->pages[page][(msaa->blocks_used % MSAA_PAGE_TILES) * block];
+    msaa->blocks_used++;
+    return samples;
+}
+
+// 把颜色写入像素 (x, y) 中 mask 指定的采样（第 s 位为采样 s）。
+// 4 个采样都写入时像素恢复为压缩存储；部分写入时先把像素当前的颜色复制到 4 个采样再展开
+inline void msaa_write(device_t* device, int x, int y, int mask, unsigned int clr)
+{
+    msaa_tile_t* tile = &device->msaa->tiles[(y / MSAA_TILE_SIZE) * device->msaa->tiles_x + x / MSAA_TILE_SIZE];
+    int bit = (y % MSAA_TILE_SIZE) * MSAA_TILE_SIZE + x % MSAA_TILE_SIZE;
+    unsigned int* pixel = &device->buffer[(size_t)y * device->width + x];
+    if (mask == 0xF) {
+        *pixel = clr;
+        tile->expanded &= ~((uint64_t)1 << bit);
+        return;
+    }
+    if (!tile->samples) {
+        tile->samples = msaa_alloc_block(device->msaa);
+    }
+    unsigned int* samples = tile->samples + bit * MSAA_SAMPLES;
+    if (!((tile->expanded >> bit) & 1)) {
+        for (int s = 0; s < MSAA_SAMPLES; s++) {
+            samples[s] = *pixel;
+        }
+        tile->expanded |= (uint64_t)1 << bit;
+    }
+    for (int s = 0; s < MSAA_SAMPLES; s++) {
+        if (mask & (1 << s)) {
+            samples[s] = clr;
+        }
+    }
+    // 共享边两侧的三角形颜色相同时，两次部分写入后 4 个采样又相同，像素重新压缩
+    if (samples[0] == clr && samples[1] == clr && samples[2] == clr && samples[3] == clr) {
+        *pixel = clr;
+        tile->expanded &= ~((uint64_t)1 << bit);
+    }
+}
+
+// 按 mode 把颜色合成到像素 (x, y) 中 mask 指定的采样。压缩存储的像素被完整覆盖时只合成一次，
+// 否则先展开，再逐采样合成；mode 为 BLEND_NONE 时与 msaa_write 相同
+inline void msaa_blend(device_t* device, int x, int y, int mask, unsigned int clr, blend_mode_t mode)
+{
+    if (mode == BLEND_NONE) {
+        msaa_write(device, x, y, mask, clr);
+        return;
+    }
+    msaa_tile_t* tile = &device->msaa->tiles[(y / MSAA_TILE_SIZE) * device->msaa->tiles_x + x / MSAA_TILE_SIZE];
+    int bit = (y % MSAA_TILE_SIZE) * MSAA_TILE_SIZE + x % MSAA_TILE_SIZE;
+    unsigned int* pixel = &device->buffer[(size_t)y * device->width + x];
+    bool expanded = ((tile->expanded >> bit) & 1) != 0;
+    if (mask == 0xF && !expanded) {
+        *pixel = blend_pixel(clr, *pixel, mode);
+        return;
+    }
+    if (!tile->samples) {
+        tile->samples = msaa_alloc_block(device->msaa);
+    }
+    unsigned int* samples = tile->samples + bit * MSAA_SAMPLES;
+    if (!expanded) {
+        for (int s = 0; s < MSAA_SAMPLES; s++) {
+            samples[s] = *pixel;
+        }
+        tile->expanded |= (uint64_t)1 << bit;
+    }
+    for (int s = 0; s < MSAA_SAMPLES; s++) {
+        if (mask & (1 << s)) {
+            samples[s] = blend_pixel(clr, samples[s], mode);
+        }
+    }
+    if (samples[0] == samples[1] && samples[0] == samples[2] && samples[0] == samples[3]) {
+        *pixel = samples[0];
+        tile->expanded &= ~((uint64_t)1 << bit);
+    }
+}
+
+// 清除颜色：所有像素恢复为压缩存储，回收采样池
+inline void msaa_clear(msaa_t* msaa)
+{
+    msaa_tile_t empty = { 0, nullptr };
+    std::fill(msaa->tiles.begin(), msaa->tiles.end(), empty);
+    msaa->blocks_used = 0;
+}
+
+// 只清除矩形 r 内的像素：恢复为压缩存储，已分配的采样块保留到下一次整体清除
+inline void msaa_clear_rect(msaa_t* msaa, const rect_t* r)
+{
+    for (int y = r->y0; y <= r->y1; y++) {
+        msaa_tile_t* tile_row = &msaa->tiles[(y / MSAA_TILE_SIZE) * msaa->tiles_x];
+        for (int x = r->x0; x <= r->x1; x++) {
+            tile_row[x / MSAA_TILE_SIZE].expanded &= ~((uint64_t)1 << ((y % MSAA_TILE_SIZE) * MSAA_TILE_SIZE + x % MSAA_TILE_SIZE));
+        }
+    }
+}
+
+// 帧结束时（分块光栅化完成后，显示或输出颜色缓冲之前）把展开像素的 4 个采样平均后写入 device->buffer。
+// 展开的像素仍保留采样，之后继续绘制时以采样为准
+inline void msaa_resolve(device_t* device)
+{
+    msaa_t* msaa = device->msaa;
+    if (!msaa) {
+        return;
+    }
+    for (size_t i = 0; i < msaa->tiles.size(); i++) {
+        uint64_t expanded = msaa->tiles[i].expanded;
+        int x0 = (int)(i % msaa->tiles_x) * MSAA_TILE_SIZE;
+        int y0 = (int)(i / msaa->tiles_x) * MSAA_TILE_SIZE;
+        for (int bit = 0; expanded; bit++, expanded >>= 1) {
+            if (!(expanded & 1)) {
+                continue;
+            }
+            // 两个字节一组同时求和：每组最多 4 * 255，不会溢出到相邻字节
+            const unsigned int* samples = msaa->tiles[i].samples + bit * MSAA_SAMPLES;
+            uint32_t rb = 0x00020002u, ag = 0x00020002u;
+            for (int s = 0; s < MSAA_SAMPLES; s++) {
+                rb += samples[s] & 0x00FF00FFu;
+                ag += (samples[s] >> 8) & 0x00FF00FFu;
+            }
+            int x = x0 + bit % MSAA_TILE_SIZE;
+            int y = y0 + bit / MSAA_TILE_SIZE;
+            device->buffer[(size_t)y * device->width + x] = ((rb >> 2) & 0x00FF00FFu) | (((ag >> 2) & 0x00FF00FFu) << 8);
+        }
+    }
+}
+
+// 光栅化一行中 [x, x_end] 的像素：逐采样测试覆盖和深度，每 4 个相邻像素一组着色，每个像素只着色一次。
+// shade(x, y, zr, mask, out) 为像素 x..x + 3 着色（zr 为本行的深度基值 depth_row，mask 的第 k 位表示像素 x + k 需要颜色），
+// 结果只写入通过测试的采样。SSE2 路径中一个像素的 4 个采样正好占 4 个通道，逐采样深度也是连续存放的，
+// 覆盖和深度测试各只需一组向量运算
+template <typename Shade>
+inline void msaa_span(device_t* device, const triangle_setup_t* ts, int x, int x_end, int y,
+                      fill_counts_t* counts, const Shade& shade)
+{
+    const edge_t* e = ts->e;
+    // 较长的行由边函数直接算出可能有采样被覆盖的区间，跳过行首、行尾完全在三角形外的像素（w 加上采样偏移的最大值）；
+    // 分 Hi-Z 块遍历时每段不超过 8 个像素，除法的开销比逐组测试还大
+    for (int i = 0; i < 3 && x_end - x >= 16; i++) {
+        const int* dw = ts->sample_dw[i];
+        long long w = edge_eval(&e[i], x, y) + std::max(std::max(dw[0], dw[1]), std::max(dw[2], dw[3]));
+        int a = e[i].a;
+        if (a > 0 && w < 0) {
+            x += (int)std::min<long long>((-w + a - 1) / a, (long long)x_end - x + 1);
+        } else if (a < 0 && w + (long long)a * (x_end - x) < 0) {
+            x_end = w < 0 ? x - 1 : x + (int)(w / -a);
+        } else if (a == 0 && w < 0) {
+            return;
+        }
+        if (x > x_end) {
+            return;
+        }
+    }
+    long long w0 = edge_eval(&e[0], x, y), w1 = edge_eval(&e[1], x, y), w2 = edge_eval(&e[2], x, y);
+    const float zr = depth_row(ts, y);
+    float* zs = device->zbuffer ? &device->msaa->zbuffer[((size_t)y * device->width + x) * MSAA_SAMPLES] : nullptr;
+    unsigned int* row = device->buffer + (size_t)y * device->width;
+    msaa_tile_t* tile_row = &device->msaa->tiles[(y / MSAA_TILE_SIZE) * device->msaa->tiles_x];
+    const depth_func_t depth_func = ts->depth_func;
+    const bool depth_write = ts->depth_write;
+#ifdef MICRO3D_SSE2
+    const __m128i dw0 = _mm_loadu_si128((const __m128i*)ts->sample_dw[0]);
+    const __m128i dw1 = _mm_loadu_si128((const __m128i*)ts->sample_dw[1]);
+    const __m128i dw2 = _mm_loadu_si128((const __m128i*)ts->sample_dw[2]);
+    const __m128i step0 = _mm_set1_epi32(e[0].a), step1 = _mm_set1_epi32(e[1].a), step2 = _mm_set1_epi32(e[2].a);
+    const __m128 vdz = _mm_loadu_ps(ts->sample_dz);
+#endif
+    for (; x <= x_end; x += 4) {
+        int count = x_end - x + 1 < 4 ? x_end - x + 1 : 4;
+        int masks[4] = { 0, 0, 0, 0 };
+        int need = 0;
+#ifdef MICRO3D_SSE2
+        // 每组从 64 位的边函数值重新开始，限制到 int32 后再加采样偏移：组内增量和采样偏移都远小于 2^30，不会改变符号
+        __m128i c0 = _mm_add_epi32(_mm_set1_epi32(edge_clamp(w0)), dw0);
+        __m128i c1 = _mm_add_epi32(_mm_set1_epi32(edge_clamp(w1)), dw1);
+        __m128i c2 = _mm_add_epi32(_mm_set1_epi32(edge_clamp(w2)), dw2);
+#endif
+        for (int k = 0; k < count; k++) {
+            // 采样深度为像素中心的深度加采样偏移，两条路径的运算相同
+            float z = depth_pixel(ts, zr, x + k);
+#ifdef MICRO3D_SSE2
+            __m128 inside = edges_inside_sse2(c0, c1, c2);
+            c0 = _mm_add_epi32(c0, step0);
+            c1 = _mm_add_epi32(c1, step1);
+            c2 = _mm_add_epi32(c2, step2);
+            int covered = _mm_movemask_ps(inside);
+            int mask = covered;
+            if (covered && zs) {
+                __m128 znew = _mm_add_ps(_mm_set1_ps(z), vdz);
+                __m128 old = _mm_loadu_ps(zs);
+                __m128 pass = _mm_and_ps(inside, depth_test_sse2(depth_func, znew, old));
+                mask = _mm_movemask_ps(pass);
+                if (mask && depth_write) {
+                    _mm_storeu_ps(zs, _mm_or_ps(_mm_and_ps(pass, znew), _mm_andnot_ps(pass, old)));
+                }
+            }
+#else
+            long long wk0 = w0 + (long long)e[0].a * k, wk1 = w1 + (long long)e[1].a * k, wk2 = w2 + (long long)e[2].a * k;
+            int covered = 0;
+            for (int s = 0; s < MSAA_SAMPLES; s++) {
+                covered |= edges_inside(wk0 + ts->sample_dw[0][s], wk1 + ts->sample_dw[1][s], wk2 + ts->sample_dw[2][s]) << s;
+            }
+            int mask = covered;
+            if (covered && zs) {
+                for (int s = 0; s < MSAA_SAMPLES; s++) {
+                    if (covered & (1 << s)) {
+                        float znew = z + ts->sample_dz[s];
+                        if (!depth_test(depth_func, znew, zs[s])) {
+                            mask &= ~(1 << s);
+                        } else if (depth_write) {
+                            zs[s] = znew;
+                        }
+                    }
+                }
+            }
+#endif
+            if (covered && counts) {
+                counts->tested++;
+                counts->written += mask != 0;
+            }
+            masks[k] = mask;
+            need |= (mask != 0) << k;
+            if (zs) {
+                zs += MSAA_SAMPLES;
+            }
+        }
+        w0 += (long long)e[0].a * 4;
+        w1 += (long long)e[1].a * 4;
+        w2 += (long long)e[2].a * 4;
+        if (!need) {
+            continue;
+        }
+        unsigned int out[4];
+        shade(x, y, zr, need, out);
+        for (int k = 0; k < count; k++) {
+            if (ts->blend_mode != BLEND_NONE) {
+                if (masks[k]) {
+                    msaa_blend(device, x + k, y, masks[k], out[k], ts->blend_mode);
+                }
+            } else if (masks[k] == 0xF) {
+                // 完整覆盖的像素最常见：直接写入颜色缓冲，tile 有展开的像素时才需要清除展开标记
+                row[x + k] = out[k];
+                msaa_tile_t* tile = &tile_row[(x + k) / MSAA_TILE_SIZE];
+                if (tile->expanded) {
+                    tile->expanded &= ~((uint64_t)1 << ((y % MSAA_TILE_SIZE) * MSAA_TILE_SIZE + (x + k) % MSAA_TILE_SIZE));
+                }
+            } else if (masks[k]) {
+                msaa_write(device, x + k, y, masks[k], out[k]);
+            }
+        }
+    }
+}
+
+// 启用裁剪测试且 scissor 没有覆盖整个屏幕时，清除只作用于 *r（scissor 与屏幕的交集）。
+// 这样的清除立即写入，延迟清除的 tile 先补齐之前的清除值
+inline bool clear_scissored(device_t* device, rect_t* r)
+{
+    *r = scissor_rect(device);
+    if (!device->scissor_test || (r->x0 == 0 && r->y0 == 0 && r->x1 == device->width - 1 && r->y1 == device->height - 1)) {
+        return false;
+    }
+    if (device->lazy_clear && r->x0 <= r->x1 && r->y0 <= r->y1) {
+        lazy_clear_touch(device, r->x0, r->y0, r->x1, r->y1);
+    }
+    return true;
+}
+
+// 用一种颜色填满颜色缓冲（启用裁剪测试时只填满 scissor 内）；启用延迟清除时只记录清除值。
+// 分块模式下先画完已分箱的三角形，否则它们会画在清除之后
+inline void clear_color(device_t* device, unsigned int clr)
+{
+    binner_flush(device);
+    rect_t r;
+    if (clear_scissored(device, &r)) {
+        if (device->msaa) {
+            msaa_clear_rect(device->msaa, &r);
+        }
+        for (int y = r.y0; y <= r.y1; y++) {
+            fill_words(device->buffer + (size_t)y * device->width + r.x0, clr, r.x1 - r.x0 + 1, false);
+        }
+        return;
+    }
+    if (device->msaa) {
+        msaa_clear(device->msaa);
+    }
+    lazy_clear_t* lazy = device->lazy_clear;
+    if (lazy) {
+        lazy_clear_mark(&lazy->color_state, clr == lazy->color);
+        lazy->color = clr;
+        return;
+    }
+    size_t count = (size_t)device->width * device->height;
+    fill_words(device->buffer, clr, count, count * 4 >= CLEAR_STREAM_BYTES);
+}
+
+// 清空深度缓冲，同时重置分层深度；深度缓冲必须通过它清空，否则 Hi-Z 会保留过小的旧值。
+// 分块模式下先画完已分箱的三角形
+inline void clear_depth(device_t* device, float z)
+{
+    if (!device->zbuffer) {
+        return;
+    }
+    binner_flush(device);
+    rect_t r;
+    if (clear_scissored(device, &r)) {
+        for (int y = r.y0; y <= r.y1; y++) {
+            fill_words(device->zbuffer + (size_t)y * device->width + r.x0, float_bits(z), r.x1 - r.x0 + 1, false);
+        }
+        if (device->hiz && r.x0 <= r.x1 && r.y0 <= r.y1) {
+            // 整块（屏幕边缘的块只算屏幕内的部分）都被清除时上界就是 z，否则块内还有旧的深度
+            hiz_t* hiz = device->hiz;
+            for (int by = r.y0 / HIZ_BLOCK_SIZE; by <= r.y1 / HIZ_BLOCK_SIZE; by++) {
+                int block_y0 = by * HIZ_BLOCK_SIZE;
+                int block_y1 = std::min(block_y0 + HIZ_BLOCK_SIZE, device->height) - 1;
+                for (int bx = r.x0 / HIZ_BLOCK_SIZE; bx <= r.x1 / HIZ_BLOCK_SIZE; bx++) {
+                    int block_x0 = bx * HIZ_BLOCK_SIZE;
+                    int block_x1 = std::min(block_x0 + HIZ_BLOCK_SIZE, device->width) - 1;
+                    float* zmax = &hiz->zmax[bx + by * hiz->blocks_x];
+                    bool inside = block_x0 >= r.x0 && block_x1 <= r.x1 && block_y0 >= r.y0 && block_y1 <= r.y1;
+                    *zmax = inside ? z : fmaxf(*zmax, z);
+                }
+            }
+        }
+        if (device->msaa && !device->msaa->zbuffer.empty()) {
+            for (int y = r.y0; y <= r.y1; y++) {
+                float* zs = device->msaa->zbuffer.data() + ((size_t)y * device->width + r.x0) * MSAA_SAMPLES;
+                fill_words(zs, float_bits(z), (size_t)(r.x1 - r.x0 + 1) * MSAA_SAMPLES, false);
+            }
+        }
+        return;
+    }
+    lazy_clear_t* lazy = device->lazy_clear;
+    if (lazy) {
+        lazy_clear_mark(&lazy->depth_state, float_bits(z) == float_bits(lazy->depth));
+        lazy->depth = z;
+    } else {
+        size_t count = (size_t)device->width * device->height;
+        fill_words(device->zbuffer, float_bits(z), count, count * 4 >= CLEAR_STREAM_BYTES);
+    }
+    if (device->hiz) {
+        std::fill(device->hiz->zmax.begin(), device->hiz->zmax.end(), z);
+    }
+    if (device->msaa && !device->msaa->zbuffer.empty()) {
+        std::vector<float>& zs = device->msaa->zbuffer;
+        fill_words(zs.data(), float_bits(z), zs.size(), zs.size() * 4 >= CLEAR_STREAM_BYTES);
+    }
+}
+
+// 把 width x height 的图像（pitch 为每行的像素数）按 device->blend_mode 合成到颜色缓冲的 (x, y) 处，超出视口（或 scissor）的部分裁掉；
+// 用于在三维画面上叠加界面等二维图层，不做深度测试。分块模式下先画完已分箱的三角形；
+// 多重采样时写入像素的所有采样，需要在 msaa_resolve 之前调用
+inline void blit(device_t* device, int x, int y, const unsigned int* pixels, int width, int height, int pitch)
+{
+    binner_flush(device);
+    rect_t bounds = scissor_rect(device);
+    int x0 = std::max(x, bounds.x0), y0 = std::max(y, bounds.y0);
+    int x1 = std::min(x + width - 1, bounds.x1), y1 = std::min(y + height - 1, bounds.y1);
+    if (x0 > x1 || y0 > y1) {
+        return;
+    }
+    if (device->lazy_clear) {
+        lazy_clear_touch(device, x0, y0, x1, y1);
+    }
+    for (int row = y0; row <= y1; row++) {
+        const unsigned int* src = pixels + (size_t)(row - y) * pitch + (x0 - x);
+        if (device->msaa) {
+            for (int i = 0; i <= x1 - x0; i++) {
+                msaa_blend(device, x0 + i, row, 0xF, src[i], device->blend_mode);
+            }
+            continue;
+        }
+        blend_row(device->buffer + (size_t)row * device->width + x0, src, x1 - x0 + 1, device->blend_mode);
+    }
+}
+
+inline bool hiz_enabled(const device_t* device, depth_func_t func)
+{
+    return device->hiz && device->zbuffer && (func == DEPTH_LESS || func == DEPTH_LEQUAL);
+}
+
+// 最小深度为 zmin 的图元放在 [x0, x1] x [y0, y1] 内时是否必然被完全遮挡
+inline bool hiz_occluded(const device_t* device, int x0, int y0, int x1, int y1, float zmin)
+{
+    if (!hiz_enabled(device, device->depth_func)) {
+        return false;
+    }
+    x0 = x0 > 0 ? x0 : 0;
+    y0 = y0 > 0 ? y0 : 0;
+    x1 = x1 < device->width - 1 ? x1 : device->width - 1;
+    y1 = y1 < device->height - 1 ? y1 : device->height - 1;
+    if (x0 > x1 || y0 > y1) {
+        return true;
+    }
+    const hiz_t* hiz = device->hiz;
+    for (int by = y0 / HIZ_BLOCK_SIZE; by <= y1 / HIZ_BLOCK_SIZE; by++) {
+        const float* zmax = &hiz->zmax[by * hiz->blocks_x];
+        for (int bx = x0 / HIZ_BLOCK_SIZE; bx <= x1 / HIZ_BLOCK_SIZE; bx++) {
+            if (device->depth_func == DEPTH_LESS ? zmin < zmax[bx] : zmin <= zmax[bx]) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// 像素矩形 [x0, x1] x [y0, y1] 是否被三角形完全覆盖：边函数是线性的，只需检查每条边上取值最小的那个角，
+// 整数边函数是精确的，不需要留余量。多重采样时要求所有采样都被覆盖
+inline bool triangle_covers_rect(const triangle_setup_t* ts, int x0, int y0, int x1, int y1)
+{
+    for (int i = 0; i < 3; i++) {
+        const edge_t* e = &ts->e[i];
+        const int* dw = ts->sample_dw[i];
+        int margin = std::min(std::min(dw[0], dw[1]), std::min(dw[2], dw[3]));
+        if (edge_eval(e, e->a > 0 ? x0 : x1, e->b > 0 ? y0 : y1) + margin < 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// 深度平面在矩形四个角上的最小/最大值，再与顶点深度范围取交
+inline void depth_range_rect(const triangle_setup_t* ts, float x0, float y0, float x1, float y1,
+                             float* zmin, float* zmax)
+{
+    float z00 = depth_eval(ts, x0, y0);
+    float z10 = depth_eval(ts, x1, y0);
+    float z01 = depth_eval(ts, x0, y1);
+    float z11 = depth_eval(ts, x1, y1);
+    *zmin = fmaxf(fminf(fminf(z00, z10), fminf(z01, z11)), ts->zmin);
+    *zmax = fminf(fmaxf(fmaxf(z00, z10), fmaxf(z01, z11)), ts->zmax);
+}
+
+// 遍历三角形在 [x0, x1] x [y0, y1] 与边界框交集内的各行，对每段调用 span(row, zrow, x_begin, x_end, y)。
+// span 为编译期确定的函数对象，每行起点由坐标直接算出，避免误差沿 y 方向累积；行内只做加法。
+// 启用 Hi-Z 时按 8x8 块遍历：先用块的深度上界剔除整块，画完后更新块的深度上界。
+// 多重采样时深度上界覆盖块内所有采样，深度范围按采样偏移向外扩展
+template <typename Span>
+inline void triangle_walk(device_t* device, const triangle_setup_t* ts, int x0, int y0, int x1, int y1,
+                          fill_counts_t* counts, const Span& span)
+{
+    int min_x = ts->min_x > x0 ? ts->min_x : x0;
+    int max_x = ts->max_x < x1 ? ts->max_x : x1;
+    int min_y = ts->min_y > y0 ? ts->min_y : y0;
+    int max_y = ts->max_y < y1 ? ts->max_y : y1;
+    if (min_x > max_x || min_y > max_y) {
+        return;
+    }
+
+    int width = device->width;
+    hiz_t* hiz = device->zbuffer ? device->hiz : nullptr;
+    if (!hiz) {
+        unsigned int* row = device->buffer + min_y * width;
+        float* zrow = device->zbuffer ? device->zbuffer + min_y * width : nullptr;
+        for (int y = min_y; y <= max_y; y++) {
+            span(row, zrow, min_x, max_x, y);
+            row += width;
+            if (zrow) {
+                zrow += width;
+            }
+        }
+        return;
+    }
+
+    bool cull = ts->depth_func == DEPTH_LESS || ts->depth_func == DEPTH_LEQUAL;
+    const float pad = device->msaa ? (float)MSAA_SAMPLE_EXTENT / (float)SUBPIXEL_ONE : 0.0f;
+    for (int by = min_y / HIZ_BLOCK_SIZE; by <= max_y / HIZ_BLOCK_SIZE; by++) {
+        int block_y0 = by * HIZ_BLOCK_SIZE;
+        int block_y1 = block_y0 + HIZ_BLOCK_SIZE - 1 < device->height - 1 ? block_y0 + HIZ_BLOCK_SIZE - 1 : device->height - 1;
+        int y_begin = min_y > block_y0 ? min_y : block_y0;
+        int y_end = max_y < block_y1 ? max_y : block_y1;
+        for (int bx = min_x / HIZ_BLOCK_SIZE; bx <= max_x / HIZ_BLOCK_SIZE; bx++) {
+            int block_x0 = bx * HIZ_BLOCK_SIZE;
+            int block_x1 = block_x0 + HIZ_BLOCK_SIZE - 1 < width - 1 ? block_x0 + HIZ_BLOCK_SIZE - 1 : width - 1;
+            int x_begin = min_x > block_x0 ? min_x : block_x0;
+            int x_end = max_x < block_x1 ? max_x : block_x1;
+            float* zmax = &hiz->zmax[bx + by * hiz->blocks_x];
+
+            // 块剔除：用三角形在块内（与边界框的交集上）的最小深度与块的深度上界比较
+            float zlo, zhi;
+            depth_range_rect(ts, (float)x_begin + 0.5f - pad, (float)y_begin + 0.5f - pad,
+                             (float)x_end + 0.5f + pad, (float)y_end + 0.5f + pad, &zlo, &zhi);
+            if (cull && (ts->depth_func == DEPTH_LESS ? zlo >= *zmax : zlo > *zmax)) {
+                if (counts) {
+                    counts->hiz_blocks_culled++;
+                }
+                continue;
+            }
+
+            unsigned int* row = device->buffer + y_begin * width;
+            float* zrow = device->zbuffer + y_begin * width;
+            for (int y = y_begin; y <= y_end; y++) {
+                span(row, zrow, x_begin, x_end, y);
+                row += width;
+                zrow += width;
+            }
+
+            if (!ts->depth_write) {
+                continue;
+            }
+            if (cull) {
+                // 三角形覆盖整块时，块内每个像素的新深度都不超过三角形在块内的最大深度
+                // （逐像素深度与 depth_eval 的运算顺序不同，留出几个 ulp 的余量）；裁剪测试时块还必须整块都被绘制
+                if (x_begin == block_x0 && x_end == block_x1 && y_begin == block_y0 && y_end == block_y1 &&
+                    triangle_covers_rect(ts, block_x0, block_y0, block_x1, block_y1)) {
+                    depth_range_rect(ts, (float)block_x0 + 0.5f - pad, (float)block_y0 + 0.5f - pad,
+                                     (float)block_x1 + 0.5f + pad, (float)block_y1 + 0.5f + pad, &zlo, &zhi);
+                    *zmax = fminf(*zmax, zhi + 1e-6f);
+                }
+            } else if (ts->depth_func != DEPTH_EQUAL) {
+                // 其他比较函数可能把深度写大，保守地抬高上界
+                *zmax = fmaxf(*zmax, zhi);
+            }
+        }
+    }
+}
+
+// 光栅化已建立的纯色三角形，只写入 [x0, x1] x [y0, y1] 与边界框的交集；counts 非空时累计像素计数
+inline void triangle_fill(device_t* device, const triangle_setup_t* ts, int x0, int y0, int x1, int y1,
+                          fill_counts_t* counts)
+{
+    // 按 CPU 能力选择填充路径，不支持时退回标量路径
+    void (*span_fill)(const triangle_setup_t*, unsigned int*, float*, int, int, long long, long long, long long, float, fill_counts_t*) = span_fill_scalar;
+#ifdef MICRO3D_SSE2
+    span_fill = cpu_has_avx2() ? span_fill_avx2 : span_fill_sse2;
+#endif
+    const edge_t* e = ts->e;
+    if (device->msaa) {
+        triangle_walk(device, ts, x0, y0, x1, y1, counts, [&](unsigned int*, float*, int x, int x_end, int y) {
+            msaa_span(device, ts, x, x_end, y, counts, [&](int, int, float, int, unsigned int* out) {
+                out[0] = out[1] = out[2] = out[3] = ts->clr;
+            });
+        });
+        return;
+    }
+    triangle_walk(device, ts, x0, y0, x1, y1, counts, [&](unsigned int* row, float* zrow, int x, int x_end, int y) {
+        span_fill(ts, row, zrow, x, x_end, edge_eval(&e[0], x, y), edge_eval(&e[1], x, y), edge_eval(&e[2], x, y),
+                  depth_row(ts, y), counts);
+    });
+}
+
+// 分块光栅化：把帧缓冲划分为 tile，三角形建立后按覆盖的 tile 分箱，
+// 再由线程池并行光栅化各个 tile。每个 tile 只由一个线程写入，颜色缓冲无需加锁；
+// 同一 tile 内三角形按提交顺序绘制，结果与直接绘制一致
+struct binner_t {
+    int tile_size;
+    int tiles_x, tiles_y;
+    std::vector<triangle_setup_t> triangles;
+    std::vector<std::vector<int> > tile_lists; // 每个 tile 的三角形下标，按提交顺序
+    std::vector<int> active_tiles;             // 本帧有三角形的 tile
+    std::vector<std::max_align_t> payload;     // 着色三角形的属性平面和着色器
+
+    // 线程池
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable start_cv;
+    std::condition_variable done_cv;
+    std::atomic<int> next_tile;
+    int generation;
+    int busy;
+    bool quit;
+    device_t* device;
+};
+
+// 取下一个未处理的 tile 并光栅化，直到本帧的 tile 全部领完；
+// 启用统计时各线程先在本地累计，结束时加锁合并一次。thread 为线程编号（调用线程为 0）
+inline void binner_run_tiles(binner_t* binner, int thread)
+{
+    device_t* device = binner->device;
+    stats_t* stats = device->stats;
+    long long start_ns = stats ? stats_now() : 0;
+    fill_counts_t local = {};
+    fill_counts_t* counts = stats ? &local : nullptr;
+    int count = (int)binner->active_tiles.size();
+    for (;;) {
+        int i = binner->next_tile.fetch_add(1);
+        if (i >= count) {
+            break;
+        }
+        int tile = binner->active_tiles[i];
+        int x0 = (tile % binner->tiles_x) * binner->tile_size;
+        int y0 = (tile / binner->tiles_x) * binner->tile_size;
+        int x1 = x0 + binner->tile_size - 1;
+        int y1 = y0 + binner->tile_size - 1;
+        if (device->lazy_clear) {
+            lazy_clear_touch(device, x0, y0, x1, y1);
+        }
+        const std::vector<int>& list = binner->tile_lists[tile];
+        for (size_t k = 0; k < list.size(); k++) {
+            const triangle_setup_t* ts = &binner->triangles[list[k]];
+            if (ts->shade_fill) {
+                ts->shade_fill(device, ts, &binner->payload[ts->payload], x0, y0, x1, y1, counts);
+            } else {
+                triangle_fill(device, ts, x0, y0, x1, y1, counts);
+            }
+        }
+    }
+    if (stats) {
+        long long end_ns = stats_now();
+        std::lock_guard<std::mutex> lock(stats->mutex);
+        stats->pixels_tested += local.tested;
+        stats->pixels_written += local.written;
+        stats->hiz_blocks_culled += local.hiz_blocks_culled;
+        stats_record(stats, STATS_TILES, thread, start_ns, end_ns);
+    }
+}
+
+inline void binner_worker(binner_t* binner, int thread)
+{
+    int seen = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(binner->mutex);
+            binner->start_cv.wait(lock, [&]() { return binner->quit || binner->generation != seen; });
+            if (binner->quit) {
+                return;
+            }
+            seen = binner->generation;
+        }
+        binner_run_tiles(binner, thread);
+        {
+            std::lock_guard<std::mutex> lock(binner->mutex);
+            if (--binner->busy == 0) {
+                binner->done_cv.notify_one();
+            }
+        }
+    }
+}
+
+// 创建分块光栅化器，thread_count <= 0 时使用全部硬件线程（调用线程也参与光栅化）
+inline binner_t* binner_create(const device_t* device, int tile_size, int thread_count)
+{
+    binner_t* binner = new binner_t;
+    // tile 大小取 Hi-Z 块大小的整数倍，每个 Hi-Z 块只属于一个 tile
+    tile_size = tile_size > 0 ? tile_size : 64;
+    binner->tile_size = (tile_size + HIZ_BLOCK_SIZE - 1) / HIZ_BLOCK_SIZE * HIZ_BLOCK_SIZE;
+    binner->tiles_x = (device->width + binner->tile_size - 1) / binner->tile_size;
+    binner->tiles_y = (device->height + binner->tile_size - 1) / binner->tile_size;
+    binner->tile_lists.resize(binner->tiles_x * binner->tiles_y);
+    binner->next_tile = 0;
+    binner->generation = 0;
+    binner->busy = 0;
+    binner->quit = false;
+    binner->device = nullptr;
+
+    if (thread_count <= 0) {
+        thread_count = (int)std::thread::hardware_concurrency();
+    }
+    for (int i = 1; i < thread_count; i++) {
+        binner->workers.push_back(std::thread(binner_worker, binner, i));
+    }
+    return binner;
+}
+
+inline void binner_destroy(binner_t* binner)
+{
+    if (!binner) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(binner->mutex);
+        binner->quit = true;
+    }
+    binner->start_cv.notify_all();
+    for (size_t i = 0; i < binner->workers.size(); i++) {
+        binner->workers[i].join();
+    }
+    delete binner;
+}
+
+// 把三角形加入它覆盖的每个 tile；边函数在 tile 内的最大值小于 0 时，该 tile 不可能被覆盖（整数边函数，判断是精确的）。
+// 多重采样时再加上采样偏移带来的最大增量
+inline void binner_add(binner_t* binner, const triangle_setup_t* ts)
+{
+    int index = (int)binner->triangles.size();
+    binner->triangles.push_back(*ts);
+
+    int size = binner->tile_size;
+    int tx0 = ts->min_x / size;
+    int tx1 = ts->max_x / size;
+    int ty0 = ts->min_y / size;
+    int ty1 = ts->max_y / size;
+    bool single = tx0 == tx1 && ty0 == ty1;
+    for (int ty = ty0; ty <= ty1; ty++) {
+        for (int tx = tx0; tx <= tx1; tx++) {
+            if (!single) {
+                int x0 = tx * size;
+                int y0 = ty * size;
+                int x1 = x0 + size - 1;
+                int y1 = y0 + size - 1;
+                bool outside = false;
+                for (int i = 0; i < 3 && !outside; i++) {
+                    const edge_t* e = &ts->e[i];
+                    const int* dw = ts->sample_dw[i];
+                    int margin = std::max(std::max(dw[0], dw[1]), std::max(dw[2], dw[3]));
+                    outside = edge_eval(e, e->a > 0 ? x1 : x0, e->b > 0 ? y1 : y0) + margin < 0;
+                }
+                if (outside) {
+                    continue;
+                }
+            }
+            std::vector<int>& list = binner->tile_lists[tx + ty * binner->tiles_x];
+            if (list.empty()) {
+                binner->active_tiles.push_back(tx + ty * binner->tiles_x);
+            }
+            list.push_back(index);
+        }
+    }
+}
+
+// 分箱着色三角形：把 size 字节的 payload（属性平面和着色器）复制到 binner 中，光栅化时交给 shade_fill
+inline void binner_add_shaded(binner_t* binner, const triangle_setup_t* ts, const void* payload, size_t size,
+                              void (*shade_fill)(device_t*, const triangle_setup_t*, const void*, int, int, int, int, fill_counts_t*))
+{
+    size_t offset = binner->payload.size();
+    binner->payload.resize(offset + (size + sizeof(std::max_align_t) - 1) / sizeof(std::max_align_t));
+    memcpy(&binner->payload[offset], payload, size);
+    triangle_setup_t shaded = *ts;
+    shaded.shade_fill = shade_fill;
+    shaded.payload = offset;
+    binner_add(binner, &shaded);
+}
+
+// 并行光栅化所有已分箱的三角形并清空分箱；非分块模式或没有待画三角形时直接返回
+inline void binner_flush(device_t* device)
+{
+    binner_t* binner = device->binner;
+    if (!binner || binner->triangles.empty()) {
+        return;
+    }
+
+    MICRO3D_STATS_SCOPE(device, STATS_FLUSH);
+    // tile 大小不是延迟清除 tile 的整数倍时，多个分箱 tile 可能共享同一个延迟清除 tile，先在调用线程上统一清除
+    lazy_clear_t* lazy = device->lazy_clear;
+    if (lazy && binner->tile_size % lazy->tile_size != 0) {
+        for (size_t i = 0; i < binner->active_tiles.size(); i++) {
+            int tile = binner->active_tiles[i];
+            int x0 = (tile % binner->tiles_x) * binner->tile_size;
+            int y0 = (tile / binner->tiles_x) * binner->tile_size;
+            lazy_clear_touch(device, x0, y0, x0 + binner->tile_size - 1, y0 + binner->tile_size - 1);
+        }
+    }
+    binner->device = device;
+    binner->next_tile = 0;
+    if (!binner->workers.empty()) {
+        {
+            std::lock_guard<std::mutex> lock(binner->mutex);
+            binner->busy = (int)binner->workers.size();
+            binner->generation++;
+        }
+        binner->start_cv.notify_all();
+    }
+    binner_run_tiles(binner, 0);
+    if (!binner->workers.empty()) {
+        std::unique_lock<std::mutex> lock(binner->mutex);
+        binner->done_cv.wait(lock, [&]() { return binner->busy == 0; });
+    }
+
+    for (size_t i = 0; i < binner->active_tiles.size(); i++) {
+        binner->tile_lists[binner->active_tiles[i]].clear();
+    }
+    binner->active_tiles.clear();
+    binner->triangles.clear();
+    binner->payload.clear();
+}
+
+// 与 triangle() 相同，同时记录计数和各阶段耗时；统计关闭时不进入这条路径，热路径上没有计时开销
+inline void triangle_stats(device_t* device, const vec4_t* v1, const vec4_t* v2, const vec4_t* v3, unsigned int clr)
+{
+    stats_t* stats = device->stats;
+    long long start_ns = stats_now();
+    stats->triangles_setup++;
+    triangle_setup_t ts;
+    bool ok = triangle_setup(&ts, device, v1, v2, v3, clr);
+    long long setup_ns = stats_now();
+    stats_record(stats, STATS_SETUP, 0, start_ns, setup_ns);
+    if (!ok) {
+        stats->triangles_culled_degenerate++;
+    } else if (hiz_occluded(device, ts.min_x, ts.min_y, ts.max_x, ts.max_y, ts.zmin)) {
+        stats->triangles_culled_hiz++;
+    } else {
+        stats->triangles_rasterized++;
+        if (device->binner) {
+            binner_add(device->binner, &ts);
+        } else {
+            if (device->lazy_clear) {
+                lazy_clear_touch(device, ts.min_x, ts.min_y, ts.max_x, ts.max_y);
+            }
+            fill_counts_t counts = {};
+            triangle_fill(device, &ts, 0, 0, device->width - 1, device->height - 1, &counts);
+            stats->pixels_tested += counts.tested;
+            stats->pixels_written += counts.written;
+            stats->hiz_blocks_culled += counts.hiz_blocks_culled;
+            stats_record(stats, STATS_FILL, 0, setup_ns, stats_now());
+        }
+    }
+    stats_record(stats, STATS_TRIANGLE, 0, start_ns, stats_now());
+}
+
+inline void triangle(device_t* device, const vec4_t* v1, const vec4_t* v2, const vec4_t* v3, unsigned int clr)
+{
+#ifndef MICRO3D_NO_STATS
+    if (device->stats) {
+        triangle_stats(device, v1, v2, v3, clr);
+        return;
+    }
+#endif
+    triangle_setup_t ts;
+    if (!triangle_setup(&ts, device, v1, v2, v3, clr)) {
+        return;
+    }
+    // 整个三角形被遮挡时不进入光栅化
+    if (hiz_occluded(device, ts.min_x, ts.min_y, ts.max_x, ts.max_y, ts.zmin)) {
+        return;
+    }
+    if (device->binner) {
+        binner_add(device->binner, &ts);
+    } else {
+        if (device->lazy_clear) {
+            lazy_clear_touch(device, ts.min_x, ts.min_y, ts.max_x, ts.max_y);
+        }
+        triangle_fill(device, &ts, 0, 0, device->width - 1, device->height - 1, nullptr);
+    }
+}
+
+// 着色三角形：顶点带 N 个 float 属性（颜色、UV、法线等），逐像素做透视校正插值后交给着色器。
+// 着色器是编译期确定的函数对象，光栅化循环对每种着色器单独实例化，着色器调用可以完全内联，
+// 逐像素没有虚函数或函数指针调用：
+//
+//     struct my_shader_t {
+//         enum { VARYINGS = 3 };                                    // 每个顶点的属性个数
+//         unsigned int operator()(const fragment_t<3>& frag) const; // 返回 0xAARRGGBB，不透明时 alpha 为 0xFF
+//     };
+//
+// 着色器还可以提供 void shade4(const fragment4_t<N>& frag, unsigned int* out) const，一次着色一行中相邻的 4 个像素，
+// 便于用 SIMD 读取和滤波纹理；提供了 shade4 时光栅化只调用它（多重采样时也是每个像素着色一次）。
+//
+// 着色器会被复制（分块模式下保存到帧结束），必须可以按字节复制，通常只包含参数和指向纹理等数据的指针
+
+// 属性平面：a/w 和 1/w 在屏幕空间中是线性的，各自按平面方程 p(x, y) = p0 + dpdx * (x - x0) + dpdy * (y - y0) 插值，
+// 逐像素再除以 1/w 得到透视正确的属性。顶点的 w 为裁剪空间的 w（clip_to_screen 保留了它），w 都为 1 时退化为线性插值
+template <int N>
+struct varyings_setup_t {
+    float x0, y0;
+    float q0, dqdx, dqdy;          // 1/w
+    float a0[N > 0 ? N : 1];       // a/w
+    float dadx[N > 0 ? N : 1];
+    float dady[N > 0 ? N : 1];
+};
+
+// 平面方程的梯度：v1、v2、v3 上的值为 p1、p2、p3，area 为有向面积（两种绕序都适用）。
+// 吸附后面积不为 0 的三角形浮点面积仍可能为 0（顶点几乎共线），此时梯度取 0，属性按常量插值
+inline void plane_gradient(const vec4_t* v1, const vec4_t* v2, const vec4_t* v3, float area,
+                           float p1, float p2, float p3, float* dpdx, float* dpdy)
+{
+    if (area == 0.0f) {
+        *dpdx = *dpdy = 0.0f;
+        return;
+    }
+    float dx2 = v2->x - v1->x, dy2 = v2->y - v1->y, dp2 = p2 - p1;
+    float dx3 = v3->x - v1->x, dy3 = v3->y - v1->y, dp3 = p3 - p1;
+    *dpdx = (dp2 * dy3 - dp3 * dy2) / area;
+    *dpdy = (dp3 * dx2 - dp2 * dx3) / area;
+}
+
+// 为屏幕空间三角形建立属性平面，a1、a2、a3 为三个顶点的属性（各 N 个）
+template <int N>
+inline void varyings_setup(varyings_setup_t<N>* vs, const vec4_t* v1, const vec4_t* v2, const vec4_t* v3,
+                           const float* a1, const float* a2, const float* a3)
+{
+    float area = cross_product_2d(v1, v2, v3);
+    float q1 = 1.0f / v1->w, q2 = 1.0f / v2->w, q3 = 1.0f / v3->w;
+    vs->x0 = v1->x;
+    vs->y0 = v1->y;
+    vs->q0 = q1;
+    plane_gradient(v1, v2, v3, area, q1, q2, q3, &vs->dqdx, &vs->dqdy);
+    for (int i = 0; i < N; i++) {
+        vs->a0[i] = a1[i] * q1;
+        plane_gradient(v1, v2, v3, area, a1[i] * q1, a2[i] * q2, a3[i] * q3, &vs->dadx[i], &vs->dady[i]);
+    }
+}
+
+// 交给着色器的片元：透视校正后的属性、像素坐标和深度
+template <int N>
+struct fragment_t {
+    float attr[N > 0 ? N : 1];
+    int x, y;
+    float z;
+    float q; // 插值得到的 1/w
+    const varyings_setup_t<N>* setup;
+};
+
+// 属性 i 在屏幕 x、y 方向上每像素的变化量（透视校正）：d(a) = (d(a/w) - a * d(1/w)) / (1/w)，用于纹理的 mip 选择
+template <int N>
+inline float fragment_ddx(const fragment_t<N>& frag, int i)
+{
+    return (frag.setup->dadx[i] - frag.attr[i] * frag.setup->dqdx) / frag.q;
+}
+
+template <int N>
+inline float fragment_ddy(const fragment_t<N>& frag, int i)
+{
+    return (frag.setup->dady[i] - frag.attr[i] * frag.setup->dqdy) / frag.q;
+}
+
+// 一行中从 x 开始的 4 个像素：attr[i][k] 为像素 x + k 的属性 i，mask 的第 k 位表示像素 x + k 要写入。
+// 不写入的像素也带有插值结果（可能在三角形之外），着色器可以照常计算，结果被丢弃
+template <int N>
+struct fragment4_t {
+    float attr[N > 0 ? N : 1][4];
+    float q[4];
+    float z[4];
+    int x, y;
+    int mask;
+    const varyings_setup_t<N>* setup;
+};
+
+template <int N>
+inline float fragment4_ddx(const fragment4_t<N>& frag, int i, int k)
+{
+    return (frag.setup->dadx[i] - frag.attr[i][k] * frag.setup->dqdx) / frag.q[k];
+}
+
+template <int N>
+inline float fragment4_ddy(const fragment4_t<N>& frag, int i, int k)
+{
+    return (frag.setup->dady[i] - frag.attr[i][k] * frag.setup->dqdy) / frag.q[k];
+}
+
+// 着色器是否提供 shade4
+template <typename Shader, typename = void>
+struct shader_has_shade4 : std::false_type {};
+
+template <typename Shader>
+struct shader_has_shade4<Shader, decltype((void)&Shader::shade4)> : std::true_type {};
+
+// 着色三角形的光栅化数据：分块模式下按字节复制到 binner 中
+template <typename Shader>
+struct shaded_triangle_t {
+    varyings_setup_t<Shader::VARYINGS> varyings;
+    Shader shader;
+};
+
+// 着色一行中 [x, x_end] 的像素：没有属性的着色器（VARYINGS 为 0）不做 1/w 的插值和除法
+template <typename Shader>
+inline void span_shade(const triangle_setup_t* ts, const shaded_triangle_t<Shader>* st, unsigned int* row, float* zrow,
+                       int x, int x_end, int y, fill_counts_t* counts, std::false_type)
+{
+    enum { N = Shader::VARYINGS };
+    const varyings_setup_t<N>* vs = &st->varyings;
+    const edge_t* e = ts->e;
+    float px = (float)x + 0.5f;
+    float py = (float)y + 0.5f;
+    long long w0 = edge_eval(&e[0], x, y), w1 = edge_eval(&e[1], x, y), w2 = edge_eval(&e[2], x, y);
+    const float zr = depth_row(ts, y);
+
+    fragment_t<N> frag;
+    frag.y = y;
+    frag.q = 1.0f;
+    frag.setup = vs;
+    float q = 0.0f;
+    float aq[N > 0 ? N : 1];
+    if (N > 0) {
+        q = vs->q0 + vs->dqdx * (px - vs->x0) + vs->dqdy * (py - vs->y0);
+        for (int i = 0; i < N; i++) {
+            aq[i] = vs->a0[i] + vs->dadx[i] * (px - vs->x0) + vs->dady[i] * (py - vs->y0);
+        }
+    }
+    for (; x <= x_end; x++) {
+        if (edges_inside(w0, w1, w2)) {
+            float z = depth_pixel(ts, zr, x);
+            bool pass = !zrow || depth_test(ts->depth_func, z, zrow[x]);
+            if (pass) {
+                if (zrow && ts->depth_write) {
+                    zrow[x] = z;
+                }
+                frag.x = x;
+                frag.z = z;
+                if (N > 0) {
+                    float w = 1.0f / q;
+                    frag.q = q;
+                    for (int i = 0; i < N; i++) {
+                        frag.attr[i] = aq[i] * w;
+                    }
+                }
+                unsigned int c = st->shader(frag);
+                row[x] = ts->blend_mode == BLEND_NONE ? c : blend_pixel(c, row[x], ts->blend_mode);
+            }
+            if (counts) {
+                counts->tested++;
+                counts->written += pass;
+            }
+        }
+        w0 += e[0].a;
+        w1 += e[1].a;
+        w2 += e[2].a;
+        if (N > 0) {
+            q += vs->dqdx;
+            for (int i = 0; i < N; i++) {
+                aq[i] += vs->dadx[i];
+            }
+        }
+    }
+}
+
+// 提供 shade4 的着色器：覆盖和深度测试仍逐像素进行，通过的像素每 4 个一组交给 shade4
+template <typename Shader>
+inline void span_shade(const triangle_setup_t* ts, const shaded_triangle_t<Shader>* st, unsigned int* row, float* zrow,
+                       int x, int x_end, int y, fill_counts_t* counts, std::true_type)
+{
+    enum { N = Shader::VARYINGS };
+    const varyings_setup_t<N>* vs = &st->varyings;
+    const edge_t* e = ts->e;
+    float px = (float)x + 0.5f;
+    float py = (float)y + 0.5f;
+    long long w0 = edge_eval(&e[0], x, y), w1 = edge_eval(&e[1], x, y), w2 = edge_eval(&e[2], x, y);
+    const float zr = depth_row(ts, y);
+
+    fragment4_t<N> frag;
+    frag.y = y;
+    frag.setup = vs;
+    float q = 1.0f;
+    float aq[N > 0 ? N : 1];
+    if (N > 0) {
+        q = vs->q0 + vs->dqdx * (px - vs->x0) + vs->dqdy * (py - vs->y0);
+        for (int i = 0; i < N; i++) {
+            aq[i] = vs->a0[i] + vs->dadx[i] * (px - vs->x0) + vs->dady[i] * (py - vs->y0);
+        }
+    }
+    for (; x <= x_end; x += 4) {
+        int mask = 0;
+        for (int k = 0; k < 4; k++) {
+            float z = depth_pixel(ts, zr, x + k);
+            if (x + k <= x_end && edges_inside(w0, w1, w2)) {
+                bool pass = !zrow || depth_test(ts->depth_func, z, zrow[x + k]);
+                if (pass) {
+                    if (zrow && ts->depth_write) {
+                        zrow[x + k] = z;
+                    }
+                    mask |= 1 << k;
+                }
+                if (counts) {
+                    counts->tested++;
+                    counts->written += pass;
+                }
+            }
+            frag.z[k] = z;
+            frag.q[k] = q;
+            for (int i = 0; i < N; i++) {
+                frag.attr[i][k] = aq[i];
+            }
+            w0 += e[0].a;
+            w1 += e[1].a;
+            w2 += e[2].a;
+            if (N > 0) {
+                q += vs->dqdx;
+                for (int i = 0; i < N; i++) {
+                    aq[i] += vs->dadx[i];
+                }
+            }
+        }
+        if (!mask) {
+            continue;
+        }
+        for (int k = 0; k < 4; k++) {
+            float w = 1.0f / frag.q[k];
+            for (int i = 0; i < N; i++) {
+                frag.attr[i][k] *= w;
+            }
+        }
+        frag.x = x;
+        frag.mask = mask;
+        unsigned int out[4];
+        st->shader.shade4(frag, out);
+        if (ts->blend_mode != BLEND_NONE) {
+            blend_masked4(row + x, out, mask, x + 3 <= x_end, ts->blend_mode);
+            continue;
+        }
+        for (int k = 0; k < 4; k++) {
+            if (mask & (1 << k)) {
+                row[x + k] = out[k];
+            }
+        }
+    }
+}
+
+// 多重采样时在像素中心为一行中 x..x + 3 的像素着色（每个像素只着色一次），mask 的第 k 位表示像素 x + k 需要颜色，
+// zr 为本行的深度基值 depth_row；中心不在三角形内的像素使用属性平面的外推值。没有 shade4 的着色器逐像素调用 operator()
+template <typename Shader>
+inline void shade_pixels(const triangle_setup_t* ts, const shaded_triangle_t<Shader>* st, int x, int y, float zr, int mask,
+                         unsigned int* out, std::false_type)
+{
+    enum { N = Shader::VARYINGS };
+    const varyings_setup_t<N>* vs = &st->varyings;
+    fragment_t<N> frag;
+    frag.y = y;
+    frag.q = 1.0f;
+    frag.setup = vs;
+    for (int k = 0; k < 4; k++) {
+        if (!(mask & (1 << k))) {
+            continue;
+        }
+        float px = (float)(x + k) + 0.5f - vs->x0;
+        float py = (float)y + 0.5f - vs->y0;
+        frag.x = x + k;
+        frag.z = depth_pixel(ts, zr, x + k);
+        if (N > 0) {
+            frag.q = vs->q0 + vs->dqdx * px + vs->dqdy * py;
+            float w = 1.0f / frag.q;
+            for (int i = 0; i < N; i++) {
+                frag.attr[i] = (vs->a0[i] + vs->dadx[i] * px + vs->dady[i] * py) * w;
+            }
+        }
+        out[k] = st->shader(frag);
+    }
+}
+
+template <typename Shader>
+inline void shade_pixels(const triangle_setup_t* ts, const shaded_triangle_t<Shader>* st, int x, int y, float zr, int mask,
+                         unsigned int* out, std::true_type)
+{
+    enum { N = Shader::VARYINGS };
+    const varyings_setup_t<N>* vs = &st->varyings;
+    fragment4_t<N> frag;
+    frag.x = x;
+    frag.y = y;
+    frag.mask = mask;
+    frag.setup = vs;
+    float px = (float)x + 0.5f - vs->x0;
+    float py = (float)y + 0.5f - vs->y0;
+    for (int k = 0; k < 4; k++) {
+        float pk = px + (float)k;
+        frag.z[k] = depth_pixel(ts, zr, x + k);
+        frag.q[k] = N > 0 ? vs->q0 + vs->dqdx * pk + vs->dqdy * py : 1.0f;
+        float w = 1.0f / frag.q[k];
+        for (int i = 0; i < N; i++) {
+            frag.attr[i][k] = (vs->a0[i] + vs->dadx[i] * pk + vs->dady[i] * py) * w;
+        }
+    }
+    st->shader.shade4(frag, out);
+}
+
+// 光栅化着色三角形，与 triangle_fill 相同只写入 [x0, x1] x [y0, y1]；分块模式下经 shade_fill 调用，payload 为 shaded_triangle_t
+template <typename Shader>
+inline void triangle_fill_shaded(device_t* device, const triangle_setup_t* ts, const void* payload,
+                                 int x0, int y0, int x1, int y1, fill_counts_t* counts)
+{
+    const shaded_triangle_t<Shader>* st = (const shaded_triangle_t<Shader>*)payload;
+    if (device->msaa) {
+        triangle_walk(device, ts, x0, y0, x1, y1, counts, [&](unsigned int*, float*, int x, int x_end, int y) {
+            msaa_span(device, ts, x, x_end, y, counts, [&](int px, int py, float zr, int mask, unsigned int* out) {
+                shade_pixels(ts, st, px, py, zr, mask, out, shader_has_shade4<Shader>());
+            });
+        });
+        return;
+    }
+    triangle_walk(device, ts, x0, y0, x1, y1, counts, [&](unsigned int* row, float* zrow, int x, int x_end, int y) {
+        span_shade(ts, st, row, zrow, x, x_end, y, counts, shader_has_shade4<Shader>());
+    });
+}
+
+// 绘制屏幕空间中的着色三角形（与 triangle() 相同不做面剔除），a1、a2、a3 为三个顶点的属性（各 Shader::VARYINGS 个）
+template <typename Shader>
+inline void triangle_shaded(device_t* device, const vec4_t* v1, const vec4_t* v2, const vec4_t* v3,
+                            const float* a1, const float* a2, const float* a3, const Shader& shader)
+{
+    static_assert(std::is_trivially_copyable<Shader>::value, "shader must be trivially copyable");
+    MICRO3D_STATS_ADD(device, triangles_setup, 1);
+    triangle_setup_t ts;
+    if (!triangle_setup(&ts, device, v1, v2, v3, 0)) {
+        MICRO3D_STATS_ADD(device, triangles_culled_degenerate, 1);
+        return;
+    }
+    if (hiz_occluded(device, ts.min_x, ts.min_y, ts.max_x, ts.max_y, ts.zmin)) {
+        MICRO3D_STATS_ADD(device, triangles_culled_hiz, 1);
+        return;
+    }
+    MICRO3D_STATS_ADD(device, triangles_rasterized, 1);
+
+    shaded_triangle_t<Shader> st;
+    varyings_setup(&st.varyings, v1, v2, v3, a1, a2, a3);
+    st.shader = shader;
+    if (device->binner) {
+        binner_add_shaded(device->binner, &ts, &st, sizeof(st), triangle_fill_shaded<Shader>);
+        return;
+    }
+    if (device->lazy_clear) {
+        lazy_clear_touch(device, ts.min_x, ts.min_y, ts.max_x, ts.max_y);
+    }
+    fill_counts_t local = {};
+    fill_counts_t* counts = device->stats ? &local : nullptr;
+    triangle_fill_shaded<Shader>(device, &ts, &st, 0, 0, device->width - 1, device->height - 1, counts);
+    if (counts) {
+        device->stats->pixels_tested += local.tested;
+        device->stats->pixels_written += local.written;
+        device->stats->hiz_blocks_culled += local.hiz_blocks_culled;
+    }
+}
+
+// 纯色着色器：没有属性
+struct shader_flat_t {
+    enum { VARYINGS = 0 };
+    unsigned int clr;
+    unsigned int operator()(const fragment_t<0>&) const { return clr; }
+};
+
+// 纯色着色器直接使用 triangle() 的 SIMD 纯色填充，与不经过着色器时的开销相同
+inline void triangle_shaded(device_t* device, const vec4_t* v1, const vec4_t* v2, const vec4_t* v3,
+                            const float*, const float*, const float*, const shader_flat_t& shader)
+{
+    triangle(device, v1, v2, v3, shader.clr);
+}
+
+// 限制到 [0, 1]：用比较而不是 fminf/fmaxf，后者在不开启快速浮点时可能编译为库函数调用
+inline float saturate(float v)
+{
+    v = v > 0.0f ? v : 0.0f;
+    return v < 1.0f ? v : 1.0f;
+}
+
+// RGB（0..1）-> 0xFFRRGGBB（不透明）
+inline unsigned int color_pack(float r, float g, float b)
+{
+    int ir = (int)(saturate(r) * 255.0f + 0.5f);
+    int ig = (int)(saturate(g) * 255.0f + 0.5f);
+    int ib = (int)(saturate(b) * 255.0f + 0.5f);
+    return 0xFF000000u | ((unsigned int)ir << 16) | ((unsigned int)ig << 8) | (unsigned int)ib;
+}
+
+// Gouraud 着色：顶点属性为 RGB（0..1），逐像素插值颜色
+struct shader_gouraud_t {
+    enum { VARYINGS = 3 };
+    unsigned int operator()(const fragment_t<3>& frag) const
+    {
+        return color_pack(frag.attr[0], frag.attr[1], frag.attr[2]);
+    }
+};
+
+// 纹理：宽高为 2 的幂，texel 为 0xAARRGGBB，mip 链逐级用 2x2 盒式滤波生成直到 1x1。
+// texel (x, y) 位于 texels[x_offset[x] + y_offset[y]]，每个 mip 级别各有一对偏移表：
+// TEXTURE_MORTON 布局下偏移表把 x、y 的各位交错（Z 序），4x4 的 texel 块正好占一条 64 字节的缓存行，
+// 旋转、缩小的表面上相邻像素读取的 texel 大多落在同一条缓存行，逐行布局下则每一行都是不同的缓存行。
+// 偏移表的下标范围为 [-1, size]，已经按环绕方式折算，双线性滤波的第二个 texel 不需要再做环绕
+typedef enum {
+    TEXTURE_MORTON = 0, // Z 序
+    TEXTURE_LINEAR      // 逐行
+} texture_layout_t;
+
+typedef enum {
+    TEXTURE_REPEAT = 0,
+    TEXTURE_CLAMP
+} texture_wrap_t;
+
+typedef enum {
+    TEXTURE_NEAREST = 0, // 最近的 mip 级别上取最近的 texel
+    TEXTURE_BILINEAR,    // 最近的 mip 级别上双线性插值
+    TEXTURE_TRILINEAR    // 相邻两个 mip 级别分别双线性插值，再按 LOD 的小数部分混合
+} texture_filter_t;
+
+static const int TEXTURE_MAX_SIZE = 32768;
+static const int TEXTURE_MAX_LEVELS = 16;
+
+typedef struct {
+    int width, height;
+    const int* x_offset; // 下标 [-1, width]
+    const int* y_offset; // 下标 [-1, height]，已包含本级在 texels 中的起始位置
+} texture_level_t;
+
+struct texture_t {
+    int width, height;
+    int levels;
+    texture_wrap_t wrap;
+    texture_layout_t layout;
+    texture_level_t level[TEXTURE_MAX_LEVELS];
+    std::vector<uint32_t> texels;
+    std::vector<int> offsets;
+};
+
+// 把 v 的低 16 位分散到偶数位上：...dcba -> ...0d0c0b0a
+inline uint32_t morton_spread(uint32_t v)
+{
+    v &= 0xFFFF;
+    v = (v | (v << 8)) & 0x00FF00FF;
+    v = (v | (v << 4)) & 0x0F0F0F0F;
+    v = (v | (v << 2)) & 0x33333333;
+    v = (v | (v << 1)) & 0x55555555;
+    return v;
+}
+
+// 一个坐标分量在 mip 级别内的偏移，axis 为 0 表示 x、1 表示 y；size 为这一方向的大小，other 为另一方向的大小。
+// Z 序布局下在边长为 min(width, height) 的方块内交错，较长的一边由多个方块依次排列
+inline int texture_axis_offset(texture_layout_t layout, int axis, int coord, int size, int other)
+{
+    if (layout == TEXTURE_LINEAR) {
+        return axis ? coord * other : coord;
+    }
+    int square = std::min(size, other);
+    return (int)(morton_spread((uint32_t)(coord & (square - 1))) << axis) + (coord / square) * square * square;
+}
+
+// 2x2 盒式滤波（各通道四舍五入）得到下一级；宽或高为 1 时只在另一个方向上平均
+inline void texture_downsample(uint32_t* dst, const uint32_t* src, int width, int height)
+{
+    int dw = std::max(1, width / 2), dh = std::max(1, height / 2);
+    int sx = width > 1 ? 1 : 0;
+    int sy = height > 1 ? width : 0;
+    for (int y = 0; y < dh; y++) {
+        for (int x = 0; x < dw; x++) {
+            const uint32_t* s = src + (size_t)y * (sy ? 2 * width : width) + x * (sx ? 2 : 1);
+            uint32_t a = s[0], b = s[sx], c = s[sy], d = s[sx + sy];
+            uint32_t rb = (a & 0x00FF00FF) + (b & 0x00FF00FF) + (c & 0x00FF00FF) + (d & 0x00FF00FF) + 0x00020002;
+            uint32_t ag = ((a >> 8) & 0x00FF00FF) + ((b >> 8) & 0x00FF00FF) + ((c >> 8) & 0x00FF00FF) +
+                          ((d >> 8) & 0x00FF00FF) + 0x00020002;
+            dst[(size_t)y * dw + x] = ((rb >> 2) & 0x00FF00FF) | (((ag >> 2) & 0x00FF00FF) << 8);
+        }
+    }
+}
+
+// 从逐行存放的 pixels 创建纹理，pitch 为每行的 texel 数；宽高必须是 2 的幂且不超过 TEXTURE_MAX_SIZE，否则返回空。
+// mipmaps 为假时只有第 0 级
+inline texture_t* texture_create(const uint32_t* pixels, int width, int height, int pitch,
+                                 texture_wrap_t wrap, texture_layout_t layout, bool mipmaps)
+{
+    if (width <= 0 || height <= 0 || width > TEXTURE_MAX_SIZE || height > TEXTURE_MAX_SIZE ||
+        (width & (width - 1)) || (height & (height - 1))) {
+        return nullptr;
+    }
+    texture_t* texture = new texture_t;
+    texture->width = width;
+    texture->height = height;
+    texture->wrap = wrap;
+    texture->layout = layout;
+
+    // 各级大小
+    size_t texel_count = 0, offset_count = 0;
+    int levels = 0;
+    for (int w = width, h = height;; w = std::max(1, w / 2), h = std::max(1, h / 2)) {
+        texture->level[levels].width = w;
+        texture->level[levels].height = h;
+        texel_count += (size_t)w * h;
+        offset_count += (size_t)w + h + 4;
+        levels++;
+        if (!mipmaps || (w == 1 && h == 1)) {
+            break;
+        }
+    }
+    texture->levels = levels;
+    texture->texels.resize(texel_count);
+    texture->offsets.resize(offset_count);
+
+    // 偏移表：环绕方式折算进 -1 和 size 两项
+    int* offsets = texture->offsets.data();
+    int base = 0;
+    for (int l = 0; l < levels; l++) {
+        texture_level_t* level = &texture->level[l];
+        int w = level->width, h = level->height;
+        for (int i = -1; i <= w; i++) {
+            int x = wrap == TEXTURE_REPEAT ? (i & (w - 1)) : std::min(std::max(i, 0), w - 1);
+            offsets[i + 1] = texture_axis_offset(layout, 0, x, w, h);
+        }
+        level->x_offset = offsets + 1;
+        offsets += w + 2;
+        for (int i = -1; i <= h; i++) {
+            int y = wrap == TEXTURE_REPEAT ? (i & (h - 1)) : std::min(std::max(i, 0), h - 1);
+            offsets[i + 1] = base + texture_axis_offset(layout, 1, y, h, w);
+        }
+        level->y_offset = offsets + 1;
+        offsets += h + 2;
+        base += w * h;
+    }
+
+    // 逐行生成各级，再按布局写入
+    std::vector<uint32_t> current((size_t)width * height), next;
+    for (int y = 0; y < height; y++) {
+        memcpy(&current[(size_t)y * width], pixels + (size_t)y * pitch, (size_t)width * sizeof(uint32_t));
+    }
+    for (int l = 0; l < levels; l++) {
+        const texture_level_t* level = &texture->level[l];
+        for (int y = 0; y < level->height; y++) {
+            for (int x = 0; x < level->width; x++) {
+                texture->texels[level->x_offset[x] + level->y_offset[y]] = current[(size_t)y * level->width + x];
+            }
+        }
+        if (l + 1 < levels) {
+            next.resize((size_t)texture->level[l + 1].width * texture->level[l + 1].height);
+            texture_downsample(next.data(), current.data(), level->width, level->height);
+            current.swap(next);
+        }
+    }
+    return texture;
+}
+
+inline void texture_destroy(texture_t* texture)
+{
+    delete texture;
+}
+
+// 棋盘格纹理：size x size，每格 cell 个 texel，亮格带有颜色渐变，用于演示和基准测试
+inline texture_t* texture_create_checker(int size, int cell, texture_layout_t layout)
+{
+    std::vector<uint32_t> pixels((size_t)size * size);
+    for (int y = 0; y < size; y++) {
+        for (int x = 0; x < size; x++) {
+            uint32_t r = (uint32_t)(x * 255 / size), g = (uint32_t)(y * 255 / size);
+            uint32_t clr = ((x / cell) ^ (y / cell)) & 1 ? 0x202020 : (r << 16) | (g << 8) | 0xC0;
+            pixels[(size_t)y * size + x] = 0xFF000000 | clr;
+        }
+    }
+    return texture_create(pixels.data(), size, size, size, TEXTURE_REPEAT, layout, true);
+}
+
+// 近似 log2：指数加上尾数的二次近似（误差约 0.01），只用于选择 mip 级别，避免逐像素调用 log2f
+inline float fast_log2(float v)
+{
+    uint32_t bits = float_bits(v);
+    float e = (float)((int)((bits >> 23) & 0xFF) - 127);
+    float m = float_from_bits((bits & 0x007FFFFF) | 0x3F800000) - 1.0f;
+    return e + m * (1.3465f - 0.3465f * m);
+}
+
+// 由纹理坐标在屏幕 x、y 方向上的变化量计算 LOD（纹理坐标 0..1 对应整个纹理）
+inline float texture_lod(const texture_t* texture, float dudx, float dvdx, float dudy, float dvdy)
+{
+    float w = (float)texture->width, h = (float)texture->height;
+    float dx = dudx * dudx * w * w + dvdx * dvdx * h * h;
+    float dy = dudy * dudy * w * w + dvdy * dvdy * h * h;
+    return 0.5f * fast_log2(dx > dy ? dx : dy);
+}
+
+// 纹理坐标转换为带 7 位小数的 texel 坐标（向下取整），texel 中心位于整数处；
+// 先限制到 ±2^30，超出范围的坐标和 NaN 不会溢出
+inline int texture_coord_fixed(float u, int size)
+{
+    float t = u * (float)(size * 128) - 64.0f;
+    t = t > -1073741824.0f ? t : -1073741824.0f;
+    t = t < 1073741824.0f ? t : 1073741824.0f;
+    int i = (int)t;
+    return i - ((float)i > t ? 1 : 0);
+}
+
+// 把 texel 坐标环绕到 [-1, size - 1]：下一个 texel 仍在偏移表的范围内
+inline int texture_wrap_coord(texture_wrap_t wrap, int x, int size)
+{
+    if (wrap == TEXTURE_REPEAT) {
+        return x & (size - 1);
+    }
+    return x < -1 ? -1 : (x > size - 1 ? size - 1 : x);
+}
+
+// 两个 texel 逐通道插值：a + (b - a) * w / 128，w 为 0..127；与 SIMD 路径的结果逐位相同
+inline uint32_t texel_lerp(uint32_t a, uint32_t b, int w)
+{
+    uint32_t result = 0;
+    for (int shift = 0; shift < 32; shift += 8) {
+        int ca = (int)((a >> shift) & 0xFF), cb = (int)((b >> shift) & 0xFF);
+        result |= (uint32_t)(ca + (((cb - ca) * w) >> 7)) << shift;
+    }
+    return result;
+}
+
+inline uint32_t texture_nearest(const texture_t* texture, int l, float u, float v)
+{
+    const texture_level_t* level = &texture->level[l];
+    int x = texture_wrap_coord(texture->wrap, (texture_coord_fixed(u, level->width) + 64) >> 7, level->width);
+    int y = texture_wrap_coord(texture->wrap, (texture_coord_fixed(v, level->height) + 64) >> 7, level->height);
+    return texture->texels[level->x_offset[x] + level->y_offset[y]];
+}
+
+inline uint32_t texture_bilinear(const texture_t* texture, int l, float u, float v)
+{
+    const texture_level_t* level = &texture->level[l];
+    int fx = texture_coord_fixed(u, level->width);
+    int fy = texture_coord_fixed(v, level->height);
+    int x = texture_wrap_coord(texture->wrap, fx >> 7, level->width);
+    int y = texture_wrap_coord(texture->wrap, fy >> 7, level->height);
+    const uint32_t* texels = texture->texels.data();
+    const int* xo = level->x_offset;
+    const int* yo = level->y_offset;
+    uint32_t top = texel_lerp(texels[xo[x] + yo[y]], texels[xo[x + 1] + yo[y]], fx & 127);
+    uint32_t bottom = texel_lerp(texels[xo[x] + yo[y + 1]], texels[xo[x + 1] + yo[y + 1]], fx & 127);
+    return texel_lerp(top, bottom, fy & 127);
+}
+
+// 按 LOD 选择 mip 级别：放大（LOD <= 0）时使用第 0 级；三线性滤波时 *weight 为下一级的权重（0..127）
+inline int texture_select_level(const texture_t* texture, texture_filter_t filter, float lod, int* weight)
+{
+    float max_level = (float)(texture->levels - 1);
+    lod = lod > 0.0f ? lod : 0.0f; // 同时处理 NaN
+    lod = lod < max_level ? lod : max_level;
+    if (filter != TEXTURE_TRILINEAR) {
+        *weight = 0;
+        return (int)(lod + 0.5f);
+    }
+    int l = (int)lod;
+    *weight = (int)((lod - (float)l) * 128.0f);
+    return l;
+}
+
+// 在纹理坐标 (u, v) 处采样，LOD 通常由 texture_lod 得到
+inline uint32_t texture_sample(const texture_t* texture, texture_filter_t filter, float u, float v, float lod)
+{
+    int weight;
+    int l = texture_select_level(texture, filter, lod, &weight);
+    if (filter == TEXTURE_NEAREST) {
+        return texture_nearest(texture, l, u, v);
+    }
+    uint32_t clr = texture_bilinear(texture, l, u, v);
+    if (weight) {
+        clr = texel_lerp(clr, texture_bilinear(texture, l + 1, u, v), weight);
+    }
+    return clr;
+}
+
+#ifdef MICRO3D_SSE2
+inline __m128i texture_coord_fixed_sse2(__m128 u, int size)
+{
+    __m128 t = _mm_sub_ps(_mm_mul_ps(u, _mm_set1_ps((float)(size * 128))), _mm_set1_ps(64.0f));
+    t = _mm_max_ps(t, _mm_set1_ps(-1073741824.0f));
+    t = _mm_min_ps(t, _mm_set1_ps(1073741824.0f));
+    __m128i i = _mm_cvttps_epi32(t);
+    return _mm_add_epi32(i, _mm_castps_si128(_mm_cmpgt_ps(_mm_cvtepi32_ps(i), t)));
+}
+
+inline __m128i texture_wrap_coord_sse2(texture_wrap_t wrap, __m128i x, int size)
+{
+    if (wrap == TEXTURE_REPEAT) {
+        return _mm_and_si128(x, _mm_set1_epi32(size - 1));
+    }
+    __m128i lo = _mm_set1_epi32(-1), hi = _mm_set1_epi32(size - 1);
+    __m128i below = _mm_cmplt_epi32(x, lo);
+    x = _mm_or_si128(_mm_and_si128(below, lo), _mm_andnot_si128(below, x));
+    __m128i above = _mm_cmpgt_epi32(x, hi);
+    return _mm_or_si128(_mm_and_si128(above, hi), _mm_andnot_si128(above, x));
+}
+
+// 4 个像素的 texel 逐通道插值：R/B 和 A/G 两两一组放在 16 位中，乘积不超过 255 * 127，不会溢出
+inline __m128i texel_lerp_sse2(__m128i a, __m128i b, __m128i w)
+{
+    __m128i mask = _mm_set1_epi32(0x00FF00FF);
+    __m128i w16 = _mm_or_si128(w, _mm_slli_epi32(w, 16));
+    __m128i a_rb = _mm_and_si128(a, mask), b_rb = _mm_and_si128(b, mask);
+    __m128i a_ag = _mm_and_si128(_mm_srli_epi32(a, 8), mask), b_ag = _mm_and_si128(_mm_srli_epi32(b, 8), mask);
+    __m128i rb = _mm_add_epi16(a_rb, _mm_srai_epi16(_mm_mullo_epi16(_mm_sub_epi16(b_rb, a_rb), w16), 7));
+    __m128i ag = _mm_add_epi16(a_ag, _mm_srai_epi16(_mm_mullo_epi16(_mm_sub_epi16(b_ag, a_ag), w16), 7));
+    return _mm_or_si128(_mm_and_si128(rb, mask), _mm_slli_epi32(_mm_and_si128(ag, mask), 8));
+}
+
+inline __m128i texture_nearest_sse2(const texture_t* texture, int l, __m128 u, __m128 v)
+{
+    const texture_level_t* level = &texture->level[l];
+    __m128i half = _mm_set1_epi32(64);
+    __m128i x = _mm_srai_epi32(_mm_add_epi32(texture_coord_fixed_sse2(u, level->width), half), 7);
+    __m128i y = _mm_srai_epi32(_mm_add_epi32(texture_coord_fixed_sse2(v, level->height), half), 7);
+    alignas(16) int xs[4], ys[4];
+    _mm_store_si128((__m128i*)xs, texture_wrap_coord_sse2(texture->wrap, x, level->width));
+    _mm_store_si128((__m128i*)ys, texture_wrap_coord_sse2(texture->wrap, y, level->height));
+    const uint32_t* texels = texture->texels.data();
+    const int* xo = level->x_offset;
+    const int* yo = level->y_offset;
+    return _mm_setr_epi32((int)texels[xo[xs[0]] + yo[ys[0]]], (int)texels[xo[xs[1]] + yo[ys[1]]],
+                          (int)texels[xo[xs[2]] + yo[ys[2]]], (int)texels[xo[xs[3]] + yo[ys[3]]]);
+}
+
+// 4 个像素的双线性滤波：坐标换算、环绕和滤波按 4 路并行，16 次 texel 读取为标量
+inline __m128i texture_bilinear_sse2(const texture_t* texture, int l, __m128 u, __m128 v)
+{
+    const texture_level_t* level = &texture->level[l];
+    __m128i fx = texture_coord_fixed_sse2(u, level->width);
+    __m128i fy = texture_coord_fixed_sse2(v, level->height);
+    alignas(16) int xs[4], ys[4];
+    _mm_store_si128((__m128i*)xs, texture_wrap_coord_sse2(texture->wrap, _mm_srai_epi32(fx, 7), level->width));
+    _mm_store_si128((__m128i*)ys, texture_wrap_coord_sse2(texture->wrap, _mm_srai_epi32(fy, 7), level->height));
+    const uint32_t* texels = texture->texels.data();
+    const int* xo = level->x_offset;
+    const int* yo = level->y_offset;
+    alignas(16) uint32_t t00[4], t10[4], t01[4], t11[4];
+    for (int k = 0; k < 4; k++) {
+        int x0 = xo[xs[k]], x1 = xo[xs[k] + 1];
+        int y0 = yo[ys[k]], y1 = yo[ys[k] + 1];
+        t00[k] = texels[x0 + y0];
+        t10[k] = texels[x1 + y0];
+        t01[k] = texels[x0 + y1];
+        t11[k] = texels[x1 + y1];
+    }
+    __m128i frac = _mm_set1_epi32(127);
+    __m128i wx = _mm_and_si128(fx, frac), wy = _mm_and_si128(fy, frac);
+    __m128i top = texel_lerp_sse2(_mm_load_si128((const __m128i*)t00), _mm_load_si128((const __m128i*)t10), wx);
+    __m128i bottom = texel_lerp_sse2(_mm_load_si128((const __m128i*)t01), _mm_load_si128((const __m128i*)t11), wx);
+    return texel_lerp_sse2(top, bottom, wy);
+}
+#endif
+
+// 同时采样 4 个纹理坐标 (u[k], v[k])，4 个像素共用一个 LOD（与 GPU 按 2x2 像素块计算 LOD 相同）；
+// 结果与逐个调用 texture_sample 逐位相同
+inline void texture_sample4(const texture_t* texture, texture_filter_t filter, const float* u, const float* v, float lod,
+                            uint32_t* out)
+{
+    int weight;
+    int l = texture_select_level(texture, filter, lod, &weight);
+#ifdef MICRO3D_SSE2
+    __m128 vu = _mm_loadu_ps(u), vv = _mm_loadu_ps(v);
+    __m128i clr;
+    if (filter == TEXTURE_NEAREST) {
+        clr = texture_nearest_sse2(texture, l, vu, vv);
+    } else {
+        clr = texture_bilinear_sse2(texture, l, vu, vv);
+        if (weight) {
+            clr = texel_lerp_sse2(clr, texture_bilinear_sse2(texture, l + 1, vu, vv), _mm_set1_epi32(weight));
+        }
+    }
+    _mm_storeu_si128((__m128i*)out, clr);
+#else
+    for (int k = 0; k < 4; k++) {
+        if (filter == TEXTURE_NEAREST) {
+            out[k] = texture_nearest(texture, l, u[k], v[k]);
+        } else {
+            out[k] = texture_bilinear(texture, l, u[k], v[k]);
+            if (weight) {
+                out[k] = texel_lerp(out[k], texture_bilinear(texture, l + 1, u[k], v[k]), weight);
+            }
+        }
+    }
+#endif
+}
+
+// 纹理着色器：顶点属性为纹理坐标 (u, v)，LOD 由纹理坐标在屏幕上的变化量得到；输出带有纹理的 alpha
+struct shader_texture_t {
+    enum { VARYINGS = 2 };
+    const texture_t* texture;
+    texture_filter_t filter;
+
+    unsigned int operator()(const fragment_t<2>& frag) const
+    {
+        float lod = 0.0f;
+        if (texture->levels > 1) {
+            lod = texture_lod(texture, fragment_ddx(frag, 0), fragment_ddx(frag, 1), fragment_ddy(frag, 0), fragment_ddy(frag, 1));
+        }
+        return texture_sample(texture, filter, frag.attr[0], frag.attr[1], lod);
+    }
+
+    // LOD 取第一个要写入的像素处的值
+    void shade4(const fragment4_t<2>& frag, unsigned int* out) const
+    {
+        float lod = 0.0f;
+        if (texture->levels > 1) {
+            int k = 0;
+            while (!(frag.mask & (1 << k))) {
+                k++;
+            }
+            lod = texture_lod(texture, fragment4_ddx(frag, 0, k), fragment4_ddx(frag, 1, k),
+                              fragment4_ddy(frag, 0, k), fragment4_ddy(frag, 1, k));
+        }
+        texture_sample4(texture, filter, frag.attr[0], frag.attr[1], lod, out);
+    }
+};
+
+// 线框模式：屏幕坐标的三条边经 line_screen 先按浮点坐标裁剪到视口，再用 run-slice 光栅化；
+// 远在屏幕外或不是有限值的顶点不会在转换为整数时溢出
+inline void triangle_wireframe(device_t* device, const vec4_t* v1, const vec4_t* v2, const vec4_t* v3, unsigned int clr)
+{
+    // 分块模式下先画完已分箱的三角形，保持绘制顺序
+    binner_flush(device);
+    MICRO3D_STATS_SCOPE(device, STATS_LINE);
+    MICRO3D_STATS_ADD(device, lines, 3);
+    line_screen(device, v1->x, v1->y, v2->x, v2->y, clr);
+    line_screen(device, v2->x, v2->y, v3->x, v3->y, clr);
+    line_screen(device, v3->x, v3->y, v1->x, v1->y, clr);
+}
+
+inline void matrix_look_at(matrix_t* view, vec4_t* eye, vec4_t* target, vec4_t* up)
+{
+    // 计算前向向量 (forward = target - eye)
+    vec4_t forward = {
+        target->x - eye->x,
+        target->y - eye->y,
+        target->z - eye->z,
+        0.0f
+    };
+
+    // 归一化前向向量
+    float length = sqrtf(forward.x * forward.x + forward.y * forward.y + forward.z * forward.z);
+    if (length > 0) {
+        forward.x /= length;
+        forward.y /= length;
+        forward.z /= length;
+    }
+
+    // 计算右向量 (right = forward × up)
+    vec4_t right = {
+        forward.y * up->z - forward.z * up->y,
+        forward.z * up->x - forward.x * up->z,
+        forward.x * up->y - forward.y * up->x,
+        0.0f
+    };
+
+    // 归一化右向量
+    length = sqrtf(right.x * right.x + right.y * right.y + right.z * right.z);
+    if (length > 0) {
+        right.x /= length;
+        right.y /= length;
+        right.z /= length;
+    }
+
+    // 计算上向量 (up = right × forward)
+    vec4_t new_up = {
+        right.y * forward.z - right.z * forward.y,
+        right.z * forward.x - right.x * forward.z,
+        right.x * forward.y - right.y * forward.x,
+        0.0f
+    };
+
+    // 构建视图矩阵 (右手坐标系，相机看向 -z 方向)
+    // 旋转部分
+    view->m[0][0] = right.x;
+    view->m[0][1] = new_up.x;
+    view->m[0][2] = -forward.x;
+    view->m[0][3] = 0.0f;
+
+    view->m[1][0] = right.y;
+    view->m[1][1] = new_up.y;
+    view->m[1][2] = -forward.y;
+    view->m[1][3] = 0.0f;
+
+    view->m[2][0] = right.z;
+    view->m[2][1] = new_up.z;
+    view->m[2][2] = -forward.z;
+    view->m[2][3] = 0.0f;
+
+    // 平移部分 (将世界坐标转换到相机坐标)
+    view->m[3][0] = -(right.x * eye->x + right.y * eye->y + right.z * eye->z);
+    view->m[3][1] = -(new_up.x * eye->x + new_up.y * eye->y + new_up.z * eye->z);
+    view->m[3][2] = forward.x * eye->x + forward.y * eye->y + forward.z * eye->z;
+    view->m[3][3] = 1.0f;
+}
+
+inline void matrix_perspective_fov(matrix_t* projection, float fovY, float aspect, float zn, float zf)
+{
+    // 清除矩阵
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            projection->m[i][j] = 0.0f;
+        }
+    }
+
+    // 计算投影参数
+    float yScale = 1.0f / tanf(fovY * 0.5f); // cot(fovY/2)
+    float xScale = yScale / aspect;
+
+    // 构建右手透视投影矩阵，与 matrix_look_at 一致：相机看向 -z 方向
+    // 相机前方的点 w = -z_view > 0，透视除法后深度范围为 [0, 1]（近平面为 0，远平面为 1）
+    projection->m[0][0] = xScale; // 缩放 x 坐标
+    projection->m[1][1] = yScale; // 缩放 y 坐标
+    projection->m[2][2] = zf / (zn - zf); // 深度映射
+    projection->m[2][3] = -1.0f; // 透视除法
+    projection->m[3][2] = zn * zf / (zn - zf); // 深度平移
+}
+
+// 矩阵乘法：result = a * b
+inline void matrix_multiply(matrix_t* result, const matrix_t* a, const matrix_t* b)
+{
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            result->m[i][j] = 0;
+            for (int k = 0; k < 4; k++) {
+                result->m[i][j] += a->m[i][k] * b->m[k][j];
+            }
+        }
+    }
+}
+
+// 向量与矩阵乘法：result = v * m
+inline void vector_transform(vec4_t* result, const vec4_t* v, const matrix_t* m)
+{
+    result->x = v->x * m->m[0][0] + v->y * m->m[1][0] + v->z * m->m[2][0] + v->w * m->m[3][0];
+    result->y = v->x * m->m[0][1] + v->y * m->m[1][1] + v->z * m->m[2][1] + v->w * m->m[3][1];
+    result->z = v->x * m->m[0][2] + v->y * m->m[1][2] + v->z * m->m[2][2] + v->w * m->m[3][2];
+    result->w = v->x * m->m[0][3] + v->y * m->m[1][3] + v->z * m->m[2][3] + v->w * m->m[3][3];
+}
+
+// 透视除法：将齐次坐标转换为屏幕坐标
+inline void perspective_divide(vec4_t* v)
+{
+    if (v->w != 0.0f) {
+        v->x /= v->w;
+        v->y /= v->w;
+        v->z /= v->w;
+    }
+}
+
+// 将标准化设备坐标转换为屏幕坐标
+inline void viewport_transform(vec4_t* v, int screen_width, int screen_height)
+{
+    v->x = (v->x + 1.0f) * 0.5f * screen_width;
+    v->y = (1.0f - v->y) * 0.5f * screen_height; // Y轴翻转
+}
+
+// 创建单位矩阵
+inline void matrix_identity(matrix_t* m)
+{
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            m->m[i][j] = (i == j) ? 1.0f : 0.0f;
+        }
+    }
+}
+
+// 创建平移矩阵
+inline void matrix_translation(matrix_t* m, float tx, float ty, float tz)
+{
+    matrix_identity(m);
     m->m[3][0] = tx;
     m->m[3][1] = ty;
     m->m[3][2] = tz;
 }
 
-// 创建旋转矩阵（绕X轴）
-inline void matrix_rotation_x(matrix_t* m, float angle)
+// 创建旋转矩阵（绕X轴）
+inline void matrix_rotation_x(matrix_t* m, float angle)
+{
+    matrix_identity(m);
+    float cosA = cosf(angle);
+    float sinA = sinf(angle);
+    m->m[1][1] = cosA;
+    m->m[1][2] = sinA;
+    m->m[2][1] = -sinA;
+    m->m[2][2] = cosA;
+}
+
+// 创建旋转矩阵（绕Y轴）
+inline void matrix_rotation_y(matrix_t* m, float angle)
+{
+    matrix_identity(m);
+    float cosA = cosf(angle);
+    float sinA = sinf(angle);
+    m->m[0][0] = cosA;
+    m->m[0][2] = -sinA;
+    m->m[2][0] = sinA;
+    m->m[2][2] = cosA;
+}
+
+// 创建缩放矩阵
+inline void matrix_scaling(matrix_t* m, float sx, float sy, float sz)
+{
+    matrix_identity(m);
+    m->m[0][0] = sx;
+    m->m[1][1] = sy;
+    m->m[2][2] = sz;
+}
+
+// 裁剪：顶点经过 world * view * projection 变换后位于裁剪空间 (x, y, z, w)，
+// 可见区域为 -w <= x <= w、-w <= y <= w、0 <= z <= w。
+// 近平面和远平面总是精确裁剪（近平面之后 w > 0，透视除法才有意义）；
+// x、y 方向使用保护带（guard band）：超出视口但仍在保护带内的三角形直接光栅化，
+// 边界框会被限制在屏幕内，只有超出保护带的部分才需要裁剪，从而保证屏幕坐标有界
+static const float GUARD_BAND_PIXELS = 4096.0f;
+
+enum {
+    CLIP_LEFT = 1 << 0,   // x < -w
+    CLIP_RIGHT = 1 << 1,  // x > w
+    CLIP_BOTTOM = 1 << 2, // y < -w
+    CLIP_TOP = 1 << 3,    // y > w
+    CLIP_NEAR = 1 << 4,   // z < 0
+    CLIP_FAR = 1 << 5,    // z > w
+    CLIP_GUARD_LEFT = 1 << 6,   // x < -gx * w
+    CLIP_GUARD_RIGHT = 1 << 7,  // x > gx * w
+    CLIP_GUARD_BOTTOM = 1 << 8, // y < -gy * w
+    CLIP_GUARD_TOP = 1 << 9,    // y > gy * w
+
+    CLIP_FRUSTUM = CLIP_LEFT | CLIP_RIGHT | CLIP_BOTTOM | CLIP_TOP | CLIP_NEAR | CLIP_FAR,
+    CLIP_GUARD = CLIP_GUARD_LEFT | CLIP_GUARD_RIGHT | CLIP_GUARD_BOTTOM | CLIP_GUARD_TOP,
+    CLIP_DEPTH = CLIP_NEAR | CLIP_FAR
+};
+
+// 保护带在 NDC 中的范围：|x| <= gx、|y| <= gy 时屏幕坐标在视口外 GUARD_BAND_PIXELS 以内
+typedef struct {
+    float gx, gy;
+} guard_band_t;
+
+inline guard_band_t guard_band(const device_t* device)
+{
+    guard_band_t gb;
+    gb.gx = 1.0f + 2.0f * GUARD_BAND_PIXELS / (float)device->width;
+    gb.gy = 1.0f + 2.0f * GUARD_BAND_PIXELS / (float)device->height;
+    return gb;
+}
+
+// 计算裁剪空间顶点的外码
+inline int clip_outcode(const vec4_t* v, const guard_band_t* gb)
+{
+    int code = 0;
+    if (v->x < -v->w) code |= CLIP_LEFT;
+    if (v->x > v->w) code |= CLIP_RIGHT;
+    if (v->y < -v->w) code |= CLIP_BOTTOM;
+    if (v->y > v->w) code |= CLIP_TOP;
+    if (v->z < 0) code |= CLIP_NEAR;
+    if (v->z > v->w) code |= CLIP_FAR;
+    if (v->x < -gb->gx * v->w) code |= CLIP_GUARD_LEFT;
+    if (v->x > gb->gx * v->w) code |= CLIP_GUARD_RIGHT;
+    if (v->y < -gb->gy * v->w) code |= CLIP_GUARD_BOTTOM;
+    if (v->y > gb->gy * v->w) code |= CLIP_GUARD_TOP;
+    return code;
+}
+
+// 顶点到裁剪平面的有向距离，>= 0 为内侧
+inline float clip_distance(const vec4_t* v, int plane, const guard_band_t* gb)
+{
+    switch (plane) {
+    case CLIP_NEAR: return v->z;
+    case CLIP_FAR: return v->w - v->z;
+    case CLIP_GUARD_LEFT: return v->x + gb->gx * v->w;
+    case CLIP_GUARD_RIGHT: return gb->gx * v->w - v->x;
+    case CLIP_GUARD_BOTTOM: return v->y + gb->gy * v->w;
+    default: return gb->gy * v->w - v->y;
+    }
+}
+
+inline vec4_t vec4_lerp(const vec4_t* a, const vec4_t* b, float t)
+{
+    vec4_t v = {
+        a->x + (b->x - a->x) * t,
+        a->y + (b->y - a->y) * t,
+        a->z + (b->z - a->z) * t,
+        a->w + (b->w - a->w) * t
+    };
+    return v;
+}
+
+// 带属性的裁剪顶点：属性和位置一样在裁剪空间中线性插值
+template <int N>
+struct clip_vertex_t {
+    vec4_t pos;
+    float attr[N > 0 ? N : 1];
+};
+
+inline const vec4_t* vertex_position(const vec4_t* v)
+{
+    return v;
+}
+
+template <int N>
+inline const vec4_t* vertex_position(const clip_vertex_t<N>* v)
+{
+    return &v->pos;
+}
+
+inline vec4_t vertex_lerp(const vec4_t* a, const vec4_t* b, float t)
+{
+    return vec4_lerp(a, b, t);
+}
+
+template <int N>
+inline clip_vertex_t<N> vertex_lerp(const clip_vertex_t<N>* a, const clip_vertex_t<N>* b, float t)
+{
+    clip_vertex_t<N> v;
+    v.pos = vec4_lerp(&a->pos, &b->pos, t);
+    for (int i = 0; i < N; i++) {
+        v.attr[i] = a->attr[i] + (b->attr[i] - a->attr[i]) * t;
+    }
+    return v;
+}
+
+// 求边与裁剪平面的交点：总是从内侧顶点向外侧顶点插值，
+// 相邻三角形的公共边得到完全相同的交点，裁剪后不会出现裂缝
+template <typename V>
+inline V clip_intersect(const V* in, const V* out, float d_in, float d_out)
+{
+    return vertex_lerp(in, out, d_in / (d_in - d_out));
+}
+
+// Sutherland-Hodgman：用一个平面裁剪凸多边形，返回输出顶点数；V 为 vec4_t 或 clip_vertex_t
+template <typename V>
+inline int clip_polygon(V* out, const V* in, int count, int plane, const guard_band_t* gb)
+{
+    int n = 0;
+    for (int i = 0; i < count; i++) {
+        const V* a = &in[i];
+        const V* b = &in[i + 1 < count ? i + 1 : 0];
+        float da = clip_distance(vertex_position(a), plane, gb);
+        float db = clip_distance(vertex_position(b), plane, gb);
+        if (da >= 0) {
+            out[n++] = *a;
+        }
+        if ((da >= 0) != (db >= 0)) {
+            out[n++] = da >= 0 ? clip_intersect(a, b, da, db) : clip_intersect(b, a, db, da);
+        }
+    }
+    return n;
+}
+
+// 裁剪三角形 poly[0][0..2]：先裁近远平面，之后 w > 0，再按新多边形的外码决定要裁哪些保护带平面。
+// codes 为三个顶点外码的并，每个平面最多增加一个顶点（3 + 6）；返回结果所在的缓冲，*count 为顶点数（小于 3 时已被完全裁掉）
+template <typename V>
+inline V* clip_triangle(V (*poly)[9], int codes, const guard_band_t* gb, int* count)
+{
+    int n = 3;
+    int cur = 0;
+    int planes = codes & CLIP_DEPTH;
+    for (int plane = CLIP_NEAR; plane <= CLIP_GUARD_TOP && n >= 3; plane <<= 1) {
+        if (plane == CLIP_GUARD_LEFT) {
+            int guard = 0;
+            for (int i = 0; i < n; i++) {
+                guard |= clip_outcode(vertex_position(&poly[cur][i]), gb);
+            }
+            planes |= guard & CLIP_GUARD;
+        }
+        if (planes & plane) {
+            n = clip_polygon(poly[cur ^ 1], poly[cur], n, plane, gb);
+            cur ^= 1;
+        }
+    }
+    *count = n;
+    return poly[cur];
+}
+
+// 裁剪空间坐标 -> 屏幕坐标 (x, y, z/w, w)：透视除法和视口变换合并为一步，
+// 与批量顶点处理 process_vertices 的计算方式相同，两条路径得到的屏幕坐标一致
+inline void clip_to_screen(vec4_t* v, const device_t* device)
+{
+    float rw = 1.0f / v->w;
+    float hw = 0.5f * (float)device->width;
+    float hh = 0.5f * (float)device->height;
+    v->x = (v->x * rw + 1.0f) * hw;
+    v->y = (1.0f - v->y * rw) * hh; // Y轴翻转
+    v->z = v->z * rw;
+}
+
+// 裁剪空间中三角形的朝向：由 (x, y, w) 组成的 3x3 行列式取负。
+// 三个顶点都在相机前方时与屏幕空间的有向面积同号（视口变换翻转了 y，所以取负）；
+// 有顶点在相机后方时，其符号仍是三角形可见部分的朝向，因此可以在裁剪之前做面剔除
+inline float clip_orientation(const vec4_t* v1, const vec4_t* v2, const vec4_t* v3)
+{
+    return -(v1->x * (v2->y * v3->w - v3->y * v2->w) -
+             v1->y * (v2->x * v3->w - v3->x * v2->w) +
+             v1->w * (v2->x * v3->y - v3->x * v2->y));
+}
+
+// 图元装配阶段的剔除：area 为屏幕空间的有向面积（或与之同号的量），正值为顺时针。
+// 屏幕空间的三角形传入 triangle_snapped_area，与三角形建立使用同一个精确的整数面积，不需要浮点容差。
+// area 为 0 的三角形退化，总是剔除；其余按 cull_mode 剔除。被剔除的三角形不进入三角形建立
+inline bool triangle_culled(device_t* device, float area)
+{
+    if (area == 0.0f) {
+        MICRO3D_STATS_ADD(device, triangles_culled_degenerate, 1);
+        return true;
+    }
+    if ((device->cull_mode == CULL_CW && area > 0) || (device->cull_mode == CULL_CCW && area < 0)) {
+        MICRO3D_STATS_ADD(device, triangles_culled_backface, 1);
+        return true;
+    }
+    return false;
+}
+
+// 绘制裁剪空间中的三角形（顶点为 vector_transform 的结果）：
+// 完全在某个视锥平面外的直接剔除；面积为 0 或被面剔除的直接丢弃；在近远平面之间且在保护带内的直接光栅化；
+// 其余的先在裁剪空间中裁剪成凸多边形，再按扇形拆成三角形
+inline void draw_triangle(device_t* device, const vec4_t* v1, const vec4_t* v2, const vec4_t* v3, unsigned int clr)
+{
+    guard_band_t gb = guard_band(device);
+    int c1 = clip_outcode(v1, &gb);
+    int c2 = clip_outcode(v2, &gb);
+    int c3 = clip_outcode(v3, &gb);
+    MICRO3D_STATS_ADD(device, triangles_submitted, 1);
+
+    // 三个顶点都在同一个视锥平面外：平凡剔除
+    if (c1 & c2 & c3 & CLIP_FRUSTUM) {
+        MICRO3D_STATS_ADD(device, triangles_culled_frustum, 1);
+        return;
+    }
+
+    if (((c1 | c2 | c3) & (CLIP_DEPTH | CLIP_GUARD)) == 0) {
+        vec4_t s1 = *v1, s2 = *v2, s3 = *v3;
+        clip_to_screen(&s1, device);
+        clip_to_screen(&s2, device);
+        clip_to_screen(&s3, device);
+        if (triangle_culled(device, (float)triangle_snapped_area(&s1, &s2, &s3))) {
+            return;
+        }
+        triangle(device, &s1, &s2, &s3, clr);
+        return;
+    }
+
+    // 在裁剪空间中判断朝向，背面三角形不做裁剪
+    if (triangle_culled(device, clip_orientation(v1, v2, v3))) {
+        return;
+    }
+
+    MICRO3D_STATS_ADD(device, triangles_clipped, 1);
+
+    vec4_t poly[2][9];
+    poly[0][0] = *v1;
+    poly[0][1] = *v2;
+    poly[0][2] = *v3;
+    int n;
+    vec4_t* out = clip_triangle(poly, c1 | c2 | c3, &gb, &n);
+    if (n < 3) {
+        return;
+    }
+
+    for (int i = 0; i < n; i++) {
+        clip_to_screen(&out[i], device);
+    }
+    for (int i = 1; i + 1 < n; i++) {
+        triangle(device, &out[0], &out[i], &out[i + 1], clr);
+    }
+}
+
+// 绘制裁剪空间中的着色三角形，a1、a2、a3 为顶点属性；剔除和裁剪与 draw_triangle 相同，裁剪时属性一起插值
+template <typename Shader>
+inline void draw_triangle_shaded(device_t* device, const vec4_t* v1, const vec4_t* v2, const vec4_t* v3,
+                                 const float* a1, const float* a2, const float* a3, const Shader& shader)
+{
+    enum { N = Shader::VARYINGS };
+    guard_band_t gb = guard_band(device);
+    int c1 = clip_outcode(v1, &gb);
+    int c2 = clip_outcode(v2, &gb);
+    int c3 = clip_outcode(v3, &gb);
+    MICRO3D_STATS_ADD(device, triangles_submitted, 1);
+
+    if (c1 & c2 & c3 & CLIP_FRUSTUM) {
+        MICRO3D_STATS_ADD(device, triangles_culled_frustum, 1);
+        return;
+    }
+
+    if (((c1 | c2 | c3) & (CLIP_DEPTH | CLIP_GUARD)) == 0) {
+        vec4_t s1 = *v1, s2 = *v2, s3 = *v3;
+        clip_to_screen(&s1, device);
+        clip_to_screen(&s2, device);
+        clip_to_screen(&s3, device);
+        if (triangle_culled(device, (float)triangle_snapped_area(&s1, &s2, &s3))) {
+            return;
+        }
+        triangle_shaded(device, &s1, &s2, &s3, a1, a2, a3, shader);
+        return;
+    }
+
+    if (triangle_culled(device, clip_orientation(v1, v2, v3))) {
+        return;
+    }
+
+    MICRO3D_STATS_ADD(device, triangles_clipped, 1);
+
+    clip_vertex_t<N> poly[2][9];
+    const vec4_t* v[3] = { v1, v2, v3 };
+    const float* a[3] = { a1, a2, a3 };
+    for (int k = 0; k < 3; k++) {
+        poly[0][k].pos = *v[k];
+        for (int i = 0; i < N; i++) {
+            poly[0][k].attr[i] = a[k][i];
+        }
+    }
+    int n;
+    clip_vertex_t<N>* out = clip_triangle(poly, c1 | c2 | c3, &gb, &n);
+    if (n < 3) {
+        return;
+    }
+
+    for (int i = 0; i < n; i++) {
+        clip_to_screen(&out[i].pos, device);
+    }
+    for (int i = 1; i + 1 < n; i++) {
+        triangle_shaded(device, &out[0].pos, &out[i].pos, &out[i + 1].pos, out[0].attr, out[i].attr, out[i + 1].attr, shader);
+    }
+}
+
+inline void draw_triangle_shaded(device_t* device, const vec4_t* v1, const vec4_t* v2, const vec4_t* v3,
+                                 const float*, const float*, const float*, const shader_flat_t& shader)
+{
+    draw_triangle(device, v1, v2, v3, shader.clr);
+}
+
+// 裁剪空间中的线段：对近远平面和保护带做参数化裁剪（Liang-Barsky），投影到屏幕后再由 line_screen 裁剪到视口。
+// 不刷新分块、不计数，由 draw_line 和 draw_lines_indexed 调用
+inline void line_clip_space(device_t* device, const vec4_t* v1, const vec4_t* v2, unsigned int clr)
+{
+    guard_band_t gb = guard_band(device);
+    int c1 = clip_outcode(v1, &gb);
+    int c2 = clip_outcode(v2, &gb);
+    if (c1 & c2 & CLIP_FRUSTUM) {
+        return;
+    }
+
+    float t0 = 0.0f, t1 = 1.0f;
+    int planes = (c1 | c2) & (CLIP_DEPTH | CLIP_GUARD);
+    for (int plane = CLIP_NEAR; plane <= CLIP_GUARD_TOP; plane <<= 1) {
+        if (!(planes & plane)) {
+            continue;
+        }
+        float d1 = clip_distance(v1, plane, &gb);
+        float d2 = clip_distance(v2, plane, &gb);
+        if (d1 < 0 && d2 < 0) {
+            return;
+        }
+        if (d1 < 0) {
+            t0 = fmaxf(t0, d1 / (d1 - d2));
+        } else if (d2 < 0) {
+            t1 = fminf(t1, d1 / (d1 - d2));
+        }
+    }
+    if (t0 > t1) {
+        return;
+    }
+
+    vec4_t a = t0 > 0 ? vec4_lerp(v1, v2, t0) : *v1;
+    vec4_t b = t1 < 1 ? vec4_lerp(v1, v2, t1) : *v2;
+    clip_to_screen(&a, device);
+    clip_to_screen(&b, device);
+    line_screen(device, a.x, a.y, b.x, b.y, clr);
+}
+
+// 绘制裁剪空间中的线段
+inline void draw_line(device_t* device, const vec4_t* v1, const vec4_t* v2, unsigned int clr)
+{
+    binner_flush(device);
+    MICRO3D_STATS_SCOPE(device, STATS_LINE);
+    MICRO3D_STATS_ADD(device, lines, 1);
+    line_clip_space(device, v1, v2, clr);
+}
+
+// 用 Hi-Z 查询屏幕坐标范围 [min_x, max_x] x [min_y, max_y] 在深度 min_z 处是否已被完全遮挡
+inline bool hiz_occluded_bounds(const device_t* device, float min_x, float min_y, float max_x, float max_y, float min_z)
+{
+    if (max_x < 0 || max_y < 0 || min_x >= device->width || min_y >= device->height) {
+        return false;
+    }
+    return hiz_occluded(device, (int)fmaxf(min_x, 0.0f), (int)fmaxf(min_y, 0.0f),
+                        (int)fminf(max_x, (float)(device->width - 1)), (int)fminf(max_y, (float)(device->height - 1)), min_z);
+}
+
+// 用 Hi-Z 查询一组裁剪空间顶点（如物体的包围盒角点）覆盖的屏幕区域是否已被完全遮挡；
+// 有顶点在近平面之前时无法得到有效的屏幕范围，保守地返回 false
+inline bool hiz_occluded_points(const device_t* device, const vec4_t* points, int count)
+{
+    if (!device->hiz || count <= 0) {
+        return false;
+    }
+    float min_x = 0, max_x = 0, min_y = 0, max_y = 0, min_z = 0;
+    for (int i = 0; i < count; i++) {
+        if (points[i].z < 0) {
+            return false;
+        }
+        vec4_t s = points[i];
+        clip_to_screen(&s, device);
+        if (i == 0) {
+            min_x = max_x = s.x;
+            min_y = max_y = s.y;
+            min_z = s.z;
+        } else {
+            min_x = fminf(min_x, s.x);
+            max_x = fmaxf(max_x, s.x);
+            min_y = fminf(min_y, s.y);
+            max_y = fmaxf(max_y, s.y);
+            min_z = fminf(min_z, s.z);
+        }
+    }
+    return hiz_occluded_bounds(device, min_x, min_y, max_x, max_y, min_z);
+}
+
+// 计算 world * view * projection
+inline void transform_wvp(matrix_t* wvp, const transform_t* transform)
+{
+    matrix_t world_view;
+    matrix_multiply(&world_view, &transform->world, &transform->view);
+    matrix_multiply(wvp, &world_view, &transform->projection);
+}
+
+// 批量顶点处理：一次遍历完成矩阵变换、外码计算、透视除法（乘以 1/w）和视口变换。
+// clip 输出裁剪空间坐标（供裁剪使用），outcodes 输出外码，screen 输出 clip_to_screen 的结果，
+// 只对外码不含 CLIP_NEAR 的顶点有意义
+inline void process_vertices_scalar(vec4_t* clip, vec4_t* screen, int* outcodes,
+                                    const vec4_t* in, int count, const matrix_t* m, const device_t* device)
+{
+    guard_band_t gb = guard_band(device);
+    for (int i = 0; i < count; i++) {
+        vector_transform(&clip[i], &in[i], m);
+        outcodes[i] = clip_outcode(&clip[i], &gb);
+        screen[i] = clip[i];
+        clip_to_screen(&screen[i], device);
+    }
+}
+
+#ifdef MICRO3D_SSE2
+inline __m128i outcode_bit_sse2(__m128 mask, int bit)
+{
+    return _mm_and_si128(_mm_castps_si128(mask), _mm_set1_epi32(bit));
+}
+
+// SSE2 路径：每次把 4 个顶点转置成 SoA（x、y、z、w 各占一个寄存器），逐分量计算后再转置回 AoS 写出；
+// 不足 4 个的尾部交给标量路径
+inline void process_vertices_sse2(vec4_t* clip, vec4_t* screen, int* outcodes,
+                                  const vec4_t* in, int count, const matrix_t* m, const device_t* device)
+{
+    guard_band_t gb = guard_band(device);
+    __m128 mc[4][4];
+    for (int r = 0; r < 4; r++) {
+        for (int c = 0; c < 4; c++) {
+            mc[r][c] = _mm_set1_ps(m->m[r][c]);
+        }
+    }
+    __m128 sign = _mm_set1_ps(-0.0f);
+    __m128 gx = _mm_set1_ps(gb.gx), ngx = _mm_set1_ps(-gb.gx);
+    __m128 gy = _mm_set1_ps(gb.gy), ngy = _mm_set1_ps(-gb.gy);
+    __m128 zero = _mm_setzero_ps();
+    __m128 one = _mm_set1_ps(1.0f);
+    __m128 hw = _mm_set1_ps(0.5f * (float)device->width);
+    __m128 hh = _mm_set1_ps(0.5f * (float)device->height);
+
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 x = _mm_loadu_ps(&in[i].x);
+        __m128 y = _mm_loadu_ps(&in[i + 1].x);
+        __m128 z = _mm_loadu_ps(&in[i + 2].x);
+        __m128 w = _mm_loadu_ps(&in[i + 3].x);
+        _MM_TRANSPOSE4_PS(x, y, z, w);
+
+        __m128 c[4];
+        for (int j = 0; j < 4; j++) {
+            c[j] = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, mc[0][j]), _mm_mul_ps(y, mc[1][j])),
+                                         _mm_mul_ps(z, mc[2][j])), _mm_mul_ps(w, mc[3][j]));
+        }
+
+        __m128 nw = _mm_xor_ps(c[3], sign);
+        __m128i code = outcode_bit_sse2(_mm_cmplt_ps(c[0], nw), CLIP_LEFT);
+        code = _mm_or_si128(code, outcode_bit_sse2(_mm_cmpgt_ps(c[0], c[3]), CLIP_RIGHT));
+        code = _mm_or_si128(code, outcode_bit_sse2(_mm_cmplt_ps(c[1], nw), CLIP_BOTTOM));
+        code = _mm_or_si128(code, outcode_bit_sse2(_mm_cmpgt_ps(c[1], c[3]), CLIP_TOP));
+        code = _mm_or_si128(code, outcode_bit_sse2(_mm_cmplt_ps(c[2], zero), CLIP_NEAR));
+        code = _mm_or_si128(code, outcode_bit_sse2(_mm_cmpgt_ps(c[2], c[3]), CLIP_FAR));
+        code = _mm_or_si128(code, outcode_bit_sse2(_mm_cmplt_ps(c[0], _mm_mul_ps(ngx, c[3])), CLIP_GUARD_LEFT));
+        code = _mm_or_si128(code, outcode_bit_sse2(_mm_cmpgt_ps(c[0], _mm_mul_ps(gx, c[3])), CLIP_GUARD_RIGHT));
+        code = _mm_or_si128(code, outcode_bit_sse2(_mm_cmplt_ps(c[1], _mm_mul_ps(ngy, c[3])), CLIP_GUARD_BOTTOM));
+        code = _mm_or_si128(code, outcode_bit_sse2(_mm_cmpgt_ps(c[1], _mm_mul_ps(gy, c[3])), CLIP_GUARD_TOP));
+        _mm_storeu_si128((__m128i*)&outcodes[i], code);
+
+        __m128 rw = _mm_div_ps(one, c[3]);
+        __m128 sx = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(c[0], rw), one), hw);
+        __m128 sy = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(c[1], rw)), hh);
+        __m128 sz = _mm_mul_ps(c[2], rw);
+        __m128 sw = c[3];
+        _MM_TRANSPOSE4_PS(sx, sy, sz, sw);
+        _mm_storeu_ps(&screen[i].x, sx);
+        _mm_storeu_ps(&screen[i + 1].x, sy);
+        _mm_storeu_ps(&screen[i + 2].x, sz);
+        _mm_storeu_ps(&screen[i + 3].x, sw);
+
+        _MM_TRANSPOSE4_PS(c[0], c[1], c[2], c[3]);
+        for (int j = 0; j < 4; j++) {
+            _mm_storeu_ps(&clip[i + j].x, c[j]);
+        }
+    }
+    process_vertices_scalar(clip + i, screen + i, outcodes + i, in + i, count - i, m, device);
+}
+
+// 对两个 128 位通道分别做 4x4 转置
+MICRO3D_TARGET_AVX2
+inline void transpose4_avx2(__m256* r0, __m256* r1, __m256* r2, __m256* r3)
+{
+    __m256 t0 = _mm256_unpacklo_ps(*r0, *r1);
+    __m256 t1 = _mm256_unpackhi_ps(*r0, *r1);
+    __m256 t2 = _mm256_unpacklo_ps(*r2, *r3);
+    __m256 t3 = _mm256_unpackhi_ps(*r2, *r3);
+    *r0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+    *r1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+    *r2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+    *r3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+}
+
+MICRO3D_TARGET_AVX2
+inline __m256i outcode_bit_avx2(__m256 mask, int bit)
+{
+    return _mm256_and_si256(_mm256_castps_si256(mask), _mm256_set1_epi32(bit));
+}
+
+// AVX2 路径：每次处理 8 个顶点，顶点 j 和 j + 4 放在同一行的低、高 128 位通道，
+// 转置后每个寄存器按顺序保存 8 个顶点的同一分量
+MICRO3D_TARGET_AVX2
+inline void process_vertices_avx2(vec4_t* clip, vec4_t* screen, int* outcodes,
+                                  const vec4_t* in, int count, const matrix_t* m, const device_t* device)
+{
+    guard_band_t gb = guard_band(device);
+    __m256 mc[4][4];
+    for (int r = 0; r < 4; r++) {
+        for (int c = 0; c < 4; c++) {
+            mc[r][c] = _mm256_set1_ps(m->m[r][c]);
+        }
+    }
+    __m256 sign = _mm256_set1_ps(-0.0f);
+    __m256 gx = _mm256_set1_ps(gb.gx), ngx = _mm256_set1_ps(-gb.gx);
+    __m256 gy = _mm256_set1_ps(gb.gy), ngy = _mm256_set1_ps(-gb.gy);
+    __m256 zero = _mm256_setzero_ps();
+    __m256 one = _mm256_set1_ps(1.0f);
+    __m256 hw = _mm256_set1_ps(0.5f * (float)device->width);
+    __m256 hh = _mm256_set1_ps(0.5f * (float)device->height);
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256 v[4];
+        for (int j = 0; j < 4; j++) {
+            v[j] = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(&in[i + j].x)), _mm_loadu_ps(&in[i + j + 4].x), 1);
+        }
+        transpose4_avx2(&v[0], &v[1], &v[2], &v[3]);
+
+        __m256 c[4];
+        for (int j = 0; j < 4; j++) {
+            c[j] = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(v[0], mc[0][j]), _mm256_mul_ps(v[1], mc[1][j])),
+                                               _mm256_mul_ps(v[2], mc[2][j])), _mm256_mul_ps(v[3], mc[3][j]));
+        }
+
+        __m256 nw = _mm256_xor_ps(c[3], sign);
+        __m256i code = outcode_bit_avx2(_mm256_cmp_ps(c[0], nw, _CMP_LT_OQ), CLIP_LEFT);
+        code = _mm256_or_si256(code, outcode_bit_avx2(_mm256_cmp_ps(c[0], c[3], _CMP_GT_OQ), CLIP_RIGHT));
+        code = _mm256_or_si256(code, outcode_bit_avx2(_mm256_cmp_ps(c[1], nw, _CMP_LT_OQ), CLIP_BOTTOM));
+        code = _mm256_or_si256(code, outcode_bit_avx2(_mm256_cmp_ps(c[1], c[3], _CMP_GT_OQ), CLIP_TOP));
+        code = _mm256_or_si256(code, outcode_bit_avx2(_mm256_cmp_ps(c[2], zero, _CMP_LT_OQ), CLIP_NEAR));
+        code = _mm256_or_si256(code, outcode_bit_avx2(_mm256_cmp_ps(c[2], c[3], _CMP_GT_OQ), CLIP_FAR));
+        code = _mm256_or_si256(code, outcode_bit_avx2(_mm256_cmp_ps(c[0], _mm256_mul_ps(ngx, c[3]), _CMP_LT_OQ), CLIP_GUARD_LEFT));
+        code = _mm256_or_si256(code, outcode_bit_avx2(_mm256_cmp_ps(c[0], _mm256_mul_ps(gx, c[3]), _CMP_GT_OQ), CLIP_GUARD_RIGHT));
+        code = _mm256_or_si256(code, outcode_bit_avx2(_mm256_cmp_ps(c[1], _mm256_mul_ps(ngy, c[3]), _CMP_LT_OQ), CLIP_GUARD_BOTTOM));
+        code = _mm256_or_si256(code, outcode_bit_avx2(_mm256_cmp_ps(c[1], _mm256_mul_ps(gy, c[3]), _CMP_GT_OQ), CLIP_GUARD_TOP));
+        _mm256_storeu_si256((__m256i*)&outcodes[i], code);
+
+        __m256 rw = _mm256_div_ps(one, c[3]);
+        __m256 s[4];
+        s[0] = _mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(c[0], rw), one), hw);
+        s[1] = _mm256_mul_ps(_mm256_sub_ps(one, _mm256_mul_ps(c[1], rw)), hh);
+        s[2] = _mm256_mul_ps(c[2], rw);
+        s[3] = c[3];
+        transpose4_avx2(&s[0], &s[1], &s[2], &s[3]);
+        transpose4_avx2(&c[0], &c[1], &c[2], &c[3]);
+        for (int j = 0; j < 4; j++) {
+            _mm_storeu_ps(&screen[i + j].x, _mm256_castps256_ps128(s[j]));
+            _mm_storeu_ps(&screen[i + j + 4].x, _mm256_extractf128_ps(s[j], 1));
+            _mm_storeu_ps(&clip[i + j].x, _mm256_castps256_ps128(c[j]));
+            _mm_storeu_ps(&clip[i + j + 4].x, _mm256_extractf128_ps(c[j], 1));
+        }
+    }
+    process_vertices_sse2(clip + i, screen + i, outcodes + i, in + i, count - i, m, device);
+}
+#endif
+
+inline void process_vertices(vec4_t* clip, vec4_t* screen, int* outcodes,
+                             const vec4_t* in, int count, const matrix_t* m, const device_t* device)
+{
+#ifdef MICRO3D_SSE2
+    if (cpu_has_avx2()) {
+        process_vertices_avx2(clip, screen, outcodes, in, count, m, device);
+    } else {
+        process_vertices_sse2(clip, screen, outcodes, in, count, m, device);
+    }
+#else
+    process_vertices_scalar(clip, screen, outcodes, in, count, m, device);
+#endif
+}
+
+// 变换后顶点缓存：按顶点下标直接映射，相邻三角形共享的顶点只变换一次
+static const int VERTEX_CACHE_SIZE = 64;
+
+typedef struct {
+    unsigned int tags[VERTEX_CACHE_SIZE];
+    vec4_t vertices[VERTEX_CACHE_SIZE];
+} vertex_cache_t;
+
+inline void vertex_cache_init(vertex_cache_t* cache)
+{
+    for (int i = 0; i < VERTEX_CACHE_SIZE; i++) {
+        cache->tags[i] = 0xFFFFFFFFu;
+    }
+}
+
+inline const vec4_t* vertex_cache_fetch(vertex_cache_t* cache, const vec4_t* vertices, unsigned int index, const matrix_t* m)
+{
+    int slot = (int)(index & (VERTEX_CACHE_SIZE - 1));
+    if (cache->tags[slot] != index) {
+        cache->tags[slot] = index;
+        vector_transform(&cache->vertices[slot], &vertices[index], m);
+    }
+    return &cache->vertices[slot];
+}
+
+// 所有顶点都在同一个视锥平面外，或整个网格被已绘制的几何体遮挡时返回 true（screen、outcodes 为 process_vertices 的结果）
+inline bool mesh_culled(device_t* device, const vec4_t* screen, const int* outcodes, int count)
+{
+    int codes_and = ~0, codes_or = 0;
+    float min_x = 0, max_x = 0, min_y = 0, max_y = 0, min_z = 0;
+    for (int i = 0; i < count; i++) {
+        codes_and &= outcodes[i];
+        codes_or |= outcodes[i];
+        const vec4_t* v = &screen[i];
+        if (i == 0) {
+            min_x = max_x = v->x;
+            min_y = max_y = v->y;
+            min_z = v->z;
+        } else {
+            min_x = fminf(min_x, v->x);
+            max_x = fmaxf(max_x, v->x);
+            min_y = fminf(min_y, v->y);
+            max_y = fmaxf(max_y, v->y);
+            min_z = fminf(min_z, v->z);
+        }
+    }
+    // 裁剪测试时整个网格在 scissor 外也剔除（留出一个像素的余量，不依赖像素中心和采样位置）
+    const rect_t* s = &device->scissor;
+    bool scissored = device->scissor_test && !(codes_or & CLIP_NEAR) &&
+                     (max_x < (float)s->x0 - 1.0f || min_x > (float)s->x1 + 1.0f || max_y < (float)s->y0 - 1.0f || min_y > (float)s->y1 + 1.0f);
+    if ((codes_and & CLIP_FRUSTUM) || scissored ||
+        (device->hiz && !(codes_or & CLIP_NEAR) && hiz_occluded_bounds(device, min_x, min_y, max_x, max_y, min_z))) {
+        MICRO3D_STATS_ADD(device, meshes_culled, 1);
+        return true;
+    }
+    return false;
+}
+
+// 绘制索引三角形网格：顶点和下标缓冲由调用者持有，每 3 个下标组成一个三角形，
+// colors 为每个三角形的颜色（为空时都使用 clr）。下标越界的三角形被跳过。
+// 大部分顶点都会被引用时（index_count >= vertex_count），先用 process_vertices 一次性处理全部顶点，
+// 再按外码剔除或裁剪三角形；
+// 只引用大顶点缓冲中的一小部分时，经变换后顶点缓存按需变换。wvp 为已经计算好的 world * view * projection
+inline void draw_indexed_wvp(device_t* device, const matrix_t* wvp,
+                             const vec4_t* vertices, int vertex_count,
+                             const unsigned int* indices, int index_count,
+                             const unsigned int* colors, unsigned int clr)
+{
+    if (vertex_count <= 0 || index_count < 3) {
+        return;
+    }
+    unsigned int count = (unsigned int)vertex_count;
+    int triangle_count = index_count / 3;
+    if (index_count >= vertex_count) {
+        static thread_local std::vector<vec4_t> clip;
+        static thread_local std::vector<vec4_t> screen;
+        static thread_local std::vector<int> outcodes;
+        clip.resize(vertex_count);
+        screen.resize(vertex_count);
+        outcodes.resize(vertex_count);
+        {
+            MICRO3D_STATS_SCOPE(device, STATS_TRANSFORM);
+            process_vertices(clip.data(), screen.data(), outcodes.data(), vertices, vertex_count, wvp, device);
+        }
+
+        if (mesh_culled(device, screen.data(), outcodes.data(), vertex_count)) {
+            return;
+        }
+
+        for (int i = 0; i < triangle_count; i++) {
+            const unsigned int* tri = &indices[i * 3];
+            if (tri[0] >= count || tri[1] >= count || tri[2] >= count) {
+                continue;
+            }
+            int c1 = outcodes[tri[0]], c2 = outcodes[tri[1]], c3 = outcodes[tri[2]];
+            if (c1 & c2 & c3 & CLIP_FRUSTUM) {
+                MICRO3D_STATS_ADD(device, triangles_submitted, 1);
+                MICRO3D_STATS_ADD(device, triangles_culled_frustum, 1);
+                continue;
+            }
+            unsigned int tri_clr = colors ? colors[i] : clr;
+            if (((c1 | c2 | c3) & (CLIP_DEPTH | CLIP_GUARD)) == 0) {
+                // 不需要裁剪：直接使用批量计算好的屏幕坐标（需要裁剪的由 draw_triangle 计数）
+                MICRO3D_STATS_ADD(device, triangles_submitted, 1);
+                vec4_t s1 = screen[tri[0]], s2 = screen[tri[1]], s3 = screen[tri[2]];
+                if (triangle_culled(device, (float)triangle_snapped_area(&s1, &s2, &s3))) {
+                    continue;
+                }
+                triangle(device, &s1, &s2, &s3, tri_clr);
+            } else {
+                draw_triangle(device, &clip[tri[0]], &clip[tri[1]], &clip[tri[2]], tri_clr);
+            }
+        }
+    } else {
+        vertex_cache_t cache;
+        vertex_cache_init(&cache);
+        for (int i = 0; i < triangle_count; i++) {
+            const unsigned int* tri = &indices[i * 3];
+            if (tri[0] >= count || tri[1] >= count || tri[2] >= count) {
+                continue;
+            }
+            // 三个顶点可能落在同一个缓存槽，先复制出来
+            vec4_t v1 = *vertex_cache_fetch(&cache, vertices, tri[0], wvp);
+            vec4_t v2 = *vertex_cache_fetch(&cache, vertices, tri[1], wvp);
+            vec4_t v3 = *vertex_cache_fetch(&cache, vertices, tri[2], wvp);
+            draw_triangle(device, &v1, &v2, &v3, colors ? colors[i] : clr);
+        }
+    }
+}
+
+// 由 transform 计算 world * view * projection 后调用 draw_indexed_wvp
+inline void draw_indexed(device_t* device, const transform_t* transform,
+                         const vec4_t* vertices, int vertex_count,
+                         const unsigned int* indices, int index_count,
+                         const unsigned int* colors, unsigned int clr)
+{
+    MICRO3D_STATS_SCOPE(device, STATS_DRAW_INDEXED);
+    matrix_t wvp;
+    transform_wvp(&wvp, transform);
+    draw_indexed_wvp(device, &wvp, vertices, vertex_count, indices, index_count, colors, clr);
+}
+
+// 网格的轴对齐包围盒的 8 个角点
+inline void mesh_bounds(vec4_t* corners, const vec4_t* vertices, int count)
+{
+    vec4_t lo = vertices[0], hi = vertices[0];
+    for (int i = 1; i < count; i++) {
+        lo.x = fminf(lo.x, vertices[i].x);
+        lo.y = fminf(lo.y, vertices[i].y);
+        lo.z = fminf(lo.z, vertices[i].z);
+        hi.x = fmaxf(hi.x, vertices[i].x);
+        hi.y = fmaxf(hi.y, vertices[i].y);
+        hi.z = fmaxf(hi.z, vertices[i].z);
+    }
+    for (int i = 0; i < 8; i++) {
+        corners[i].x = (i & 1) ? hi.x : lo.x;
+        corners[i].y = (i & 2) ? hi.y : lo.y;
+        corners[i].z = (i & 4) ? hi.z : lo.z;
+        corners[i].w = 1.0f;
+    }
+}
+
+// 实例化绘制：同一个索引网格按 worlds 中的 instance_count 个世界矩阵各绘制一次。
+// view * projection 只计算一次，每个实例只做一次矩阵乘法，顶点仍由 process_vertices 按 SIMD 批量变换；
+// 顶点多于 8 个时先变换包围盒的 8 个角点，整个实例在视锥外或被 Hi-Z 遮挡时不再变换网格顶点。
+// instance_colors 非空时实例 i 的所有三角形使用 instance_colors[i]，否则与 draw_indexed 相同使用 colors 或 clr
+inline void draw_indexed_instanced(device_t* device, const matrix_t* view, const matrix_t* projection,
+                                   const matrix_t* worlds, int instance_count,
+                                   const vec4_t* vertices, int vertex_count,
+                                   const unsigned int* indices, int index_count,
+                                   const unsigned int* colors, unsigned int clr, const unsigned int* instance_colors)
+{
+    MICRO3D_STATS_SCOPE(device, STATS_DRAW_INDEXED);
+    if (vertex_count <= 0) {
+        return;
+    }
+    matrix_t view_projection;
+    matrix_multiply(&view_projection, view, projection);
+
+    bool bounds = vertex_count > 8;
+    vec4_t corners[8], clip[8], screen[8];
+    int outcodes[8];
+    if (bounds) {
+        mesh_bounds(corners, vertices, vertex_count);
+    }
+    for (int i = 0; i < instance_count; i++) {
+        matrix_t wvp;
+        matrix_multiply(&wvp, &worlds[i], &view_projection);
+        if (bounds) {
+            {
+                MICRO3D_STATS_SCOPE(device, STATS_TRANSFORM);
+                process_vertices(clip, screen, outcodes, corners, 8, &wvp, device);
+            }
+            if (mesh_culled(device, screen, outcodes, 8)) {
+                continue;
+            }
+        }
+        if (instance_colors) {
+            draw_indexed_wvp(device, &wvp, vertices, vertex_count, indices, index_count, nullptr, instance_colors[i]);
+        } else {
+            draw_indexed_wvp(device, &wvp, vertices, vertex_count, indices, index_count, colors, clr);
+        }
+    }
+}
+
+// 从三角形下标中提取不重复的边，每条边 2 个下标（小的在前），按下标排序。
+// 相邻三角形共享的边只保留一条；网格不变时提取一次即可每帧复用
+inline void mesh_edges(std::vector<unsigned int>* edges, const unsigned int* indices, int index_count)
+{
+    std::vector<unsigned long long> keys;
+    keys.reserve(index_count);
+    for (int i = 0; i + 2 < index_count; i += 3) {
+        for (int k = 0; k < 3; k++) {
+            unsigned int a = indices[i + k];
+            unsigned int b = indices[i + (k + 1) % 3];
+            if (a == b) {
+                continue;
+            }
+            if (a > b) {
+                std::swap(a, b);
+            }
+            keys.push_back((unsigned long long)a << 32 | b);
+        }
+    }
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    edges->resize(keys.size() * 2);
+    for (size_t i = 0; i < keys.size(); i++) {
+        (*edges)[i * 2] = (unsigned int)(keys[i] >> 32);
+        (*edges)[i * 2 + 1] = (unsigned int)keys[i];
+    }
+}
+
+// 绘制索引线段：每 2 个下标组成一条线段，colors 为每条线段的颜色（为空时都使用 clr），下标越界的线段被跳过。
+// 顶点先由 process_vertices 一次性处理，两端在同一视锥平面外的线段直接剔除，
+// 不需要近远平面和保护带裁剪的线段直接使用批量计算好的屏幕坐标。线段不做深度测试
+inline void draw_lines_indexed(device_t* device, const transform_t* transform,
+                               const vec4_t* vertices, int vertex_count,
+                               const unsigned int* edges, int edge_index_count,
+                               const unsigned int* colors, unsigned int clr)
+{
+    if (vertex_count <= 0 || edge_index_count < 2) {
+        return;
+    }
+    binner_flush(device);
+    MICRO3D_STATS_SCOPE(device, STATS_LINE);
+    matrix_t wvp;
+    transform_wvp(&wvp, transform);
+
+    static thread_local std::vector<vec4_t> clip;
+    static thread_local std::vector<vec4_t> screen;
+    static thread_local std::vector<int> outcodes;
+    clip.resize(vertex_count);
+    screen.resize(vertex_count);
+    outcodes.resize(vertex_count);
+    {
+        MICRO3D_STATS_SCOPE(device, STATS_TRANSFORM);
+        process_vertices(clip.data(), screen.data(), outcodes.data(), vertices, vertex_count, &wvp, device);
+    }
+
+    unsigned int count = (unsigned int)vertex_count;
+    int line_count = edge_index_count / 2;
+    for (int i = 0; i < line_count; i++) {
+        unsigned int i1 = edges[i * 2], i2 = edges[i * 2 + 1];
+        if (i1 >= count || i2 >= count) {
+            continue;
+        }
+        int c1 = outcodes[i1], c2 = outcodes[i2];
+        if (c1 & c2 & CLIP_FRUSTUM) {
+            continue;
+        }
+        MICRO3D_STATS_ADD(device, lines, 1);
+        unsigned int c = colors ? colors[i] : clr;
+        if (((c1 | c2) & (CLIP_DEPTH | CLIP_GUARD)) == 0) {
+            line_screen(device, screen[i1].x, screen[i1].y, screen[i2].x, screen[i2].y, c);
+        } else {
+            line_clip_space(device, &clip[i1], &clip[i2], c);
+        }
+    }
+}
+
+// 索引三角形网格的线框：相邻三角形共享的边只画一次。每次调用都要提取边，
+// 网格不变时可以先用 mesh_edges 提取一次，再直接调用 draw_lines_indexed
+inline void draw_indexed_wireframe(device_t* device, const transform_t* transform,
+                                   const vec4_t* vertices, int vertex_count,
+                                   const unsigned int* indices, int index_count, unsigned int clr)
+{
+    static thread_local std::vector<unsigned int> edges;
+    mesh_edges(&edges, indices, index_count);
+    draw_lines_indexed(device, transform, vertices, vertex_count, edges.data(), (int)edges.size(), nullptr, clr);
+}
+
+// 绘制带顶点属性的索引网格：varyings 为每个顶点 Shader::VARYINGS 个 float，依次排列；
+// 每 3 个下标组成一个三角形，下标越界的三角形被跳过。顶点先由 process_vertices 一次性处理，
+// 剔除、裁剪与 draw_indexed 相同
+template <typename Shader>
+inline void draw_indexed_shaded(device_t* device, const transform_t* transform,
+                                const vec4_t* vertices, const float* varyings, int vertex_count,
+                                const unsigned int* indices, int index_count, const Shader& shader)
+{
+    MICRO3D_STATS_SCOPE(device, STATS_DRAW_INDEXED);
+    if (vertex_count <= 0 || index_count < 3) {
+        return;
+    }
+    enum { N = Shader::VARYINGS };
+    matrix_t wvp;
+    transform_wvp(&wvp, transform);
+
+    static thread_local std::vector<vec4_t> clip;
+    static thread_local std::vector<vec4_t> screen;
+    static thread_local std::vector<int> outcodes;
+    clip.resize(vertex_count);
+    screen.resize(vertex_count);
+    outcodes.resize(vertex_count);
+    {
+        MICRO3D_STATS_SCOPE(device, STATS_TRANSFORM);
+        process_vertices(clip.data(), screen.data(), outcodes.data(), vertices, vertex_count, &wvp, device);
+    }
+    if (mesh_culled(device, screen.data(), outcodes.data(), vertex_count)) {
+        return;
+    }
+
+    unsigned int count = (unsigned int)vertex_count;
+    int triangle_count = index_count / 3;
+    for (int i = 0; i < triangle_count; i++) {
+        const unsigned int* tri = &indices[i * 3];
+        if (tri[0] >= count || tri[1] >= count || tri[2] >= count) {
+            continue;
+        }
+        const float* a1 = varyings + (size_t)tri[0] * N;
+        const float* a2 = varyings + (size_t)tri[1] * N;
+        const float* a3 = varyings + (size_t)tri[2] * N;
+        int c1 = outcodes[tri[0]], c2 = outcodes[tri[1]], c3 = outcodes[tri[2]];
+        if (c1 & c2 & c3 & CLIP_FRUSTUM) {
+            MICRO3D_STATS_ADD(device, triangles_submitted, 1);
+            MICRO3D_STATS_ADD(device, triangles_culled_frustum, 1);
+            continue;
+        }
+        if (((c1 | c2 | c3) & (CLIP_DEPTH | CLIP_GUARD)) == 0) {
+            MICRO3D_STATS_ADD(device, triangles_submitted, 1);
+            const vec4_t* s1 = &screen[tri[0]];
+            const vec4_t* s2 = &screen[tri[1]];
+            const vec4_t* s3 = &screen[tri[2]];
+            if (triangle_culled(device, (float)triangle_snapped_area(s1, s2, s3))) {
+                continue;
+            }
+            triangle_shaded(device, s1, s2, s3, a1, a2, a3, shader);
+        } else {
+            draw_triangle_shaded(device, &clip[tri[0]], &clip[tri[1]], &clip[tri[2]], a1, a2, a3, shader);
+        }
+    }
+}
+
+inline void draw_indexed_shaded(device_t* device, const transform_t* transform,
+                                const vec4_t* vertices, const float*, int vertex_count,
+                                const unsigned int* indices, int index_count, const shader_flat_t& shader)
+{
+    draw_indexed(device, transform, vertices, vertex_count, indices, index_count, nullptr, shader.clr);
+}
+
+// 长方体的8个顶点（局部坐标）
+static const vec4_t CUBE_VERTICES[8] = {
+    // 前面四个顶点
+    { -0.5f, -0.5f,  0.5f, 1.0f }, // 左下前 0
+    {  0.5f, -0.5f,  0.5f, 1.0f }, // 右下前 1
+    {  0.5f,  0.5f,  0.5f, 1.0f }, // 右上前 2
+    { -0.5f,  0.5f,  0.5f, 1.0f }, // 左上前 3
+
+    // 后面四个顶点
+    { -0.5f, -0.5f, -0.5f, 1.0f }, // 左下后 4
+    {  0.5f, -0.5f, -0.5f, 1.0f }, // 右下后 5
+    {  0.5f,  0.5f, -0.5f, 1.0f }, // 右上后 6
+    { -0.5f,  0.5f, -0.5f, 1.0f }  // 左上后 7
+};
+
+// 定义6个面的12个三角形（三角形顶点索引）
+static const unsigned int CUBE_INDICES[36] = {
+    0, 1, 2,  0, 2, 3, // 前面
+    5, 4, 7,  5, 7, 6, // 后面
+    3, 2, 6,  3, 6, 7, // 上面
+    1, 0, 4,  1, 4, 5, // 下面
+    4, 0, 3,  4, 3, 7, // 左面
+    1, 5, 6,  1, 6, 2  // 右面
+};
+
+// 贴图长方体：每个面 4 个独立的顶点（取自 CUBE_VERTICES，各面与 CUBE_INDICES 的顺序和绕序相同），
+// 纹理坐标在每个面上覆盖整张纹理
+static const vec4_t CUBE_FACE_VERTICES[24] = {
+    CUBE_VERTICES[0], CUBE_VERTICES[1], CUBE_VERTICES[2], CUBE_VERTICES[3], // 前面
+    CUBE_VERTICES[5], CUBE_VERTICES[4], CUBE_VERTICES[7], CUBE_VERTICES[6], // 后面
+    CUBE_VERTICES[3], CUBE_VERTICES[2], CUBE_VERTICES[6], CUBE_VERTICES[7], // 上面
+    CUBE_VERTICES[1], CUBE_VERTICES[0], CUBE_VERTICES[4], CUBE_VERTICES[5], // 下面
+    CUBE_VERTICES[4], CUBE_VERTICES[0], CUBE_VERTICES[3], CUBE_VERTICES[7], // 左面
+    CUBE_VERTICES[1], CUBE_VERTICES[5], CUBE_VERTICES[6], CUBE_VERTICES[2]  // 右面
+};
+
+static const float CUBE_FACE_UVS[24 * 2] = {
+    0, 1,  1, 1,  1, 0,  0, 0,
+    0, 1,  1, 1,  1, 0,  0, 0,
+    0, 1,  1, 1,  1, 0,  0, 0,
+    0, 1,  1, 1,  1, 0,  0, 0,
+    0, 1,  1, 1,  1, 0,  0, 0,
+    0, 1,  1, 1,  1, 0,  0, 0
+};
+
+static const unsigned int CUBE_FACE_INDICES[36] = {
+     0,  1,  2,   0,  2,  3,
+     4,  5,  6,   4,  6,  7,
+     8,  9, 10,   8, 10, 11,
+    12, 13, 14,  12, 14, 15,
+    16, 17, 18,  16, 18, 19,
+    20, 21, 22,  20, 22, 23
+};
+
+// 每个三角形的颜色（ARGB格式，不透明），每个面两个三角形
+static const unsigned int CUBE_COLORS[12] = {
+    0xFFFF0000, 0xFFFF0000, // 前面 - 红色
+    0xFF00FF00, 0xFF00FF00, // 后面 - 绿色
+    0xFF0000FF, 0xFF0000FF, // 上面 - 蓝色
+    0xFFFFFF00, 0xFFFFFF00, // 下面 - 黄色
+    0xFFFF00FF, 0xFFFF00FF, // 左面 - 紫色
+    0xFF00FFFF, 0xFF00FFFF  // 右面 - 青色
+};
+
+// 长方体线框的 12 条边（CUBE_VERTICES 的下标）：z = -0.5 和 z = 0.5 的两个面各四条，再连接两个面的四条
+static const unsigned int CUBE_EDGES[24] = {
+    4, 5,  5, 6,  6, 7,  7, 4, // z = -0.5 的面
+    0, 1,  1, 2,  2, 3,  3, 0, // z = 0.5 的面
+    4, 0,  5, 1,  6, 2,  7, 3  // 连接两个面
+};
+
+// 每条边的颜色（ARGB格式，不透明）
+static const unsigned int CUBE_EDGE_COLORS[12] = {
+    0xFFFF0000, 0xFFFF0000, 0xFFFF0000, 0xFFFF0000, // 红色
+    0xFF00FF00, 0xFF00FF00, 0xFF00FF00, 0xFF00FF00, // 绿色
+    0xFFFF00FF, 0xFF00FFFF, 0xFF0000FF, 0xFFFFFF00  // 紫色、青色、蓝色、黄色
+};
+
+// 绘制长方体
+inline void draw_cube(device_t* device, const transform_t* transform)
 {
-    matrix_identity(m);
-    float cosA = cosf(angle);
-    float sinA = sinf(angle);
-    m->m[1][1] = cosA;
-    m->m[1][2] = sinA;
-    m->m[2][1] = -sinA;
-    m->m[2][2] = cosA;
+    MICRO3D_STATS_SCOPE(device, STATS_DRAW_CUBE);
+    draw_indexed(device, transform, CUBE_VERTICES, 8, CUBE_INDICES, 36, CUBE_COLORS, 0);
 }
 
-// 创建旋转矩阵（绕Y轴）
-inline void matrix_rotation_y(matrix_t* m, float angle)
+// 实例化绘制 count 个长方体；instance_colors 为空时与 draw_cube 相同每个面一种颜色，否则每个长方体一种颜色
+inline void draw_cubes(device_t* device, const matrix_t* view, const matrix_t* projection,
+                       const matrix_t* worlds, int count, const unsigned int* instance_colors)
 {
-    matrix_identity(m);
-    float cosA = cosf(angle);
-    float sinA = sinf(angle);
-    m->m[0][0] = cosA;
-    m->m[0][2] = -sinA;
-    m->m[2][0] = sinA;
-    m->m[2][2] = cosA;
+    MICRO3D_STATS_SCOPE(device, STATS_DRAW_CUBE);
+    draw_indexed_instanced(device, view, projection, worlds, count, CUBE_VERTICES, 8, CUBE_INDICES, 36,
+                           CUBE_COLORS, 0, instance_colors);
 }
 
-// 创建缩放矩阵
-inline void matrix_scaling(matrix_t* m, float sx, float sy, float sz)
+// 绘制半透明的长方体（需要设置 blend_mode）：各面颜色与 draw_cube 相同，alpha 为 0x80。
+// 先画背面再画正面，凸物体上每个像素的两层由远到近合成，不需要逐三角形排序
+inline void draw_cube_translucent(device_t* device, const transform_t* transform)
 {
-    matrix_identity(m);
-    m->m[0][0] = sx;
-    m->m[1][1] = sy;
-    m->m[2][2] = sz;
+    MICRO3D_STATS_SCOPE(device, STATS_DRAW_CUBE);
+    unsigned int colors[12];
+    for (int i = 0; i < 12; i++) {
+        colors[i] = (CUBE_COLORS[i] & 0x00FFFFFFu) | 0x80000000u;
+    }
+    // 正面在屏幕上为逆时针
+    cull_mode_t saved = device->cull_mode;
+    device->cull_mode = CULL_CCW;
+    draw_indexed(device, transform, CUBE_VERTICES, 8, CUBE_INDICES, 36, colors, 0);
+    device->cull_mode = CULL_CW;
+    draw_indexed(device, transform, CUBE_VERTICES, 8, CUBE_INDICES, 36, colors, 0);
+    device->cull_mode = saved;
 }
 
-// 绘制长方体
-inline void draw_cube(device_t* device, const transform_t* transform)
+// 绘制 Gouraud 着色的长方体：每个顶点的颜色由它的位置决定（RGB 立方体），面内逐像素插值
+inline void draw_cube_gouraud(device_t* device, const transform_t* transform)
 {
-    // 长方体的8个顶点（局部坐标）
-    vec4_t vertices[8] = {
-        // 前面四个顶点
-        { -0.5f, -0.5f,  0.5f, 1.0f }, // 左下前 0
-        {  0.5f, -0.5f,  0.5f, 1.0f }, // 右下前 1
-        {  0.5f,  0.5f,  0.5f, 1.0f }, // 右上前 2
-        { -0.5f,  0.5f,  0.5f, 1.0f }, // 左上前 3
-        
-        // 后面四个顶点
-        { -0.5f, -0.5f, -0.5f, 1.0f }, // 左下后 4
-        {  0.5f, -0.5f, -0.5f, 1.0f }, // 右下后 5
-        {  0.5f,  0.5f, -0.5f, 1.0f }, // 右上后 6
-        { -0.5f,  0.5f, -0.5f, 1.0f }  // 左上后 7
+    MICRO3D_STATS_SCOPE(device, STATS_DRAW_CUBE);
+    static const float colors[8 * 3] = {
+        0, 0, 1,  1, 0, 1,  1, 1, 1,  0, 1, 1,
+        0, 0, 0,  1, 0, 0,  1, 1, 0,  0, 1, 0
     };
+    shader_gouraud_t shader;
+    draw_indexed_shaded(device, transform, CUBE_VERTICES, colors, 8, CUBE_INDICES, 36, shader);
+}
 
-    // 定义6个面的12个三角形，每个面指定颜色
-    struct Face {
-        int indices[3];  // 三角形顶点索引
-        unsigned int color; // 面的颜色
-    };
-    
-    // 六个面的颜色（RGB格式）
-    unsigned int colors[6] = {
-        0xFF0000, // 前面 - 红色
-        0x00FF00, // 后面 - 绿色  
-        0x0000FF, // 上面 - 蓝色
-        0xFFFF00, // 下面 - 黄色
-        0xFF00FF, // 左面 - 紫色
-        0x00FFFF  // 右面 - 青色
-    };
-    
-    Face faces[12] = {
-        // 前面 (红色)
-        {{0, 1, 2}, colors[0]},
-        {{0, 2, 3}, colors[0]},
-        
-        // 后面 (绿色)
-        {{5, 4, 7}, colors[1]},
-        {{5, 7, 6}, colors[1]},
-        
-        // 上面 (蓝色)
-        {{3, 2, 6}, colors[2]},
-        {{3, 6, 7}, colors[2]},
-        
-        // 下面 (黄色)
-        {{1, 0, 4}, colors[3]},
-        {{1, 4, 5}, colors[3]},
-        
-        // 左面 (紫色)
-        {{4, 0, 3}, colors[4]},
-        {{4, 3, 7}, colors[4]},
-        
-        // 右面 (青色)
-        {{1, 5, 6}, colors[5]},
-        {{1, 6, 2}, colors[5]}
-    };
+// 绘制贴图的长方体：纹理由调用者创建和释放（如 texture_create_checker），三线性滤波
+inline void draw_cube_textured(device_t* device, const transform_t* transform, const texture_t* texture)
+{
+    MICRO3D_STATS_SCOPE(device, STATS_DRAW_CUBE);
+    shader_texture_t shader;
+    shader.texture = texture;
+    shader.filter = TEXTURE_TRILINEAR;
+    draw_indexed_shaded(device, transform, CUBE_FACE_VERTICES, CUBE_FACE_UVS, 24, CUBE_FACE_INDICES, 36, shader);
+}
 
-    // 变换后的顶点
-    vec4_t transformed_vertices[8];
-    
-    // 计算世界视图投影矩阵
-    matrix_t world_view;
-    matrix_t wvp; // world * view * projection
-    matrix_multiply(&world_view, &transform->world, &transform->view);
-    matrix_multiply(&wvp, &world_view, &transform->projection);
+// 绘制长方体线框
+inline void draw_cube_wireframe(device_t* device, const transform_t* transform)
+{
+    draw_lines_indexed(device, transform, CUBE_VERTICES, 8, CUBE_EDGES, 24, CUBE_EDGE_COLORS, 0);
+}
 
-    // 变换所有顶点
-    for (int i = 0; i < 8; i++) {
-        vector_transform(&transformed_vertices[i], &vertices[i], &wvp);
-        perspective_divide(&transformed_vertices[i]);
-        viewport_transform(&transformed_vertices[i], device->width, device->height);
+// 线性分配器：从大块内存中按顺序分配，不能单独释放，只能整体重置。
+// 重置不归还内存；一帧用到了多个块时合并为一个足够大的块，之后每帧的分配都落在同一个块内
+struct arena_t {
+    std::vector<std::vector<std::max_align_t> > blocks;
+    size_t used;       // 最后一个块已用的 max_align_t 个数
+    size_t block_size; // 新块的最小大小（max_align_t 个数）
+};
+
+// block_size 为第一个块的字节数，为 0 时为 64 KB
+inline arena_t* arena_create(size_t block_size)
+{
+    arena_t* arena = new arena_t;
+    block_size = block_size != 0 ? block_size : 64u << 10;
+    arena->block_size = (block_size + sizeof(std::max_align_t) - 1) / sizeof(std::max_align_t);
+    arena->blocks.resize(1);
+    arena->blocks[0].resize(arena->block_size);
+    arena->used = 0;
+    return arena;
+}
+
+inline void arena_destroy(arena_t* arena)
+{
+    delete arena;
+}
+
+// 分配 size 字节，按 max_align_t 对齐；返回的指针在 arena_reset 之前一直有效
+inline void* arena_alloc(arena_t* arena, size_t size)
+{
+    size_t n = std::max<size_t>(1, (size + sizeof(std::max_align_t) - 1) / sizeof(std::max_align_t));
+    if (arena->used + n > arena->blocks.back().size()) {
+        arena->blocks.push_back(std::vector<std::max_align_t>(std::max(n, arena->block_size)));
+        arena->used = 0;
     }
+    void* p = &arena->blocks.back()[arena->used];
+    arena->used += n;
+    return p;
+}
 
-    // 绘制所有三角形面，使用各自的颜色
-    for (int i = 0; i < 12; i++) {
-        int idx1 = faces[i].indices[0];
-        int idx2 = faces[i].indices[1];
-        int idx3 = faces[i].indices[2];
-        
-        triangle(device, 
-                 &transformed_vertices[idx1], 
-                 &transformed_vertices[idx2], 
-                 &transformed_vertices[idx3], 
-                 faces[i].color);
+inline void* arena_copy(arena_t* arena, const void* data, size_t size)
+{
+    void* p = arena_alloc(arena, size);
+    memcpy(p, data, size);
+    return p;
+}
+
+inline void arena_reset(arena_t* arena)
+{
+    if (arena->blocks.size() > 1) {
+        size_t total = 0;
+        for (size_t i = 0; i < arena->blocks.size(); i++) {
+            total += arena->blocks[i].size();
+        }
+        arena->blocks.resize(1);
+        arena->blocks[0].resize(total);
     }
+    arena->used = 0;
 }
 
-// 绘制长方体线框
-inline void draw_cube_wireframe(device_t* device, const transform_t* transform)
+// 命令缓冲：先把一帧的清除、状态和绘制记录下来，排序后再执行。
+// 变换、着色器等参数复制到每帧重置的 arena 中，顶点、下标等网格数据只保存指针，由调用者保持到执行结束。
+// 记录时不访问 device_t，执行前的命令缓冲只是普通数据，可以在另一个线程上执行（执行期间不能同时使用同一个 device）
+typedef struct {
+    depth_func_t depth_func;
+    bool depth_readonly;
+    cull_mode_t cull_mode;
+    blend_mode_t blend_mode; // 不为 BLEND_NONE 的状态下的绘制是半透明的，排序时由远到近
+} render_state_t;
+
+typedef enum {
+    COMMAND_CLEAR_COLOR = 0,
+    COMMAND_CLEAR_DEPTH,
+    COMMAND_DRAW
+} command_type_t;
+
+typedef struct {
+    command_type_t type;
+    unsigned int clr;   // COMMAND_CLEAR_COLOR
+    float z;            // COMMAND_CLEAR_DEPTH
+    int state;          // COMMAND_DRAW：command_buffer_t::states 的下标，-1 表示沿用执行前 device 的状态
+    uint64_t key;       // COMMAND_DRAW 的排序键，见 command_draw_raw
+    void (*execute)(device_t*, const void*);
+    const void* data;   // 位于 arena 中，以 transform_t 开头
+} command_t;
+
+struct command_buffer_t {
+    arena_t* arena;
+    std::vector<command_t> commands;
+    std::vector<render_state_t> states;
+};
+
+// arena_size 为 arena 第一个块的字节数，为 0 时使用默认大小
+inline command_buffer_t* command_buffer_create(size_t arena_size)
 {
-    // 长方体的8个顶点（局部坐标）
-    vec4_t vertices[8] = {
-        // 前面四个顶点
-        { -0.5f, -0.5f,  -0.5f, 1.0f }, // 左下前 0
-        {  0.5f, -0.5f,  -0.5f, 1.0f }, // 右下前 1
-        {  0.5f,  0.5f,  -0.5f, 1.0f }, // 右上前 2
-        { -0.5f,  0.5f,  -0.5f, 1.0f }, // 左上前 3
-        
-        // 后面四个顶点
-        { -0.5f, -0.5f, 0.5f, 1.0f }, // 左下后 4
-        {  0.5f, -0.5f, 0.5f, 1.0f }, // 右下后 5
-        {  0.5f,  0.5f, 0.5f, 1.0f }, // 右上后 6
-        { -0.5f,  0.5f, 0.5f, 1.0f }  // 左上后 7
-    };
+    command_buffer_t* cb = new command_buffer_t;
+    cb->arena = arena_create(arena_size);
+    return cb;
+}
 
-    // 定义12条边，每条边连接两个顶点
-    struct Edge {
-        int start, end;      // 边的起点和终点索引
-        unsigned int color;  // 边的颜色
-    };
-    
-    // 六个面的颜色（RGB格式）
-    unsigned int colors[6] = {
-        0xFF0000, // 前面 - 红色
-        0x00FF00, // 后面 - 绿色  
-        0x0000FF, // 上面 - 蓝色
-        0xFFFF00, // 下面 - 黄色
-        0xFF00FF, // 左面 - 紫色
-        0x00FFFF  // 右面 - 青色
-    };
-    
-    Edge edges[12] = {
-        // 前面四条边 (红色)
-        {0, 1, colors[0]}, // 下边
-        {1, 2, colors[0]}, // 右边
-        {2, 3, colors[0]}, // 上边
-        {3, 0, colors[0]}, // 左边
-        
-        // 后面四条边 (绿色)
-        {4, 5, colors[1]}, // 下边
-        {5, 6, colors[1]}, // 右边
-        {6, 7, colors[1]}, // 上边
-        {7, 4, colors[1]}, // 左边
-        
-        // 连接前后面的四条边
-        {0, 4, colors[4]}, // 左下 (紫色)
-        {1, 5, colors[5]}, // 右下 (青色)
-        {2, 6, colors[2]}, // 右上 (蓝色)
-        {3, 7, colors[3]}  // 左上 (黄色)
-    };
+inline void command_buffer_destroy(command_buffer_t* cb)
+{
+    if (!cb) {
+        return;
+    }
+    arena_destroy(cb->arena);
+    delete cb;
+}
+
+// 开始记录新的一帧：丢弃所有命令，内存留给下一帧复用
+inline void command_buffer_reset(command_buffer_t* cb)
+{
+    arena_reset(cb->arena);
+    cb->commands.clear();
+    cb->states.clear();
+}
+
+inline void command_clear_color(command_buffer_t* cb, unsigned int clr)
+{
+    command_t cmd = {};
+    cmd.type = COMMAND_CLEAR_COLOR;
+    cmd.clr = clr;
+    cb->commands.push_back(cmd);
+}
+
+inline void command_clear_depth(command_buffer_t* cb, float z)
+{
+    command_t cmd = {};
+    cmd.type = COMMAND_CLEAR_DEPTH;
+    cmd.z = z;
+    cb->commands.push_back(cmd);
+}
+
+// 之后记录的绘制使用 state；排序不会把不透明的绘制移到另一个状态之前，半透明的绘制见 command_buffer_sort
+inline void command_set_state(command_buffer_t* cb, const render_state_t* state)
+{
+    cb->states.push_back(*state);
+}
 
-    // 变换后的顶点
-    vec4_t transformed_vertices[8];
-    
-    // 计算世界视图投影矩阵
+// 排序用的深度：物体原点在相机空间中沿视线方向的距离，在相机后方时为 0；非负浮点数的位模式与大小顺序一致
+inline uint32_t command_depth_key(const transform_t* transform)
+{
     matrix_t world_view;
-    matrix_t wvp; // world * view * projection
     matrix_multiply(&world_view, &transform->world, &transform->view);
-    matrix_multiply(&wvp, &world_view, &transform->projection);
+    float depth = -world_view.m[3][2];
+    return float_bits(depth > 0.0f ? depth : 0.0f); // 同时处理 NaN
+}
 
-    // 变换所有顶点
-    for (int i = 0; i < 8; i++) {
-        vector_transform(&transformed_vertices[i], &vertices[i], &wvp);
-        perspective_divide(&transformed_vertices[i]);
-        viewport_transform(&transformed_vertices[i], device->width, device->height);
+// 记录一次绘制：data 为 size 字节、以 transform_t 开头的参数，复制到 arena 中，执行时交给 execute
+inline void command_draw_raw(command_buffer_t* cb, const void* data, size_t size, void (*execute)(device_t*, const void*))
+{
+    command_t cmd = {};
+    cmd.type = COMMAND_DRAW;
+    cmd.state = (int)cb->states.size() - 1;
+    // 不透明：最高位为 0，之后是 state + 1 和深度；半透明：最高位为 1，之后是取反的深度（由远到近）和 state + 1。
+    // 沿用执行前 device 状态（state 为 -1）的绘制按不透明处理
+    uint32_t depth = command_depth_key((const transform_t*)data);
+    if (cmd.state >= 0 && cb->states[cmd.state].blend_mode != BLEND_NONE) {
+        cmd.key = ((uint64_t)1 << 63) | ((uint64_t)(uint32_t)~depth << 31) | (uint64_t)(cmd.state + 1);
+    } else {
+        cmd.key = ((uint64_t)(cmd.state + 1) << 32) | depth;
     }
+    cmd.execute = execute;
+    cmd.data = arena_copy(cb->arena, data, size);
+    cb->commands.push_back(cmd);
+}
 
-    // 绘制所有边
-    for (int i = 0; i < 12; i++) {
-        int start_idx = edges[i].start;
-        int end_idx = edges[i].end;
-        
-        line(device, 
-             (int)transformed_vertices[start_idx].x, 
-             (int)transformed_vertices[start_idx].y,
-             (int)transformed_vertices[end_idx].x, 
-             (int)transformed_vertices[end_idx].y,
-             edges[i].color);
+typedef struct {
+    transform_t transform;
+    void (*draw)(device_t*, const transform_t*);
+} draw_command_t;
+
+inline void draw_command_execute(device_t* device, const void* data)
+{
+    const draw_command_t* cmd = (const draw_command_t*)data;
+    cmd->draw(device, &cmd->transform);
+}
+
+// 记录 draw(device, transform)，如 draw_cube、draw_cube_gouraud
+inline void command_draw(command_buffer_t* cb, const transform_t* transform, void (*draw)(device_t*, const transform_t*))
+{
+    draw_command_t cmd = { *transform, draw };
+    command_draw_raw(cb, &cmd, sizeof(cmd), draw_command_execute);
+}
+
+typedef struct {
+    transform_t transform;
+    const vec4_t* vertices;
+    int vertex_count;
+    const unsigned int* indices;
+    int index_count;
+    const unsigned int* colors;
+    unsigned int clr;
+} indexed_command_t;
+
+inline void indexed_command_execute(device_t* device, const void* data)
+{
+    const indexed_command_t* cmd = (const indexed_command_t*)data;
+    draw_indexed(device, &cmd->transform, cmd->vertices, cmd->vertex_count, cmd->indices, cmd->index_count, cmd->colors, cmd->clr);
+}
+
+// 记录 draw_indexed；vertices、indices、colors 不复制
+inline void command_draw_indexed(command_buffer_t* cb, const transform_t* transform,
+                                 const vec4_t* vertices, int vertex_count,
+                                 const unsigned int* indices, int index_count,
+                                 const unsigned int* colors, unsigned int clr)
+{
+    indexed_command_t cmd = { *transform, vertices, vertex_count, indices, index_count, colors, clr };
+    command_draw_raw(cb, &cmd, sizeof(cmd), indexed_command_execute);
+}
+
+template <typename Shader>
+struct indexed_shaded_command_t {
+    transform_t transform;
+    const vec4_t* vertices;
+    const float* varyings;
+    int vertex_count;
+    const unsigned int* indices;
+    int index_count;
+    Shader shader;
+};
+
+template <typename Shader>
+inline void indexed_shaded_command_execute(device_t* device, const void* data)
+{
+    const indexed_shaded_command_t<Shader>* cmd = (const indexed_shaded_command_t<Shader>*)data;
+    draw_indexed_shaded(device, &cmd->transform, cmd->vertices, cmd->varyings, cmd->vertex_count,
+                        cmd->indices, cmd->index_count, cmd->shader);
+}
+
+// 记录 draw_indexed_shaded；着色器按字节复制到 arena 中，网格数据不复制
+template <typename Shader>
+inline void command_draw_indexed_shaded(command_buffer_t* cb, const transform_t* transform,
+                                        const vec4_t* vertices, const float* varyings, int vertex_count,
+                                        const unsigned int* indices, int index_count, const Shader& shader)
+{
+    indexed_shaded_command_t<Shader> cmd = { *transform, vertices, varyings, vertex_count, indices, index_count, shader };
+    command_draw_raw(cb, &cmd, sizeof(cmd), indexed_shaded_command_execute<Shader>);
+}
+
+// 把两次清除之间的每一段绘制按排序键稳定排序：不透明的绘制先按状态（保持 command_set_state 的先后顺序），
+// 同一状态内由近到远，先画的近处物体让后面被遮挡的像素在 early-Z 和 Hi-Z 中被剔除。
+// 深度测试为 DEPTH_LESS 等严格比较时只有深度相等的像素可能与不排序的结果不同。
+// 半透明的绘制（状态的 blend_mode 不为 BLEND_NONE）移到所有不透明的绘制之后，不分状态一起由远到近排列，
+// 混合结果与绘制顺序有关，这样近处的物体合成在远处的物体之上；排序以物体为单位，物体内部的三角形顺序不变
+inline void command_buffer_sort(command_buffer_t* cb)
+{
+    std::vector<command_t>& commands = cb->commands;
+    size_t begin = 0;
+    while (begin < commands.size()) {
+        if (commands[begin].type != COMMAND_DRAW) {
+            begin++;
+            continue;
+        }
+        size_t end = begin;
+        while (end < commands.size() && commands[end].type == COMMAND_DRAW) {
+            end++;
+        }
+        std::stable_sort(commands.begin() + begin, commands.begin() + end,
+                         [](const command_t& a, const command_t& b) { return a.key < b.key; });
+        begin = end;
     }
 }
 
-extern float g_cameraZ;
+// 按顺序执行所有命令；命令缓冲不被修改，可以重复执行。执行结束后恢复 device 的状态，
+// 分块模式下与直接绘制相同，需要再调用 binner_flush
+inline void command_buffer_execute(const command_buffer_t* cb, device_t* device)
+{
+    MICRO3D_STATS_SCOPE(device, STATS_EXECUTE);
+    render_state_t saved = { device->depth_func, device->depth_readonly, device->cull_mode, device->blend_mode };
+    int current = -1;
+    for (size_t i = 0; i < cb->commands.size(); i++) {
+        const command_t* cmd = &cb->commands[i];
+        switch (cmd->type) {
+        case COMMAND_CLEAR_COLOR: {
+            MICRO3D_STATS_SCOPE(device, STATS_CLEAR);
+            clear_color(device, cmd->clr);
+            break;
+        }
+        case COMMAND_CLEAR_DEPTH: {
+            MICRO3D_STATS_SCOPE(device, STATS_CLEAR);
+            clear_depth(device, cmd->z);
+            break;
+        }
+        case COMMAND_DRAW:
+            if (cmd->state != current) {
+                const render_state_t* state = cmd->state >= 0 ? &cb->states[cmd->state] : &saved;
+                device->depth_func = state->depth_func;
+                device->depth_readonly = state->depth_readonly;
+                device->cull_mode = state->cull_mode;
+                device->blend_mode = state->blend_mode;
+                current = cmd->state;
+            }
+            cmd->execute(device, cmd->data);
+            break;
+        }
+    }
+    device->depth_func = saved.depth_func;
+    device->depth_readonly = saved.depth_readonly;
+    device->cull_mode = saved.cull_mode;
+    device->blend_mode = saved.blend_mode;
+}
+
+// 脏矩形：画面大部分不变时只重绘变化的区域。每帧先 dirty_begin，再报告变化：物体移动时用 dirty_add 加入它在
+// 上一帧和这一帧的屏幕包围矩形，影响整个画面的状态（相机、绘制方式等）交给 dirty_state，变化时整帧重绘。
+// dirty_resolve 合并后给出这个 device 需要重绘的矩形：device 的缓冲保留着它上一次绘制时的画面，帧流水线中
+// 多个 device 轮流绘制，所以要重绘的是那之后所有帧变化区域的并集。重绘时对每个矩形设置 scissor，清除后绘制所有物体，
+// 矩形外的像素保持不变。矩形向外对齐到 Hi-Z 块，启用 Hi-Z 时每行仍从块边界起步，矩形内的结果与整帧重绘逐像素相同。
+// 一个 dirty_t 由轮流绘制的所有 device 共用，各帧需要按顺序在一个线程上绘制（frame_pipeline 正是这样）
+static const int DIRTY_ALIGN = HIZ_BLOCK_SIZE;
+static const int DIRTY_HISTORY = 8;    // 保留最近几帧的变化区域，device 落后更多帧时整帧重绘
+static const int DIRTY_MAX_RECTS = 16; // 合并后仍多于这个数时改用它们的包围矩形
+
+typedef struct {
+    const device_t* device;
+    unsigned long long frame;    // 这个 device 最近一次绘制的帧号，0 表示缓冲内容未知
+    std::vector<rect_t> rects;   // 本次需要重绘的区域
+    std::vector<rect_t> changed; // 本次绘制的帧相对上一帧变化的区域，写出或呈现增量画面时使用
+} dirty_buffer_t;
+
+struct dirty_t {
+    int width, height;
+    std::vector<dirty_buffer_t> buffers;
+    unsigned long long frame;                   // 已开始的帧数
+    std::vector<rect_t> history[DIRTY_HISTORY]; // 第 f 帧的变化区域位于 history[f % DIRTY_HISTORY]
+    std::vector<rect_t> changed;                // 当前帧的变化区域
+    std::vector<unsigned char> state;           // 上一帧的 dirty_state
+    int current;                                // 当前帧的 device 在 buffers 中的下标
+    bool invalid;                               // 下一帧整帧重绘
+};
 
-inline void render3d(device_t* device, bool wireframe)
+// devices 为 count 个大小相同、轮流绘制的 device；创建后由调用者把它们的 dirty 指向返回值
+inline dirty_t* dirty_create(device_t* const* devices, int count)
 {
-    // 清空屏幕缓冲，避免模式切换时残留
-    int totalPixels = device->width * device->height;
-    for (int i = 0; i < totalPixels; ++i) {
-        device->buffer[i] = 0x000000; // 黑色背景
+    dirty_t* dirty = new dirty_t;
+    dirty->width = devices[0]->width;
+    dirty->height = devices[0]->height;
+    dirty->buffers.resize(count);
+    for (int i = 0; i < count; i++) {
+        dirty->buffers[i].device = devices[i];
+        dirty->buffers[i].frame = 0;
+    }
+    dirty->frame = 0;
+    dirty->current = 0;
+    dirty->invalid = true;
+    return dirty;
+}
+
+inline void dirty_destroy(dirty_t* dirty)
+{
+    delete dirty;
+}
+
+// 缓冲内容不再可信（例如被外部修改）时调用：之后每个 device 都整帧重绘。需要在绘制线程上或没有帧在绘制时调用
+inline void dirty_invalidate(dirty_t* dirty)
+{
+    dirty->invalid = true;
+    for (size_t i = 0; i < dirty->buffers.size(); i++) {
+        dirty->buffers[i].frame = 0;
+    }
+}
+
+inline const dirty_buffer_t* dirty_buffer(const dirty_t* dirty, const device_t* device)
+{
+    for (size_t i = 0; i < dirty->buffers.size(); i++) {
+        if (dirty->buffers[i].device == device) {
+            return &dirty->buffers[i];
+        }
+    }
+    return nullptr;
+}
+
+inline long long rect_area(const rect_t* r)
+{
+    return (long long)(r->x1 - r->x0 + 1) * (r->y1 - r->y0 + 1);
+}
+
+// 矩形向外对齐到 DIRTY_ALIGN 并限制在屏幕内，再合并相交的矩形，合并后的矩形互不相交。
+// 矩形太多时改用包围矩形，总面积超过屏幕一半时改为整个屏幕：这时逐个矩形重绘不比整帧重绘省多少
+inline void dirty_merge(std::vector<rect_t>* rects, int width, int height)
+{
+    std::vector<rect_t>& r = *rects;
+    size_t count = 0;
+    for (size_t i = 0; i < r.size(); i++) {
+        rect_t a = r[i];
+        a.x0 = std::max(a.x0, 0) & ~(DIRTY_ALIGN - 1);
+        a.y0 = std::max(a.y0, 0) & ~(DIRTY_ALIGN - 1);
+        a.x1 = std::min(a.x1 | (DIRTY_ALIGN - 1), width - 1);
+        a.y1 = std::min(a.y1 | (DIRTY_ALIGN - 1), height - 1);
+        if (a.x0 <= a.x1 && a.y0 <= a.y1) {
+            r[count++] = a;
+        }
+    }
+    r.resize(count);
+
+    // 合并后的矩形可能又与前面的矩形相交，直到没有相交的矩形为止
+    for (bool merged = true; merged; ) {
+        merged = false;
+        for (size_t i = 0; i < r.size(); i++) {
+            for (size_t j = i + 1; j < r.size(); ) {
+                if (r[j].x0 <= r[i].x1 && r[i].x0 <= r[j].x1 && r[j].y0 <= r[i].y1 && r[i].y0 <= r[j].y1) {
+                    r[i].x0 = std::min(r[i].x0, r[j].x0);
+                    r[i].y0 = std::min(r[i].y0, r[j].y0);
+                    r[i].x1 = std::max(r[i].x1, r[j].x1);
+                    r[i].y1 = std::max(r[i].y1, r[j].y1);
+                    r[j] = r.back();
+                    r.pop_back();
+                    merged = true;
+                } else {
+                    j++;
+                }
+            }
+        }
+    }
+
+    long long area = 0;
+    rect_t bounds = { width, height, -1, -1 };
+    for (size_t i = 0; i < r.size(); i++) {
+        area += rect_area(&r[i]);
+        bounds.x0 = std::min(bounds.x0, r[i].x0);
+        bounds.y0 = std::min(bounds.y0, r[i].y0);
+        bounds.x1 = std::max(bounds.x1, r[i].x1);
+        bounds.y1 = std::max(bounds.y1, r[i].y1);
+    }
+    if (area * 2 > (long long)width * height) {
+        rect_t full = { 0, 0, width - 1, height - 1 };
+        r.assign(1, full);
+    } else if (r.size() > (size_t)DIRTY_MAX_RECTS) {
+        r.assign(1, bounds);
+    }
+}
+
+// 开始绘制 device 的一帧
+inline void dirty_begin(device_t* device)
+{
+    dirty_t* dirty = device->dirty;
+    dirty->frame++;
+    dirty->changed.clear();
+    for (size_t i = 0; i < dirty->buffers.size(); i++) {
+        if (dirty->buffers[i].device == device) {
+            dirty->current = (int)i;
+        }
+    }
+    if (dirty->invalid) {
+        rect_t full = { 0, 0, dirty->width - 1, dirty->height - 1 };
+        dirty->changed.push_back(full);
+        dirty->invalid = false;
+    }
+}
+
+// 这一帧中 [x0, x1] x [y0, y1]（可超出屏幕）内的像素可能与上一帧不同
+inline void dirty_add(device_t* device, int x0, int y0, int x1, int y1)
+{
+    rect_t r = { x0, y0, x1, y1 };
+    device->dirty->changed.push_back(r);
+}
+
+inline void dirty_add_full(device_t* device)
+{
+    dirty_add(device, 0, 0, device->width - 1, device->height - 1);
+}
+
+// 影响整个画面的状态：与上一帧的 size 字节不同时整帧重绘。state 按字节比较，结构体不能有未初始化的填充
+inline void dirty_state(device_t* device, const void* state, size_t size)
+{
+    dirty_t* dirty = device->dirty;
+    const unsigned char* bytes = (const unsigned char*)state;
+    if (dirty->state.size() != size || memcmp(dirty->state.data(), bytes, size) != 0) {
+        dirty_add_full(device);
+        dirty->state.assign(bytes, bytes + size);
+    }
+}
+
+// 结束报告变化，返回这一帧在 device 上需要重绘的矩形（互不相交，为空时整帧都不用画）
+inline const std::vector<rect_t>* dirty_resolve(device_t* device)
+{
+    dirty_t* dirty = device->dirty;
+    dirty_merge(&dirty->changed, dirty->width, dirty->height);
+    dirty->history[dirty->frame % DIRTY_HISTORY] = dirty->changed;
+
+    dirty_buffer_t* buffer = &dirty->buffers[dirty->current];
+    buffer->changed = dirty->changed;
+    buffer->rects.clear();
+    if (buffer->frame == 0 || dirty->frame - buffer->frame > DIRTY_HISTORY) {
+        rect_t full = { 0, 0, dirty->width - 1, dirty->height - 1 };
+        buffer->rects.push_back(full);
+    } else {
+        for (unsigned long long f = buffer->frame + 1; f <= dirty->frame; f++) {
+            const std::vector<rect_t>& rects = dirty->history[f % DIRTY_HISTORY];
+            buffer->rects.insert(buffer->rects.end(), rects.begin(), rects.end());
+        }
+        dirty_merge(&buffer->rects, dirty->width, dirty->height);
+    }
+    buffer->frame = dirty->frame;
+    MICRO3D_STATS_ADD(device, dirty_rects, buffer->rects.size());
+    for (size_t i = 0; i < buffer->rects.size(); i++) {
+        MICRO3D_STATS_ADD(device, dirty_pixels, (unsigned long long)rect_area(&buffer->rects[i]));
+    }
+    return &buffer->rects;
+}
+
+// device 最近一次绘制的帧相对上一帧变化的区域；device 没有使用脏矩形时返回 nullptr
+inline const std::vector<rect_t>* dirty_changed(const device_t* device)
+{
+    const dirty_buffer_t* buffer = device->dirty ? dirty_buffer(device->dirty, device) : nullptr;
+    return buffer ? &buffer->changed : nullptr;
+}
+
+// 对 rects 中的每个矩形设置 scissor 后执行命令缓冲，之后恢复裁剪状态
+inline void command_buffer_execute_rects(const command_buffer_t* cb, device_t* device, const std::vector<rect_t>* rects)
+{
+    bool scissor_test = device->scissor_test;
+    rect_t scissor = device->scissor;
+    for (size_t i = 0; i < rects->size(); i++) {
+        device->scissor_test = true;
+        device->scissor = (*rects)[i];
+        command_buffer_execute(cb, device);
     }
+    device->scissor_test = scissor_test;
+    device->scissor = scissor;
+}
 
-    // pixel(device, 400, 100, 0xc00000);
-    // pixel(device, 400, 200, 0xc00000);
-    // pixel(device, 400, 300, 0xc00000);
+extern float g_cameraZ;
+
+// render3d 的绘制方式
+typedef enum {
+    RENDER_SOLID = 0, // 每个面一种颜色
+    RENDER_WIREFRAME, // 线框
+    RENDER_GOURAUD,   // 顶点颜色逐像素插值
+    RENDER_TEXTURED,  // 纹理贴图
+    RENDER_TRANSLUCENT, // 半透明长方体套住不透明的小长方体
+    RENDER_MODE_COUNT
+} render_mode_t;
+
+// 绘制一帧，相机位于 (0, 0, camera_z)；在其他线程上绘制时由调用者传入相机位置的快照
+inline void render3d(device_t* device, render_mode_t mode, float camera_z)
+{
+    MICRO3D_STATS_SCOPE(device, STATS_RENDER3D);
+    MICRO3D_STATS_ADD(device, frames, 1);
 
-    // line(device, 0, 0, 400, 300, 0xc00000);
-    // line(device, 400, 0, 400, 150, 0xc00000);
+    // 整帧先记录到命令缓冲，排序后执行；命令缓冲每个线程一个，每帧重置后复用内存，线程退出时释放
+    static thread_local std::unique_ptr<command_buffer_t, void (*)(command_buffer_t*)> owner(command_buffer_create(0), command_buffer_destroy);
+    command_buffer_t* commands = owner.get();
+    command_buffer_reset(commands);
 
-    //vec4_t v1 = { 100, 100, 0, 1 };
-    //vec4_t v2 = { 400, 100, 0, 1 };
-    //vec4_t v3 = { 250, 400, 0, 1 };
-    //triangle(device, &v1, &v2, &v3, 0xc00000);
+    // 清空屏幕缓冲，避免模式切换时残留
+    command_clear_color(commands, 0xFF000000); // 不透明的黑色背景
+    command_clear_depth(commands, 1.0f); // 远平面
 
-	 // 设置变换
+    // 设置变换
     transform_t transform;
 
-	// 世界矩阵：让长方体稍微旋转
+    // 世界矩阵：让长方体稍微旋转
     float angle = 0.0f;
-    //angle += 0.1f;
-    
+
     matrix_t rotation_y, translation, scaling;
     matrix_rotation_y(&rotation_y, angle);
     matrix_translation(&translation, 0.0f, 0.0f, 0.1f);
     matrix_scaling(&scaling, 1.0f, 1.0f, 1.0f); // 非立方体，更像长方体
-    
+
     // 组合世界变换：先缩放，再旋转，最后平移
     matrix_t temp;
     matrix_multiply(&temp, &scaling, &rotation_y);
     matrix_multiply(&transform.world, &temp, &translation);
-    
+
     // 视图矩阵：相机位置
-    vec4_t eye = { 0.0f, 0.0f, g_cameraZ, 1.0f };
+    vec4_t eye = { 0.0f, 0.0f, camera_z, 1.0f };
     vec4_t target = { 0.0f, 0.0f, 0.0f, 1.0f };
     vec4_t up = { 0.0f, 1.0f, 0.0f, 0.0f };
     matrix_look_at(&transform.view, &eye, &target, &up);
-    
+
     // 投影矩阵
     float aspect = (float)device->width / (float)device->height;
     matrix_perspective_fov(&transform.projection, 3.1415926f / 3.0f, aspect, 0.1f, 100.0f);
-    
-    // 绘制长方体：根据模式在实心和线框之间切换
-    if (wireframe) {
-        draw_cube_wireframe(device, &transform);
+
+    // 绘制长方体：根据模式在实心、线框、Gouraud 着色和纹理贴图之间切换
+    switch (mode) {
+    case RENDER_WIREFRAME: command_draw(commands, &transform, draw_cube_wireframe); break;
+    case RENDER_GOURAUD: command_draw(commands, &transform, draw_cube_gouraud); break;
+    case RENDER_TEXTURED: {
+        // 演示用的棋盘格纹理：第一次使用时创建，程序退出时释放
+        static const std::unique_ptr<texture_t, void (*)(texture_t*)> texture(texture_create_checker(256, 32, TEXTURE_MORTON), texture_destroy);
+        shader_texture_t shader = { texture.get(), TEXTURE_TRILINEAR };
+        command_draw_indexed_shaded(commands, &transform, CUBE_FACE_VERTICES, CUBE_FACE_UVS, 24, CUBE_FACE_INDICES, 36, shader);
+        break;
+    }
+    case RENDER_TRANSLUCENT: {
+        // 半透明的长方体先记录，排序后仍在不透明的长方体之后绘制；半透明的绘制只做深度测试，不写深度
+        render_state_t translucent = { DEPTH_LESS, true, CULL_NONE, BLEND_OVER };
+        render_state_t opaque = { DEPTH_LESS, false, CULL_NONE, BLEND_NONE };
+        transform_t inner = transform;
+        matrix_t half;
+        matrix_scaling(&half, 0.5f, 0.5f, 0.5f);
+        matrix_multiply(&inner.world, &half, &transform.world);
+        command_set_state(commands, &translucent);
+        command_draw(commands, &transform, draw_cube_translucent);
+        command_set_state(commands, &opaque);
+        command_draw(commands, &inner, draw_cube);
+        break;
+    }
+    default: command_draw(commands, &transform, draw_cube); break;
+    }
+    command_buffer_sort(commands);
+    if (device->dirty) {
+        // 长方体是静止的，画面只随绘制方式和相机位置变化；都没变时不重绘任何区域
+        struct {
+            render_mode_t mode;
+            float camera_z;
+        } state = { mode, camera_z };
+        dirty_begin(device);
+        dirty_state(device, &state, sizeof(state));
+        command_buffer_execute_rects(commands, device, dirty_resolve(device));
     } else {
-        draw_cube(device, &transform);
+        command_buffer_execute(commands, device);
+    }
+
+    // 分块模式下在帧末并行光栅化
+    binner_flush(device);
+    // 延迟清除时补齐没有被绘制的 tile
+    lazy_clear_resolve(device, false);
+    // 多重采样时把边缘像素的采样合成到颜色缓冲
+    msaa_resolve(device);
+}
+
+inline void render3d(device_t* device, render_mode_t mode)
+{
+    render3d(device, mode, g_cameraZ);
+}
+
+// 帧流水线：N 个 device_t 轮流使用，渲染线程绘制后面的帧时，调用线程同时呈现或写出前面已完成的帧。
+// device 的缓冲区由调用者分配；帧按提交顺序在一个渲染线程上依次绘制，因此各 device 可以共用同一个 binner 和 stats。
+// 每个 device 依次处于 空闲 -> 等待渲染 -> 渲染完成 -> 调用者持有 -> 空闲，
+// 全部 device 都不空闲时提交会阻塞（或返回 false），调用者写出得慢时渲染线程自然停下，不会无限排队
+struct frame_pipeline_t {
+    std::vector<device_t*> devices;
+    std::vector<std::vector<std::max_align_t> > params; // 每个 device 本次绘制的参数
+    void (*render)(device_t* device, const void* params, void* user);
+    void* user;
+
+    std::vector<int> free_slots;   // 空闲
+    std::vector<int> render_queue; // 等待渲染，按提交顺序
+    std::vector<int> ready_queue;  // 渲染完成，按提交顺序
+    bool rendering;                // 渲染线程正在绘制
+    bool quit;
+
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable render_cv; // 通知渲染线程
+    std::condition_variable done_cv;   // 通知调用线程：有帧完成或有 device 空闲
+};
+
+inline void frame_pipeline_worker(frame_pipeline_t* pipeline)
+{
+    for (;;) {
+        int slot;
+        {
+            std::unique_lock<std::mutex> lock(pipeline->mutex);
+            pipeline->render_cv.wait(lock, [&]() { return pipeline->quit || !pipeline->render_queue.empty(); });
+            if (pipeline->quit) {
+                return;
+            }
+            slot = pipeline->render_queue.front();
+            pipeline->render_queue.erase(pipeline->render_queue.begin());
+            pipeline->rendering = true;
+        }
+        pipeline->render(pipeline->devices[slot], pipeline->params[slot].data(), pipeline->user);
+        {
+            std::lock_guard<std::mutex> lock(pipeline->mutex);
+            pipeline->ready_queue.push_back(slot);
+            pipeline->rendering = false;
+        }
+        pipeline->done_cv.notify_all();
+    }
+}
+
+// devices 为 count 个已初始化、大小相同的 device；render 在渲染线程上被调用，params 为 frame_pipeline_submit 时复制的参数
+inline frame_pipeline_t* frame_pipeline_create(device_t* const* devices, int count,
+                                               void (*render)(device_t* device, const void* params, void* user), void* user)
+{
+    frame_pipeline_t* pipeline = new frame_pipeline_t;
+    pipeline->devices.assign(devices, devices + count);
+    pipeline->params.resize(count);
+    pipeline->render = render;
+    pipeline->user = user;
+    for (int i = 0; i < count; i++) {
+        pipeline->free_slots.push_back(i);
+    }
+    pipeline->rendering = false;
+    pipeline->quit = false;
+    pipeline->thread = std::thread(frame_pipeline_worker, pipeline);
+    return pipeline;
+}
+
+// 等待正在绘制的帧完成后退出渲染线程；还没开始绘制的帧被丢弃
+inline void frame_pipeline_destroy(frame_pipeline_t* pipeline)
+{
+    if (!pipeline) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(pipeline->mutex);
+        pipeline->quit = true;
+    }
+    pipeline->render_cv.notify_one();
+    pipeline->thread.join();
+    delete pipeline;
+}
+
+// 提交一帧：复制 size 字节的 params，交给渲染线程。没有空闲的 device 时，wait 为真则等待调用者释放一帧，否则返回 false
+inline bool frame_pipeline_submit(frame_pipeline_t* pipeline, const void* params, size_t size, bool wait)
+{
+    int slot;
+    {
+        std::unique_lock<std::mutex> lock(pipeline->mutex);
+        if (wait) {
+            pipeline->done_cv.wait(lock, [&]() { return !pipeline->free_slots.empty(); });
+        } else if (pipeline->free_slots.empty()) {
+            return false;
+        }
+        slot = pipeline->free_slots.back();
+        pipeline->free_slots.pop_back();
+        std::vector<std::max_align_t>& p = pipeline->params[slot];
+        p.resize((size + sizeof(std::max_align_t) - 1) / sizeof(std::max_align_t));
+        if (size) {
+            memcpy(p.data(), params, size);
+        }
+        pipeline->render_queue.push_back(slot);
+    }
+    pipeline->render_cv.notify_one();
+    return true;
+}
+
+// 取出最早提交且已经绘制完成的一帧，返回它在 devices 中的下标；调用者写出后用 frame_pipeline_release 归还。
+// 没有完成的帧时，wait 为真则等待；没有任何已提交、未取出的帧或 wait 为假时返回 -1
+inline int frame_pipeline_acquire(frame_pipeline_t* pipeline, bool wait)
+{
+    std::unique_lock<std::mutex> lock(pipeline->mutex);
+    if (wait) {
+        pipeline->done_cv.wait(lock, [&]() {
+            return !pipeline->ready_queue.empty() || (pipeline->render_queue.empty() && !pipeline->rendering);
+        });
+    }
+    if (pipeline->ready_queue.empty()) {
+        return -1;
+    }
+    int slot = pipeline->ready_queue.front();
+    pipeline->ready_queue.erase(pipeline->ready_queue.begin());
+    return slot;
+}
+
+inline void frame_pipeline_release(frame_pipeline_t* pipeline, int slot)
+{
+    {
+        std::lock_guard<std::mutex> lock(pipeline->mutex);
+        pipeline->free_slots.push_back(slot);
     }
+    pipeline->done_cv.notify_all();
 }
\ No newline at end of file
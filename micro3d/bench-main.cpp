@@ -0,0 +1,1302 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../micro3d.h"
+#include "../micro3d_scene.h"
+
+// 基准测试：在内存中的 device_t 上直接调用 micro3d.h 的接口，输出 JSON/CSV/文本结果。
+// 输入数据由固定种子的伪随机数生成，每次运行相同；每个用例重复运行到达到最短时间，取中位数
+
+float g_cameraZ = -1.5f;
+
+// xorshift32：固定种子，保证不同机器、不同次运行的输入一致
+typedef struct {
+    unsigned int state;
+} bench_rng_t;
+
+static float rng_float(bench_rng_t* rng, float lo, float hi)
+{
+    unsigned int x = rng->state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    rng->state = x;
+    return lo + (hi - lo) * (float)(x >> 8) * (1.0f / 16777216.0f);
+}
+
+typedef struct {
+    std::vector<unsigned int> buffer;
+    std::vector<float> zbuffer;
+    device_t device;
+} surface_t;
+
+// 分配绘制表面；depth 为真时带深度缓冲和 Hi-Z，threads >= 0 时使用分块光栅化
+static void surface_init(surface_t* surface, int width, int height, bool depth, int threads)
+{
+    surface->buffer.assign((size_t)width * height, 0);
+    surface->device = device_t();
+    surface->device.width = width;
+    surface->device.height = height;
+    surface->device.buffer = surface->buffer.data();
+    if (depth) {
+        surface->zbuffer.assign((size_t)width * height, 1.0f);
+        surface->device.zbuffer = surface->zbuffer.data();
+        surface->device.hiz = hiz_create(&surface->device);
+    }
+    if (threads >= 0) {
+        surface->device.binner = binner_create(&surface->device, 64, threads);
+    }
+}
+
+static void surface_destroy(surface_t* surface)
+{
+    binner_destroy(surface->device.binner);
+    hiz_destroy(surface->device.hiz);
+    lazy_clear_destroy(surface->device.lazy_clear);
+    msaa_destroy(surface->device.msaa);
+    surface->device = device_t();
+}
+
+// 每次运行处理的工作量，用于换算吞吐量；为 0 的指标不输出
+typedef struct {
+    double ops;
+    double pixels;
+    double triangles;
+    double frames;
+} bench_work_t;
+
+typedef struct {
+    std::string name;
+    int width, height;
+    int samples;
+    double ns_per_run; // 中位数
+    bench_work_t work;
+} bench_result_t;
+
+typedef struct {
+    const char* filter;
+    double min_time;
+    int min_samples;
+    std::vector<bench_result_t> results;
+} bench_context_t;
+
+static void run_bench(bench_context_t* ctx, const std::string& name, int width, int height,
+                      const bench_work_t& work, const std::function<void()>& body)
+{
+    if (ctx->filter && name.find(ctx->filter) == std::string::npos) {
+        return;
+    }
+    typedef std::chrono::steady_clock clock;
+
+    body(); // 预热：填充缓存，启动线程池
+
+    std::vector<double> samples;
+    double total = 0;
+    while (total < ctx->min_time || (int)samples.size() < ctx->min_samples) {
+        clock::time_point start = clock::now();
+        body();
+        double ns = std::chrono::duration<double, std::nano>(clock::now() - start).count();
+        samples.push_back(ns);
+        total += ns * 1e-9;
+    }
+    std::sort(samples.begin(), samples.end());
+
+    bench_result_t result;
+    result.name = name;
+    result.width = width;
+    result.height = height;
+    result.samples = (int)samples.size();
+    result.ns_per_run = samples[samples.size() / 2];
+    result.work = work;
+    ctx->results.push_back(result);
+    fprintf(stderr, "%-36s %5dx%-5d %12.0f ns\n", name.c_str(), width, height, result.ns_per_run);
+}
+
+static std::string resolution_name(const char* prefix, int width, int height)
+{
+    char name[128];
+    snprintf(name, sizeof(name), "%s/%dx%d", prefix, width, height);
+    return name;
+}
+
+static const char* simd_path()
+{
+#ifdef MICRO3D_SSE2
+    return cpu_has_avx2() ? "avx2" : "sse2";
+#else
+    return "scalar";
+#endif
+}
+
+// 屏幕空间三角形集合，附带覆盖面积（像素数）
+typedef struct {
+    std::vector<vec4_t> vertices; // 每 3 个组成一个三角形
+    double area;
+} triangle_set_t;
+
+static void triangle_set_add(triangle_set_t* set, vec4_t a, vec4_t b, vec4_t c)
+{
+    set->vertices.push_back(a);
+    set->vertices.push_back(b);
+    set->vertices.push_back(c);
+    set->area += fabs(cross_product_2d(&a, &b, &c)) * 0.5;
+}
+
+// 以随机点为中心、边长约为 size 的随机三角形，完全位于屏幕内；z 从远到近递减，
+// 开启深度测试时每个三角形都能通过
+static triangle_set_t make_triangles(int count, float size, int width, int height, unsigned int seed)
+{
+    bench_rng_t rng = { seed };
+    triangle_set_t set = {};
+    for (int i = 0; i < count; i++) {
+        float cx = rng_float(&rng, size, width - size);
+        float cy = rng_float(&rng, size, height - size);
+        float z = 0.9f - 0.8f * (float)i / (float)count;
+        vec4_t v[3];
+        for (int k = 0; k < 3; k++) {
+            float angle = (float)k * 2.0944f + rng_float(&rng, -0.5f, 0.5f);
+            float radius = size * rng_float(&rng, 0.4f, 0.6f);
+            v[k].x = cx + radius * cosf(angle);
+            v[k].y = cy + radius * sinf(angle);
+            v[k].z = z;
+            v[k].w = 1.0f;
+        }
+        triangle_set_add(&set, v[0], v[1], v[2]);
+    }
+    return set;
+}
+
+// 细长三角形：长度接近屏幕宽度，宽度约 1 像素，方向随机
+static triangle_set_t make_slivers(int count, int width, int height, unsigned int seed)
+{
+    bench_rng_t rng = { seed };
+    triangle_set_t set = {};
+    float length = 0.45f * (float)std::min(width, height);
+    for (int i = 0; i < count; i++) {
+        float cx = rng_float(&rng, length, width - length);
+        float cy = rng_float(&rng, length, height - length);
+        float angle = rng_float(&rng, 0.0f, 6.2831853f);
+        float dx = cosf(angle) * length, dy = sinf(angle) * length;
+        float z = 0.9f - 0.8f * (float)i / (float)count;
+        vec4_t a = { cx - dx, cy - dy, z, 1.0f };
+        vec4_t b = { cx + dx, cy + dy, z, 1.0f };
+        vec4_t c = { cx + dx - dy / length, cy + dy + dx / length, z, 1.0f };
+        triangle_set_add(&set, a, b, c);
+    }
+    return set;
+}
+
+// 两个三角形覆盖整个屏幕，z 逐对递减
+static triangle_set_t make_fullscreen(int count, int width, int height)
+{
+    triangle_set_t set = {};
+    float w = (float)width, h = (float)height;
+    for (int i = 0; i < count; i++) {
+        float z = 0.9f - 0.8f * (float)i / (float)count;
+        vec4_t a = { 0, 0, z, 1 }, b = { w, 0, z, 1 }, c = { w, h, z, 1 }, d = { 0, h, z, 1 };
+        triangle_set_add(&set, a, b, c);
+        triangle_set_add(&set, a, c, d);
+    }
+    return set;
+}
+
+static void bench_triangle_set(bench_context_t* ctx, const char* name, const triangle_set_t* set,
+                               int width, int height, bool depth, int threads)
+{
+    surface_t surface;
+    surface_init(&surface, width, height, depth, threads);
+    device_t* device = &surface.device;
+    std::vector<vec4_t> vertices = set->vertices;
+    int triangles = (int)vertices.size() / 3;
+    bench_work_t work = { (double)triangles, set->area, (double)triangles, 0 };
+    // 开启深度时每次运行先清空深度缓冲（计入耗时），保证每次运行的深度测试结果相同
+    run_bench(ctx, name, width, height, work, [&]() {
+        if (depth) {
+            clear_depth(device, 1.0f);
+        }
+        for (int i = 0; i < triangles; i++) {
+            triangle(device, &vertices[i * 3], &vertices[i * 3 + 1], &vertices[i * 3 + 2], 0xFFC00000 + (i & 0xFFFF));
+        }
+        binner_flush(device);
+    });
+    surface_destroy(&surface);
+}
+
+// offscreen 为 true 时端点不限制在屏幕内，线段的大部分在视口外
+static void bench_lines(bench_context_t* ctx, const char* name, int count, float length, int width, int height, bool offscreen)
+{
+    surface_t surface;
+    surface_init(&surface, width, height, false, -1);
+    device_t* device = &surface.device;
+    bench_rng_t rng = { 7 };
+    std::vector<int> coords;
+    double pixels = 0;
+    for (int i = 0; i < count; i++) {
+        int x1 = (int)rng_float(&rng, 0, (float)width - 1);
+        int y1 = (int)rng_float(&rng, 0, (float)height - 1);
+        float angle = rng_float(&rng, 0.0f, 6.2831853f);
+        int x2 = (int)(x1 + cosf(angle) * length);
+        int y2 = (int)(y1 + sinf(angle) * length);
+        if (!offscreen) {
+            x2 = std::max(0, std::min(width - 1, x2));
+            y2 = std::max(0, std::min(height - 1, y2));
+        }
+        coords.push_back(x1);
+        coords.push_back(y1);
+        coords.push_back(x2);
+        coords.push_back(y2);
+        float fx1 = (float)x1, fy1 = (float)y1, fx2 = (float)x2, fy2 = (float)y2;
+        if (line_clip(device, &fx1, &fy1, &fx2, &fy2)) {
+            pixels += std::max(fabsf(fx2 - fx1), fabsf(fy2 - fy1)) + 1;
+        }
+    }
+    bench_work_t work = { (double)count, pixels, 0, 0 };
+    run_bench(ctx, name, width, height, work, [&]() {
+        for (int i = 0; i < count; i++) {
+            line(device, coords[i * 4], coords[i * 4 + 1], coords[i * 4 + 2], coords[i * 4 + 3], 0xFFFFFFFF);
+        }
+    });
+    surface_destroy(&surface);
+}
+
+// 与 bench_triangle_set 相同，但经过 triangle_shaded 和给定的着色器，顶点属性为 [0, 1] 内的随机数
+template <typename Shader>
+static void bench_triangle_shaded(bench_context_t* ctx, const char* name, const triangle_set_t* set,
+                                  int width, int height, bool depth, int threads, const Shader& shader)
+{
+    const int n = Shader::VARYINGS;
+    surface_t surface;
+    surface_init(&surface, width, height, depth, threads);
+    device_t* device = &surface.device;
+    std::vector<vec4_t> vertices = set->vertices;
+    int triangles = (int)vertices.size() / 3;
+    bench_rng_t rng = { 5 };
+    std::vector<float> varyings(vertices.size() * n + 1);
+    for (size_t i = 0; i < varyings.size(); i++) {
+        varyings[i] = rng_float(&rng, 0.0f, 1.0f);
+    }
+    bench_work_t work = { (double)triangles, set->area, (double)triangles, 0 };
+    run_bench(ctx, name, width, height, work, [&]() {
+        if (depth) {
+            clear_depth(device, 1.0f);
+        }
+        for (int i = 0; i < triangles; i++) {
+            const float* a = &varyings[(size_t)i * 3 * n];
+            triangle_shaded(device, &vertices[i * 3], &vertices[i * 3 + 1], &vertices[i * 3 + 2], a, a + n, a + 2 * n, shader);
+        }
+        binner_flush(device);
+    });
+    surface_destroy(&surface);
+}
+
+// 没有属性、按像素坐标生成颜色的着色器：衡量模板化逐像素着色路径本身的开销
+struct shader_checker_t {
+    enum { VARYINGS = 0 };
+    unsigned int operator()(const fragment_t<0>& frag) const
+    {
+        return ((frag.x ^ frag.y) & 8) ? 0xFFFFFFFF : 0xFF404040;
+    }
+};
+
+// 只有逐像素接口的纹理着色器：与 shader_texture_t 对比 shade4 的 SIMD 采样
+struct shader_texture_scalar_t {
+    enum { VARYINGS = 2 };
+    shader_texture_t base;
+    unsigned int operator()(const fragment_t<2>& frag) const { return base(frag); }
+};
+
+// 覆盖整个屏幕、旋转 30 度的纹理平面；scale 为每个像素跨过的 texel 数（1 时 LOD 约为 0，4 时约为 2）
+template <typename Shader>
+static void bench_textured(bench_context_t* ctx, const char* name, const texture_t* texture, float scale,
+                           int width, int height, int threads, const Shader& shader)
+{
+    surface_t surface;
+    surface_init(&surface, width, height, false, threads);
+    device_t* device = &surface.device;
+    float w = (float)width, h = (float)height;
+    vec4_t corners[4] = { { 0, 0, 0.5f, 1 }, { w, 0, 0.5f, 1 }, { w, h, 0.5f, 1 }, { 0, h, 0.5f, 1 } };
+    float c = cosf(0.5235988f) * scale, s = sinf(0.5235988f) * scale;
+    float uv[4][2];
+    for (int i = 0; i < 4; i++) {
+        uv[i][0] = (c * corners[i].x - s * corners[i].y) / (float)texture->width;
+        uv[i][1] = (s * corners[i].x + c * corners[i].y) / (float)texture->height;
+    }
+    bench_work_t work = { w * h, w * h, 2, 0 };
+    run_bench(ctx, name, width, height, work, [&]() {
+        triangle_shaded(device, &corners[0], &corners[1], &corners[2], uv[0], uv[1], uv[2], shader);
+        triangle_shaded(device, &corners[0], &corners[2], &corners[3], uv[0], uv[2], uv[3], shader);
+        binner_flush(device);
+    });
+    surface_destroy(&surface);
+}
+
+static void bench_wireframe(bench_context_t* ctx, const char* name, const triangle_set_t* set, int width, int height)
+{
+    surface_t surface;
+    surface_init(&surface, width, height, false, -1);
+    device_t* device = &surface.device;
+    std::vector<vec4_t> vertices = set->vertices;
+    int triangles = (int)vertices.size() / 3;
+    bench_work_t work = { (double)triangles, 0, (double)triangles, 0 };
+    run_bench(ctx, name, width, height, work, [&]() {
+        for (int i = 0; i < triangles; i++) {
+            triangle_wireframe(device, &vertices[i * 3], &vertices[i * 3 + 1], &vertices[i * 3 + 2], 0xFFFFFFFF);
+        }
+    });
+    surface_destroy(&surface);
+}
+
+// 经纬度细分的球面网格线框。shared_edges 为 true 时用预先提取的不重复边调用 draw_lines_indexed，
+// 否则逐三角形画三条边（共享边画两次）
+static void bench_mesh_wireframe(bench_context_t* ctx, int rings, int width, int height, bool shared_edges)
+{
+    surface_t surface;
+    surface_init(&surface, width, height, false, -1);
+    device_t* device = &surface.device;
+
+    int segments = rings * 2;
+    std::vector<vec4_t> vertices;
+    std::vector<unsigned int> indices;
+    for (int r = 0; r <= rings; r++) {
+        float theta = 3.1415926f * (float)r / (float)rings;
+        for (int k = 0; k <= segments; k++) {
+            float phi = 6.2831853f * (float)k / (float)segments;
+            vec4_t v = { sinf(theta) * cosf(phi), cosf(theta), sinf(theta) * sinf(phi), 1.0f };
+            vertices.push_back(v);
+        }
+    }
+    for (int r = 0; r < rings; r++) {
+        for (int k = 0; k < segments; k++) {
+            unsigned int a = (unsigned int)(r * (segments + 1) + k);
+            unsigned int b = a + (unsigned int)(segments + 1);
+            unsigned int quad[6] = { a, b, a + 1, a + 1, b, b + 1 };
+            indices.insert(indices.end(), quad, quad + 6);
+        }
+    }
+    std::vector<unsigned int> edges;
+    mesh_edges(&edges, indices.data(), (int)indices.size());
+
+    transform_t transform;
+    vec4_t eye = { 0.0f, 0.0f, -2.5f, 1.0f };
+    vec4_t target = { 0.0f, 0.0f, 0.0f, 1.0f };
+    vec4_t up = { 0.0f, 1.0f, 0.0f, 0.0f };
+    matrix_identity(&transform.world);
+    matrix_look_at(&transform.view, &eye, &target, &up);
+    matrix_perspective_fov(&transform.projection, 3.1415926f / 3.0f, (float)width / (float)height, 0.1f, 100.0f);
+
+    int triangles = (int)indices.size() / 3;
+    bench_work_t work = { shared_edges ? (double)edges.size() / 2 : (double)triangles * 3, 0, (double)triangles, 0 };
+    std::string name = resolution_name(shared_edges ? "mesh_wireframe_shared" : "mesh_wireframe_per_triangle", width, height);
+    run_bench(ctx, name, width, height, work, [&]() {
+        if (shared_edges) {
+            draw_lines_indexed(device, &transform, vertices.data(), (int)vertices.size(), edges.data(), (int)edges.size(), nullptr, 0xFFFFFFFF);
+            return;
+        }
+        matrix_t wvp;
+        transform_wvp(&wvp, &transform);
+        for (int i = 0; i < triangles; i++) {
+            vec4_t v[3];
+            for (int k = 0; k < 3; k++) {
+                vector_transform(&v[k], &vertices[indices[i * 3 + k]], &wvp);
+            }
+            draw_line(device, &v[0], &v[1], 0xFFFFFFFF);
+            draw_line(device, &v[1], &v[2], 0xFFFFFFFF);
+            draw_line(device, &v[2], &v[0], 0xFFFFFFFF);
+        }
+    });
+    surface_destroy(&surface);
+}
+
+static void bench_clear(bench_context_t* ctx, int width, int height)
+{
+    surface_t surface;
+    surface_init(&surface, width, height, true, -1);
+    device_t* device = &surface.device;
+    double pixels = (double)width * height;
+    bench_work_t work = { 1, pixels, 0, 0 };
+    run_bench(ctx, resolution_name("clear_color", width, height), width, height, work, [&]() {
+        clear_color(device, 0xFF000000);
+    });
+    run_bench(ctx, resolution_name("clear_depth", width, height), width, height, work, [&]() {
+        clear_depth(device, 1.0f);
+    });
+
+    // 延迟清除：空帧（清除后直接补齐）和上一帧画过一个小三角形的帧，两种情况下都只处理被写入过的 tile
+    device->lazy_clear = lazy_clear_create(device, 64);
+    run_bench(ctx, resolution_name("clear_lazy_empty", width, height), width, height, work, [&]() {
+        clear_color(device, 0xFF000000);
+        clear_depth(device, 1.0f);
+        lazy_clear_resolve(device, false);
+    });
+    vec4_t v1 = { 10, 10, 0.5f, 1 }, v2 = { 60, 10, 0.5f, 1 }, v3 = { 10, 60, 0.5f, 1 };
+    run_bench(ctx, resolution_name("clear_lazy_small", width, height), width, height, work, [&]() {
+        clear_color(device, 0xFF000000);
+        clear_depth(device, 1.0f);
+        triangle(device, &v1, &v2, &v3, 0xFFFFFFFF);
+        lazy_clear_resolve(device, false);
+    });
+    surface_destroy(&surface);
+}
+
+static void bench_render3d(bench_context_t* ctx, int width, int height, render_mode_t mode, int threads, bool lazy_clear)
+{
+    static const char* const mode_names[RENDER_MODE_COUNT] = {
+        "render3d", "render3d_wireframe", "render3d_gouraud", "render3d_textured", "render3d_translucent"
+    };
+    surface_t surface;
+    surface_init(&surface, width, height, true, threads);
+    device_t* device = &surface.device;
+    if (lazy_clear) {
+        device->lazy_clear = lazy_clear_create(device, 64);
+    }
+    bench_work_t work = { 1, (double)width * height, mode == RENDER_WIREFRAME ? 0.0 : 12.0, 1 };
+    char name[64];
+    snprintf(name, sizeof(name), "%s%s%s", mode_names[mode], threads >= 0 ? "_binned" : "", lazy_clear ? "_lazy" : "");
+    run_bench(ctx, resolution_name(name, width, height), width, height, work, [&]() {
+        render3d(device, mode);
+    });
+    surface_destroy(&surface);
+}
+
+// 画面不变时的脏矩形模式：第一帧之后没有需要重绘的区域，每帧只剩记录和比较状态的开销
+static void bench_render3d_dirty(bench_context_t* ctx, int width, int height)
+{
+    surface_t surface;
+    surface_init(&surface, width, height, true, -1);
+    device_t* device = &surface.device;
+    device_t* devices[1] = { device };
+    device->dirty = dirty_create(devices, 1);
+    bench_work_t work = { 1, (double)width * height, 0, 1 };
+    run_bench(ctx, resolution_name("render3d_dirty_static", width, height), width, height, work, [&]() {
+        render3d(device, RENDER_SOLID);
+    });
+    dirty_destroy(device->dirty);
+    surface_destroy(&surface);
+}
+
+// n x n x n 个立方体组成的网格，整体位于相机前方，各自绕 y 轴旋转不同的角度；
+// back_to_front 为假时由近到远排列，否则由远到近
+static std::vector<transform_t> make_cube_grid(int n, int width, int height, bool back_to_front)
+{
+    std::vector<transform_t> transforms;
+    vec4_t eye = { 0.0f, 0.0f, -(float)n * 2.0f, 1.0f };
+    vec4_t target = { 0.0f, 0.0f, 0.0f, 1.0f };
+    vec4_t up = { 0.0f, 1.0f, 0.0f, 0.0f };
+    matrix_t view, projection;
+    matrix_look_at(&view, &eye, &target, &up);
+    matrix_perspective_fov(&projection, 3.1415926f / 3.0f, (float)width / (float)height, 0.1f, 100.0f + n * 4.0f);
+    for (int i = 0; i < n; i++) {
+        int z = back_to_front ? n - 1 - i : i;
+        for (int y = 0; y < n; y++) {
+            for (int x = 0; x < n; x++) {
+                transform_t t;
+                matrix_t rotation, translation;
+                matrix_rotation_y(&rotation, 0.3f * (float)(x + y * n + z * n * n));
+                matrix_translation(&translation, (float)x - 0.5f * (n - 1), (float)y - 0.5f * (n - 1), (float)z - 0.5f * (n - 1));
+                matrix_multiply(&t.world, &rotation, &translation);
+                t.view = view;
+                t.projection = projection;
+                transforms.push_back(t);
+            }
+        }
+    }
+    return transforms;
+}
+
+// 立方体网格；立方体的正面在屏幕上为逆时针，cull_mode 为 CULL_CW 时剔除背面
+static void bench_cubes(bench_context_t* ctx, int n, int width, int height, int threads, cull_mode_t cull_mode)
+{
+    surface_t surface;
+    surface_init(&surface, width, height, true, threads);
+    device_t* device = &surface.device;
+    device->cull_mode = cull_mode;
+    std::vector<transform_t> transforms = make_cube_grid(n, width, height, false);
+
+    double cubes = (double)transforms.size();
+    bench_work_t work = { cubes, (double)width * height, cubes * 12, 1 };
+    char prefix[64];
+    snprintf(prefix, sizeof(prefix), "%s%s_%d", threads >= 0 ? "cubes_binned" : "cubes",
+             cull_mode == CULL_NONE ? "" : "_cull", (int)cubes);
+    run_bench(ctx, resolution_name(prefix, width, height), width, height, work, [&]() {
+        clear_color(device, 0xFF000000);
+        clear_depth(device, 1.0f);
+        for (size_t i = 0; i < transforms.size(); i++) {
+            draw_cube(device, &transforms[i]);
+        }
+        binner_flush(device);
+    });
+    surface_destroy(&surface);
+}
+
+// 与 bench_cubes 相同的立方体，由远到近记录到命令缓冲（最坏的提交顺序），每次运行都重新记录；
+// sorted 为真时执行前按深度排序，比较由近到远绘制后 early-Z 和 Hi-Z 剔除的效果
+static void bench_cubes_commands(bench_context_t* ctx, int n, int width, int height, int threads, bool sorted)
+{
+    surface_t surface;
+    surface_init(&surface, width, height, true, threads);
+    device_t* device = &surface.device;
+    command_buffer_t* commands = command_buffer_create(0);
+    std::vector<transform_t> transforms = make_cube_grid(n, width, height, true);
+
+    double cubes = (double)transforms.size();
+    bench_work_t work = { cubes, (double)width * height, cubes * 12, 1 };
+    char prefix[64];
+    snprintf(prefix, sizeof(prefix), "%s_%s_%d", threads >= 0 ? "cubes_commands_binned" : "cubes_commands",
+             sorted ? "sorted" : "back_to_front", (int)cubes);
+    run_bench(ctx, resolution_name(prefix, width, height), width, height, work, [&]() {
+        command_buffer_reset(commands);
+        command_clear_color(commands, 0xFF000000);
+        command_clear_depth(commands, 1.0f);
+        for (size_t i = 0; i < transforms.size(); i++) {
+            command_draw(commands, &transforms[i], draw_cube);
+        }
+        if (sorted) {
+            command_buffer_sort(commands);
+        }
+        command_buffer_execute(commands, device);
+        binner_flush(device);
+    });
+    command_buffer_destroy(commands);
+    surface_destroy(&surface);
+}
+
+// 与 bench_cubes 相同的场景，用 draw_cubes 一次提交所有实例；colored 为真时每个立方体一种颜色
+static void bench_cubes_instanced(bench_context_t* ctx, int n, int width, int height, int threads, bool colored)
+{
+    surface_t surface;
+    surface_init(&surface, width, height, true, threads);
+    device_t* device = &surface.device;
+    std::vector<transform_t> transforms = make_cube_grid(n, width, height, false);
+    std::vector<matrix_t> worlds;
+    std::vector<unsigned int> colors;
+    for (size_t i = 0; i < transforms.size(); i++) {
+        worlds.push_back(transforms[i].world);
+        colors.push_back((unsigned int)(i * 0x9E3779B1u) & 0xFFFFFFFF);
+    }
+
+    double cubes = (double)worlds.size();
+    bench_work_t work = { cubes, (double)width * height, cubes * 12, 1 };
+    char prefix[64];
+    snprintf(prefix, sizeof(prefix), "%s%s_%d", threads >= 0 ? "cubes_instanced_binned" : "cubes_instanced",
+             colored ? "_colored" : "", (int)cubes);
+    run_bench(ctx, resolution_name(prefix, width, height), width, height, work, [&]() {
+        clear_color(device, 0xFF000000);
+        clear_depth(device, 1.0f);
+        draw_cubes(device, &transforms[0].view, &transforms[0].projection, worlds.data(), (int)worlds.size(),
+                   colored ? colors.data() : nullptr);
+        binner_flush(device);
+    });
+    surface_destroy(&surface);
+}
+
+// 抗锯齿：同一个立方体网格分别不做抗锯齿、用 4x MSAA（含帧末合成）、以及按 2x2 超采样绘制后再缩小，
+// 比较逐采样覆盖与整帧 4 倍填充、着色的开销；textured 为真时立方体带三线性滤波的纹理。
+// MSAA 额外输出展开的像素数和采样颜色占用的内存
+typedef enum {
+    AA_NONE = 0,
+    AA_MSAA,
+    AA_SUPERSAMPLE
+} bench_aa_t;
+
+static void bench_cubes_aa(bench_context_t* ctx, int n, int width, int height, int threads, bool textured, bench_aa_t aa)
+{
+    static const char* const aa_names[] = { "none", "msaa", "ssaa" };
+    int scale = aa == AA_SUPERSAMPLE ? 2 : 1;
+    surface_t surface;
+    surface_init(&surface, width * scale, height * scale, true, threads);
+    device_t* device = &surface.device;
+    if (aa == AA_MSAA) {
+        device->msaa = msaa_create(device);
+    }
+    std::vector<transform_t> transforms = make_cube_grid(n, width, height, false);
+    std::vector<unsigned int> resolved((size_t)width * height);
+    texture_t* texture = textured ? texture_create_checker(256, 32, TEXTURE_MORTON) : nullptr;
+
+    double cubes = (double)transforms.size();
+    bench_work_t work = { cubes, (double)width * height, cubes * 12, 1 };
+    char prefix[64];
+    snprintf(prefix, sizeof(prefix), "cubes%s_aa_%s%s_%d", textured ? "_textured" : "", aa_names[aa],
+             threads >= 0 ? "_binned" : "", (int)cubes);
+    std::string name = resolution_name(prefix, width, height);
+    run_bench(ctx, name, width, height, work, [&]() {
+        clear_color(device, 0xFF000000);
+        clear_depth(device, 1.0f);
+        for (size_t i = 0; i < transforms.size(); i++) {
+            if (textured) {
+                draw_cube_textured(device, &transforms[i], texture);
+            } else {
+                draw_cube(device, &transforms[i]);
+            }
+        }
+        binner_flush(device);
+        msaa_resolve(device);
+        if (aa == AA_SUPERSAMPLE) {
+            // 2x2 盒式滤波缩小到目标分辨率
+            const unsigned int* src = device->buffer;
+            int pitch = device->width;
+            for (int y = 0; y < height; y++) {
+                for (int x = 0; x < width; x++) {
+                    const unsigned int* p = src + (size_t)y * 2 * pitch + x * 2;
+                    unsigned int c[4] = { p[0], p[1], p[pitch], p[pitch + 1] };
+                    unsigned int rb = 0x00020002u, ag = 0x00020002u;
+                    for (int k = 0; k < 4; k++) {
+                        rb += c[k] & 0x00FF00FFu;
+                        ag += (c[k] >> 8) & 0x00FF00FFu;
+                    }
+                    resolved[(size_t)y * width + x] = ((rb >> 2) & 0x00FF00FFu) | (((ag >> 2) & 0x00FF00FFu) << 8);
+                }
+            }
+        }
+    });
+    if (aa == AA_MSAA && (!ctx->filter || name.find(ctx->filter) != std::string::npos)) {
+        fprintf(stderr, "%-36s %zu expanded pixels, %zu KB samples\n", name.c_str(),
+                msaa_expanded_pixels(device->msaa), msaa_sample_bytes(device->msaa) >> 10);
+    }
+    texture_destroy(texture);
+    surface_destroy(&surface);
+}
+
+// 颜色混合：把与屏幕同样大小、alpha 随机的图层用 blit 合成到颜色缓冲上（界面叠加）；
+// scalar 为真时逐像素调用 blend_pixel，作为 SIMD 路径的对比
+static void bench_blend(bench_context_t* ctx, int width, int height, blend_mode_t mode, bool scalar)
+{
+    static const char* const mode_names[] = { "blend_none", "blend_over", "blend_add", "blend_multiply" };
+    surface_t surface;
+    surface_init(&surface, width, height, false, -1);
+    device_t* device = &surface.device;
+    device->blend_mode = mode;
+    bench_rng_t rng = { 13 };
+    std::vector<unsigned int> layer((size_t)width * height);
+    for (size_t i = 0; i < layer.size(); i++) {
+        layer[i] = ((unsigned int)rng_float(&rng, 0.0f, 256.0f) << 24) | (unsigned int)rng_float(&rng, 0.0f, 16777216.0f);
+    }
+    clear_color(device, 0xFF406080);
+
+    double pixels = (double)width * height;
+    bench_work_t work = { pixels, pixels, 0, 0 };
+    char prefix[64];
+    snprintf(prefix, sizeof(prefix), "%s%s", mode_names[mode], scalar ? "_scalar" : "");
+    run_bench(ctx, resolution_name(prefix, width, height), width, height, work, [&]() {
+        if (!scalar) {
+            blit(device, 0, 0, layer.data(), width, height, width);
+            return;
+        }
+        for (size_t i = 0; i < layer.size(); i++) {
+            device->buffer[i] = blend_pixel(layer[i], device->buffer[i], mode);
+        }
+    });
+    surface_destroy(&surface);
+}
+
+// 半透明的立方体网格：与 bench_cubes 相同的立方体由近到远记录到命令缓冲，状态为 BLEND_OVER、只读深度，
+// 每次运行重新记录并排序（排序后由远到近执行），每个立方体先画背面再画正面
+static void bench_cubes_translucent(bench_context_t* ctx, int n, int width, int height, int threads)
+{
+    surface_t surface;
+    surface_init(&surface, width, height, true, threads);
+    device_t* device = &surface.device;
+    command_buffer_t* commands = command_buffer_create(0);
+    std::vector<transform_t> transforms = make_cube_grid(n, width, height, false);
+    render_state_t translucent = { DEPTH_LESS, true, CULL_NONE, BLEND_OVER };
+
+    double cubes = (double)transforms.size();
+    bench_work_t work = { cubes, (double)width * height, cubes * 12, 1 };
+    char prefix[64];
+    snprintf(prefix, sizeof(prefix), "%s_%d", threads >= 0 ? "cubes_translucent_binned" : "cubes_translucent", (int)cubes);
+    run_bench(ctx, resolution_name(prefix, width, height), width, height, work, [&]() {
+        command_buffer_reset(commands);
+        command_clear_color(commands, 0xFF000000);
+        command_clear_depth(commands, 1.0f);
+        command_set_state(commands, &translucent);
+        for (size_t i = 0; i < transforms.size(); i++) {
+            command_draw(commands, &transforms[i], draw_cube_translucent);
+        }
+        command_buffer_sort(commands);
+        command_buffer_execute(commands, device);
+        binner_flush(device);
+    });
+    command_buffer_destroy(commands);
+    surface_destroy(&surface);
+}
+
+// 城市场景：side x side 个高度随机的长方体铺在 xz 平面上，相机位于中央、视线水平，远平面 150，
+// 只有很小一部分实例在视锥内
+typedef struct {
+    std::vector<matrix_t> worlds;
+    matrix_t view, projection;
+} city_t;
+
+static city_t make_city(int side, int width, int height, unsigned int seed)
+{
+    city_t city;
+    bench_rng_t rng = { seed };
+    for (int z = 0; z < side; z++) {
+        for (int x = 0; x < side; x++) {
+            float h = rng_float(&rng, 1.0f, 8.0f);
+            matrix_t scaling, translation, world;
+            matrix_scaling(&scaling, 1.0f, h, 1.0f);
+            matrix_translation(&translation, (float)(x - side / 2) * 2.0f, 0.5f * h, (float)(z - side / 2) * 2.0f + 1.0f);
+            matrix_multiply(&world, &scaling, &translation);
+            city.worlds.push_back(world);
+        }
+    }
+    vec4_t eye = { 1.0f, 2.0f, 0.0f, 1.0f };
+    vec4_t target = { 1.3f, 2.0f, 1.0f, 1.0f };
+    vec4_t up = { 0.0f, 1.0f, 0.0f, 0.0f };
+    matrix_look_at(&city.view, &eye, &target, &up);
+    matrix_perspective_fov(&city.projection, 3.1415926f / 3.0f, (float)width / (float)height, 0.1f, 150.0f);
+    return city;
+}
+
+static scene_t* make_city_scene(const city_t* city)
+{
+    scene_t* scene = scene_create();
+    int mesh = scene_add_mesh(scene, CUBE_VERTICES, 8, CUBE_INDICES, 36, CUBE_COLORS, 0);
+    for (size_t i = 0; i < city->worlds.size(); i++) {
+        scene_add_instance(scene, mesh, &city->worlds[i]);
+    }
+    scene_build(scene);
+    return scene;
+}
+
+// 只做 BVH 视锥剔除，不绘制
+static void bench_scene_cull(bench_context_t* ctx, int side, int width, int height)
+{
+    city_t city = make_city(side, width, height, 7);
+    scene_t* scene = make_city_scene(&city);
+    std::vector<int> visible;
+    bench_work_t work = { (double)city.worlds.size(), 0, 0, 1 };
+    char name[64];
+    snprintf(name, sizeof(name), "scene_cull_%d", (int)city.worlds.size());
+    run_bench(ctx, name, width, height, work, [&]() {
+        scene_cull(scene, &city.view, &city.projection, &visible);
+    });
+    scene_destroy(scene);
+}
+
+// 每次移动 1% 的实例后重新计算包围盒并剔除
+static void bench_scene_refit(bench_context_t* ctx, int side, int width, int height)
+{
+    city_t city = make_city(side, width, height, 7);
+    scene_t* scene = make_city_scene(&city);
+    std::vector<int> visible;
+    int count = (int)city.worlds.size();
+    int moved = count / 100;
+    int frame = 0;
+    bench_work_t work = { (double)moved, 0, 0, 1 };
+    char name[64];
+    snprintf(name, sizeof(name), "scene_refit_%d", count);
+    run_bench(ctx, name, width, height, work, [&]() {
+        frame++;
+        for (int i = 0; i < moved; i++) {
+            int instance = (int)(((unsigned int)i * 2654435761u + (unsigned int)frame) % (unsigned int)count);
+            matrix_t world = city.worlds[instance];
+            world.m[3][1] += (frame & 1) ? 0.5f : -0.5f;
+            scene_set_transform(scene, instance, &world);
+        }
+        scene_cull(scene, &city.view, &city.projection, &visible);
+    });
+    scene_destroy(scene);
+}
+
+// 绘制城市场景：scene_draw（BVH 剔除）与对每个实例调用 draw_cube 对比
+static void bench_scene_draw(bench_context_t* ctx, int side, int width, int height, bool brute_force)
+{
+    surface_t surface;
+    surface_init(&surface, width, height, true, -1);
+    device_t* device = &surface.device;
+    city_t city = make_city(side, width, height, 7);
+    scene_t* scene = make_city_scene(&city);
+    std::vector<transform_t> transforms(city.worlds.size());
+    for (size_t i = 0; i < transforms.size(); i++) {
+        transforms[i].world = city.worlds[i];
+        transforms[i].view = city.view;
+        transforms[i].projection = city.projection;
+    }
+
+    bench_work_t work = { (double)city.worlds.size(), (double)width * height, 0, 1 };
+    char prefix[64];
+    snprintf(prefix, sizeof(prefix), "%s_%d", brute_force ? "scene_brute_force" : "scene_draw", (int)city.worlds.size());
+    run_bench(ctx, resolution_name(prefix, width, height), width, height, work, [&]() {
+        clear_color(device, 0xFF000000);
+        clear_depth(device, 1.0f);
+        if (brute_force) {
+            for (size_t i = 0; i < transforms.size(); i++) {
+                draw_cube(device, &transforms[i]);
+            }
+        } else {
+            scene_draw(scene, device, &city.view, &city.projection);
+        }
+    });
+    scene_destroy(scene);
+    surface_destroy(&surface);
+}
+
+// 城市场景中每帧移动一个可见的实例：scene_draw_dirty 只重绘它移动前后覆盖的区域，与每帧整帧重绘对比
+static void bench_scene_moving(bench_context_t* ctx, int side, int width, int height, bool dirty)
+{
+    surface_t surface;
+    surface_init(&surface, width, height, true, -1);
+    device_t* device = &surface.device;
+    device_t* devices[1] = { device };
+    if (dirty) {
+        device->dirty = dirty_create(devices, 1);
+    }
+    city_t city = make_city(side, width, height, 7);
+    scene_t* scene = make_city_scene(&city);
+    // 相机前方第 3 排的实例，在视锥内
+    int instance = (side / 2 + 3) * side + side / 2;
+    int frame = 0;
+
+    bench_work_t work = { 1, (double)width * height, 0, 1 };
+    char prefix[64];
+    snprintf(prefix, sizeof(prefix), "scene_moving_%s_%d", dirty ? "dirty" : "full", (int)city.worlds.size());
+    run_bench(ctx, resolution_name(prefix, width, height), width, height, work, [&]() {
+        frame++;
+        matrix_t world = city.worlds[instance];
+        world.m[3][1] += (frame & 1) ? 0.5f : -0.5f;
+        scene_set_transform(scene, instance, &world);
+        if (dirty) {
+            scene_draw_dirty(scene, device, &city.view, &city.projection, 0xFF000000, 1.0f);
+        } else {
+            clear_color(device, 0xFF000000);
+            clear_depth(device, 1.0f);
+            scene_draw(scene, device, &city.view, &city.projection);
+        }
+    });
+    scene_destroy(scene);
+    dirty_destroy(device->dirty);
+    surface_destroy(&surface);
+}
+
+static void bench_math(bench_context_t* ctx)
+{
+    const int count = 4096;
+    bench_rng_t rng = { 11 };
+    std::vector<matrix_t> matrices(count);
+    std::vector<vec4_t> vertices(count), clip(count), screen(count);
+    std::vector<int> outcodes(count);
+    for (int i = 0; i < count; i++) {
+        for (int r = 0; r < 4; r++) {
+            for (int c = 0; c < 4; c++) {
+                matrices[i].m[r][c] = rng_float(&rng, -1.0f, 1.0f);
+            }
+        }
+        vertices[i].x = rng_float(&rng, -1.0f, 1.0f);
+        vertices[i].y = rng_float(&rng, -1.0f, 1.0f);
+        vertices[i].z = rng_float(&rng, -1.0f, 1.0f);
+        vertices[i].w = 1.0f;
+    }
+    matrix_t m;
+    matrix_perspective_fov(&m, 1.0f, 4.0f / 3.0f, 0.1f, 100.0f);
+    device_t device = {};
+    device.width = 800;
+    device.height = 600;
+
+    volatile float sink = 0;
+    bench_work_t work = { (double)count, 0, 0, 0 };
+    run_bench(ctx, "matrix_multiply", 0, 0, work, [&]() {
+        matrix_t acc;
+        float sum = 0;
+        for (int i = 0; i + 1 < count; i++) {
+            matrix_multiply(&acc, &matrices[i], &matrices[i + 1]);
+            sum += acc.m[3][3];
+        }
+        sink = sink + sum;
+    });
+    run_bench(ctx, "vector_transform", 0, 0, work, [&]() {
+        for (int i = 0; i < count; i++) {
+            vector_transform(&clip[i], &vertices[i], &m);
+        }
+        sink = sink + clip[count - 1].w;
+    });
+    run_bench(ctx, "process_vertices", 0, 0, work, [&]() {
+        process_vertices(clip.data(), screen.data(), outcodes.data(), vertices.data(), count, &m, &device);
+        sink = sink + screen[count - 1].x;
+    });
+}
+
+// FNV-1a 散列，用于比较不同填充路径、不同构建的输出
+static unsigned long long hash_bytes(unsigned long long h, const void* data, size_t size)
+{
+    const unsigned char* p = (const unsigned char*)data;
+    for (size_t i = 0; i < size; i++) {
+        h = (h ^ p[i]) * 1099511628211ull;
+    }
+    return h;
+}
+
+static unsigned long long surface_hash(const surface_t* surface)
+{
+    unsigned long long h = hash_bytes(14695981039346656037ull, surface->buffer.data(), surface->buffer.size() * sizeof(unsigned int));
+    return hash_bytes(h, surface->zbuffer.data(), surface->zbuffer.size() * sizeof(float));
+}
+
+typedef void (*span_fill_fn)(const triangle_setup_t*, unsigned int*, float*, int, int, long long, long long, long long, float, fill_counts_t*);
+
+// 一致性检查：随机的相互穿插、部分超出屏幕的三角形开启深度测试和 Hi-Z 绘制，标量、SSE2、AVX2 填充路径的
+// 颜色和深度缓冲必须逐字节相同。另外输出着色三角形（含 MSAA）的散列，与 MICRO3D_NO_SIMD 构建的输出对比。
+// 不一致时返回 false
+static bool check_span_paths(int count, int width, int height)
+{
+    bench_rng_t rng = { 17 };
+    std::vector<vec4_t> vertices((size_t)count * 3);
+    std::vector<unsigned int> colors(count);
+    std::vector<float> varyings(vertices.size() * 3);
+    for (int i = 0; i < count; i++) {
+        float size = rng_float(&rng, 2.0f, (float)width);
+        float cx = rng_float(&rng, -0.25f * width, 1.25f * width);
+        float cy = rng_float(&rng, -0.25f * height, 1.25f * height);
+        for (int k = 0; k < 3; k++) {
+            vec4_t* v = &vertices[(size_t)i * 3 + k];
+            v->x = cx + rng_float(&rng, -size, size);
+            v->y = cy + rng_float(&rng, -size, size);
+            v->z = rng_float(&rng, 0.0f, 1.0f);
+            v->w = 1.0f;
+        }
+        colors[i] = 0xFF000000u | (unsigned int)rng_float(&rng, 0.0f, 16777216.0f);
+    }
+    for (size_t i = 0; i < varyings.size(); i++) {
+        varyings[i] = rng_float(&rng, 0.0f, 1.0f);
+    }
+
+    const char* names[] = { "scalar", "sse2", "avx2" };
+    span_fill_fn fills[] = { span_fill_scalar, nullptr, nullptr };
+#ifdef MICRO3D_SSE2
+    fills[1] = span_fill_sse2;
+    if (cpu_has_avx2()) {
+        fills[2] = span_fill_avx2;
+    }
+#endif
+    bool ok = true;
+    unsigned long long reference = 0;
+    for (int p = 0; p < 3; p++) {
+        if (!fills[p]) {
+            fprintf(stderr, "check %-14s skipped (not supported)\n", names[p]);
+            continue;
+        }
+        surface_t surface;
+        surface_init(&surface, width, height, true, -1);
+        device_t* device = &surface.device;
+        for (int i = 0; i < count; i++) {
+            triangle_setup_t ts;
+            if (!triangle_setup(&ts, device, &vertices[(size_t)i * 3], &vertices[(size_t)i * 3 + 1], &vertices[(size_t)i * 3 + 2], colors[i])) {
+                continue;
+            }
+            const edge_t* e = ts.e;
+            triangle_walk(device, &ts, 0, 0, width - 1, height - 1, nullptr, [&](unsigned int* row, float* zrow, int x, int x_end, int y) {
+                fills[p](&ts, row, zrow, x, x_end, edge_eval(&e[0], x, y), edge_eval(&e[1], x, y), edge_eval(&e[2], x, y),
+                         depth_row(&ts, y), nullptr);
+            });
+        }
+        unsigned long long h = surface_hash(&surface);
+        if (p == 0) {
+            reference = h;
+        }
+        ok = ok && h == reference;
+        fprintf(stderr, "check %-14s %016llx%s\n", names[p], h, h == reference ? "" : " MISMATCH");
+        surface_destroy(&surface);
+    }
+
+    for (int msaa = 0; msaa < 2; msaa++) {
+        surface_t surface;
+        surface_init(&surface, width, height, true, -1);
+        device_t* device = &surface.device;
+        if (msaa) {
+            device->msaa = msaa_create(device);
+            clear_depth(device, 1.0f);
+        }
+        shader_gouraud_t gouraud;
+        for (int i = 0; i < count; i++) {
+            const float* a = &varyings[(size_t)i * 9];
+            triangle_shaded(device, &vertices[(size_t)i * 3], &vertices[(size_t)i * 3 + 1], &vertices[(size_t)i * 3 + 2],
+                            a, a + 3, a + 6, gouraud);
+        }
+        msaa_resolve(device);
+        fprintf(stderr, "check %-14s %016llx\n", msaa ? "gouraud_msaa" : "gouraud", surface_hash(&surface));
+        surface_destroy(&surface);
+    }
+    return ok;
+}
+
+// 一致性检查：帧中间清除颜色和深度缓冲。分块模式（以及延迟清除）下清除之前已分箱的三角形必须先画完，
+// 输出与直接绘制逐字节相同。不一致时返回 false
+static bool check_binned_clears(int width, int height)
+{
+    const char* names[] = { "clear_direct", "clear_lazy", "clear_binned", "clear_bin_lazy" };
+    vec4_t full[3] = { { 0, 0, 0.2f, 1 }, { 2.0f * width, 0, 0.2f, 1 }, { 0, 2.0f * height, 0.2f, 1 } };
+    vec4_t half[3] = { { 0, 0, 0.5f, 1 }, { (float)width, 0, 0.5f, 1 }, { 0, (float)height, 0.5f, 1 } };
+    bool ok = true;
+    unsigned long long reference = 0;
+    for (int mode = 0; mode < 4; mode++) {
+        surface_t surface;
+        surface_init(&surface, width, height, true, mode >= 2 ? 2 : -1);
+        device_t* device = &surface.device;
+        if (mode & 1) {
+            device->lazy_clear = lazy_clear_create(device, 64);
+        }
+        clear_color(device, 0xFF000000);
+        clear_depth(device, 1.0f);
+        // 全屏的红色三角形被清除掉；清除深度后更远的蓝色三角形才能通过深度测试
+        triangle(device, &full[0], &full[1], &full[2], 0xFFFF0000);
+        clear_color(device, 0xFF00FF00);
+        clear_depth(device, 1.0f);
+        triangle(device, &half[0], &half[1], &half[2], 0xFF0000FF);
+        binner_flush(device);
+        lazy_clear_resolve(device, true);
+        unsigned long long h = surface_hash(&surface);
+        if (mode == 0) {
+            reference = h;
+            ok = ok && surface.buffer[surface.buffer.size() - 1] == 0xFF00FF00 && surface.buffer[0] == 0xFF0000FF;
+        }
+        ok = ok && h == reference;
+        fprintf(stderr, "check %-14s %016llx%s\n", names[mode], h, h == reference ? "" : " MISMATCH");
+        surface_destroy(&surface);
+    }
+    return ok;
+}
+
+static void print_json(const bench_context_t* ctx, FILE* out)
+{
+    fprintf(out, "{\n  \"suite\": \"micro3d\",\n");
+    fprintf(out, "  \"config\": {\"simd\": \"%s\", \"hardware_threads\": %u, \"min_time_s\": %g, \"min_samples\": %d},\n",
+            simd_path(), std::thread::hardware_concurrency(), ctx->min_time, ctx->min_samples);
+    fprintf(out, "  \"benchmarks\": [\n");
+    for (size_t i = 0; i < ctx->results.size(); i++) {
+        const bench_result_t* r = &ctx->results[i];
+        double s = r->ns_per_run * 1e-9;
+        fprintf(out, "    {\"name\": \"%s\", \"width\": %d, \"height\": %d, \"samples\": %d, \"ns_per_run\": %.1f",
+                r->name.c_str(), r->width, r->height, r->samples, r->ns_per_run);
+        if (r->work.ops > 0) fprintf(out, ", \"ns_per_op\": %.3f", r->ns_per_run / r->work.ops);
+        if (r->work.pixels > 0) fprintf(out, ", \"ns_per_pixel\": %.4f", r->ns_per_run / r->work.pixels);
+        if (r->work.triangles > 0) fprintf(out, ", \"triangles_per_s\": %.0f", r->work.triangles / s);
+        if (r->work.frames > 0) fprintf(out, ", \"frames_per_s\": %.2f", r->work.frames / s);
+        fprintf(out, "}%s\n", i + 1 < ctx->results.size() ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+
+static void print_csv(const bench_context_t* ctx, FILE* out)
+{
+    fprintf(out, "name,width,height,samples,ns_per_run,ns_per_op,ns_per_pixel,triangles_per_s,frames_per_s\n");
+    for (size_t i = 0; i < ctx->results.size(); i++) {
+        const bench_result_t* r = &ctx->results[i];
+        double s = r->ns_per_run * 1e-9;
+        fprintf(out, "%s,%d,%d,%d,%.1f,", r->name.c_str(), r->width, r->height, r->samples, r->ns_per_run);
+        if (r->work.ops > 0) fprintf(out, "%.3f", r->ns_per_run / r->work.ops);
+        fprintf(out, ",");
+        if (r->work.pixels > 0) fprintf(out, "%.4f", r->ns_per_run / r->work.pixels);
+        fprintf(out, ",");
+        if (r->work.triangles > 0) fprintf(out, "%.0f", r->work.triangles / s);
+        fprintf(out, ",");
+        if (r->work.frames > 0) fprintf(out, "%.2f", r->work.frames / s);
+        fprintf(out, "\n");
+    }
+}
+
+static void usage()
+{
+    fprintf(stderr,
+            "usage: micro3d_bench [options]\n"
+            "  --filter TEXT     only run benchmarks whose name contains TEXT\n"
+            "  --min-time S      minimum measured time per benchmark in seconds (default 0.2)\n"
+            "  --min-samples N   minimum number of samples per benchmark (default 5)\n"
+            "  --format FMT      json or csv (default json)\n"
+            "  -o, --output PATH write results to PATH instead of stdout\n"
+            "  --check           render random triangles with every span path, print output hashes\n"
+            "                    and exit with status 1 if the paths disagree\n"
+            "Progress is printed to stderr.\n");
+}
+
+int main(int argc, char** argv)
+{
+    bench_context_t ctx;
+    ctx.filter = nullptr;
+    ctx.min_time = 0.2;
+    ctx.min_samples = 5;
+    bool csv = false;
+    const char* output = nullptr;
+
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (strcmp(arg, "--help") == 0) {
+            usage();
+            return 0;
+        }
+        if (strcmp(arg, "--check") == 0) {
+            bool ok = check_span_paths(2000, 512, 512);
+            ok = check_binned_clears(512, 512) && ok;
+            return ok ? 0 : 1;
+        }
+        if (!value) {
+            usage();
+            return 1;
+        }
+        if (strcmp(arg, "--filter") == 0) {
+            ctx.filter = value;
+        } else if (strcmp(arg, "--min-time") == 0) {
+            ctx.min_time = atof(value);
+        } else if (strcmp(arg, "--min-samples") == 0) {
+            ctx.min_samples = std::max(1, atoi(value));
+        } else if (strcmp(arg, "--format") == 0 && (strcmp(value, "json") == 0 || strcmp(value, "csv") == 0)) {
+            csv = strcmp(value, "csv") == 0;
+        } else if (strcmp(arg, "-o") == 0 || strcmp(arg, "--output") == 0) {
+            output = value;
+        } else {
+            usage();
+            return 1;
+        }
+        i++;
+    }
+
+    static const int resolutions[][2] = { { 320, 240 }, { 800, 600 }, { 1920, 1080 } };
+    const int width = 800, height = 600;
+
+    // 向量与矩阵
+    bench_math(&ctx);
+
+    // 清屏与完整帧
+    for (const auto& res : resolutions) {
+        bench_clear(&ctx, res[0], res[1]);
+        bench_render3d(&ctx, res[0], res[1], RENDER_SOLID, -1, false);
+        bench_render3d(&ctx, res[0], res[1], RENDER_SOLID, -1, true);
+        bench_render3d(&ctx, res[0], res[1], RENDER_WIREFRAME, -1, false);
+        bench_render3d(&ctx, res[0], res[1], RENDER_WIREFRAME, -1, true);
+        bench_render3d(&ctx, res[0], res[1], RENDER_GOURAUD, -1, false);
+        bench_render3d(&ctx, res[0], res[1], RENDER_TEXTURED, -1, false);
+        bench_render3d(&ctx, res[0], res[1], RENDER_TRANSLUCENT, -1, false);
+        bench_render3d(&ctx, res[0], res[1], RENDER_SOLID, 0, false);
+        bench_render3d(&ctx, res[0], res[1], RENDER_GOURAUD, 0, false);
+        bench_render3d_dirty(&ctx, res[0], res[1]);
+    }
+    bench_clear(&ctx, 3840, 2160);
+
+    // 线段
+    bench_lines(&ctx, "line_short", 10000, 8.0f, width, height, false);
+    bench_lines(&ctx, "line_long", 1000, 600.0f, width, height, false);
+    bench_lines(&ctx, "line_offscreen", 1000, 20000.0f, width, height, true);
+
+    // 三角形：极小、小、细长、全屏，分别测试无深度、深度测试和分块光栅化
+    triangle_set_t tiny = make_triangles(100000, 1.5f, width, height, 1);
+    triangle_set_t small = make_triangles(10000, 24.0f, width, height, 2);
+    triangle_set_t sliver = make_slivers(5000, width, height, 3);
+    bench_triangle_set(&ctx, "triangle_tiny", &tiny, width, height, false, -1);
+    bench_triangle_set(&ctx, "triangle_small", &small, width, height, false, -1);
+    bench_triangle_set(&ctx, "triangle_sliver", &sliver, width, height, false, -1);
+    bench_triangle_set(&ctx, "triangle_small_depth", &small, width, height, true, -1);
+    bench_triangle_set(&ctx, "triangle_small_binned", &small, width, height, false, 0);
+    for (const auto& res : resolutions) {
+        triangle_set_t huge = make_fullscreen(4, res[0], res[1]);
+        bench_triangle_set(&ctx, resolution_name("triangle_huge", res[0], res[1]).c_str(), &huge, res[0], res[1], false, -1);
+        bench_triangle_set(&ctx, resolution_name("triangle_huge_depth", res[0], res[1]).c_str(), &huge, res[0], res[1], true, -1);
+        bench_triangle_set(&ctx, resolution_name("triangle_huge_binned", res[0], res[1]).c_str(), &huge, res[0], res[1], false, 0);
+    }
+    bench_wireframe(&ctx, "triangle_wireframe", &small, width, height);
+    bench_mesh_wireframe(&ctx, 128, width, height, false);
+    bench_mesh_wireframe(&ctx, 128, width, height, true);
+
+    // 着色三角形：模板化逐像素着色（无属性）、Gouraud 插值
+    shader_checker_t checker;
+    shader_gouraud_t gouraud;
+    bench_triangle_shaded(&ctx, "triangle_small_checker", &small, width, height, false, -1, checker);
+    bench_triangle_shaded(&ctx, "triangle_small_gouraud", &small, width, height, false, -1, gouraud);
+    bench_triangle_shaded(&ctx, "triangle_small_gouraud_depth", &small, width, height, true, -1, gouraud);
+    bench_triangle_shaded(&ctx, "triangle_small_gouraud_binned", &small, width, height, false, 0, gouraud);
+    for (const auto& res : resolutions) {
+        triangle_set_t huge = make_fullscreen(4, res[0], res[1]);
+        bench_triangle_shaded(&ctx, resolution_name("triangle_huge_gouraud", res[0], res[1]).c_str(), &huge, res[0], res[1], false, -1, gouraud);
+    }
+
+    // 纹理：1024x1024（4 MB，超出 L2）的旋转平面，比较滤波方式、Z 序与逐行布局、SIMD 与逐像素采样
+    texture_t* morton = texture_create_checker(1024, 16, TEXTURE_MORTON);
+    texture_t* linear = texture_create_checker(1024, 16, TEXTURE_LINEAR);
+    shader_texture_t textured = { morton, TEXTURE_BILINEAR };
+    shader_texture_t textured_linear = { linear, TEXTURE_BILINEAR };
+    shader_texture_t nearest = { morton, TEXTURE_NEAREST };
+    shader_texture_t trilinear = { morton, TEXTURE_TRILINEAR };
+    shader_texture_t trilinear_linear = { linear, TEXTURE_TRILINEAR };
+    shader_texture_scalar_t textured_scalar = { textured };
+    bench_textured(&ctx, "texture_rotated_nearest", morton, 1.0f, width, height, -1, nearest);
+    bench_textured(&ctx, "texture_rotated_bilinear", morton, 1.0f, width, height, -1, textured);
+    bench_textured(&ctx, "texture_rotated_bilinear_linear", linear, 1.0f, width, height, -1, textured_linear);
+    bench_textured(&ctx, "texture_rotated_bilinear_scalar", morton, 1.0f, width, height, -1, textured_scalar);
+    bench_textured(&ctx, "texture_rotated_bilinear_binned", morton, 1.0f, width, height, 0, textured);
+    bench_textured(&ctx, "texture_rotated_trilinear", morton, 1.0f, width, height, -1, trilinear);
+    bench_textured(&ctx, "texture_minified_trilinear", morton, 4.0f, width, height, -1, trilinear);
+    bench_textured(&ctx, "texture_minified_trilinear_linear", linear, 4.0f, width, height, -1, trilinear_linear);
+    texture_destroy(morton);
+    texture_destroy(linear);
+
+    // 多立方体场景
+    for (const auto& res : resolutions) {
+        bench_cubes(&ctx, 10, res[0], res[1], -1, CULL_NONE);
+        bench_cubes(&ctx, 10, res[0], res[1], -1, CULL_CW);
+    }
+    bench_cubes(&ctx, 10, width, height, 0, CULL_NONE);
+    bench_cubes(&ctx, 10, width, height, 0, CULL_CW);
+
+    // 抗锯齿：无、4x MSAA、2x2 超采样
+    bench_cubes_aa(&ctx, 10, width, height, -1, false, AA_NONE);
+    bench_cubes_aa(&ctx, 10, width, height, -1, false, AA_MSAA);
+    bench_cubes_aa(&ctx, 10, width, height, -1, false, AA_SUPERSAMPLE);
+    bench_cubes_aa(&ctx, 10, width, height, 0, false, AA_MSAA);
+    bench_cubes_aa(&ctx, 10, width, height, -1, true, AA_NONE);
+    bench_cubes_aa(&ctx, 10, width, height, -1, true, AA_MSAA);
+    bench_cubes_aa(&ctx, 10, width, height, -1, true, AA_SUPERSAMPLE);
+
+    // 颜色混合：SIMD 与逐像素的图层合成，半透明立方体由远到近排序后合成
+    for (int mode = BLEND_OVER; mode <= BLEND_MULTIPLY; mode++) {
+        bench_blend(&ctx, width, height, (blend_mode_t)mode, false);
+        bench_blend(&ctx, width, height, (blend_mode_t)mode, true);
+    }
+    bench_blend(&ctx, 1920, 1080, BLEND_OVER, false);
+    bench_cubes_translucent(&ctx, 10, width, height, -1);
+    bench_cubes_translucent(&ctx, 10, width, height, 0);
+
+    // 实例化：同一场景一次提交，以及约 1 万个立方体
+    bench_cubes_instanced(&ctx, 10, width, height, -1, false);
+    bench_cubes_instanced(&ctx, 10, width, height, -1, true);
+    bench_cubes_instanced(&ctx, 10, width, height, 0, false);
+    bench_cubes(&ctx, 22, width, height, -1, CULL_NONE);
+    bench_cubes_instanced(&ctx, 22, width, height, -1, false);
+
+    // 场景：BVH 视锥剔除（100 万个实例）、移动后重新计算包围盒，以及与逐个绘制的对比
+    bench_scene_cull(&ctx, 1000, width, height);
+    bench_scene_refit(&ctx, 1000, width, height);
+    bench_scene_draw(&ctx, 316, width, height, false);
+    bench_scene_draw(&ctx, 316, width, height, true);
+
+    // 脏矩形：每帧移动一个实例，只重绘变化的区域与整帧重绘对比
+    bench_scene_moving(&ctx, 316, width, height, false);
+    bench_scene_moving(&ctx, 316, width, height, true);
+
+    // 命令缓冲：由远到近提交，排序前后对比
+    bench_cubes_commands(&ctx, 10, width, height, -1, false);
+    bench_cubes_commands(&ctx, 10, width, height, -1, true);
+    bench_cubes_commands(&ctx, 10, width, height, 0, false);
+    bench_cubes_commands(&ctx, 10, width, height, 0, true);
+
+    FILE* out = output ? fopen(output, "w") : stdout;
+    if (!out) {
+        fprintf(stderr, "cannot open %s\n", output);
+        return 1;
+    }
+    if (csv) {
+        print_csv(&ctx, out);
+    } else {
+        print_json(&ctx, out);
+    }
+    if (output) {
+        fclose(out);
+    }
+    return 0;
+}
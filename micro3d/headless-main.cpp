@@ -0,0 +1,313 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#if defined(_WIN32)
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <csignal>
+#endif
+
+#include "../micro3d.h"
+#include "../micro3d_image.h"
+
+// 无窗口渲染：在内存中分配 device_t 的缓冲区，调用 render3d，把帧写成图像文件或原始像素流。
+// 多个 device_t 组成帧流水线：渲染线程绘制后面的帧时，主线程同时写出已完成的帧。
+// 脏矩形模式下只重绘变化的区域，增量流（-f dirty）只写出变化的矩形
+
+// 摄像机 Z 轴位置（越接近 0 越靠近物体）
+float g_cameraZ = -1.5f;
+
+// 在流水线的渲染线程上绘制一帧：params 为提交时的相机位置，user 为绘制方式
+static void render_frame(device_t* device, const void* params, void* user)
+{
+    render3d(device, *(const render_mode_t*)user, *(const float*)params);
+}
+
+// 输出文件名模式只允许恰好一个 %d 或 %0Nd（N 最多两位），以及表示 % 本身的 %%；
+// 其他转换说明会让 snprintf 读取不存在的参数，拒绝
+static bool output_pattern_valid(const char* pattern)
+{
+    int conversions = 0;
+    for (const char* p = pattern; *p; p++) {
+        if (*p != '%') {
+            continue;
+        }
+        p++;
+        if (*p == '%') {
+            continue;
+        }
+        if (*p == '0') {
+            p++;
+            int digits = 0;
+            while (*p >= '0' && *p <= '9' && digits < 2) {
+                p++;
+                digits++;
+            }
+            if (digits == 0) {
+                return false;
+            }
+        }
+        if (*p != 'd') {
+            return false;
+        }
+        conversions++;
+    }
+    return conversions == 1;
+}
+
+static void usage()
+{
+    fprintf(stderr,
+            "usage: micro3d_headless [options]\n"
+            "  -W, --width N          frame width (default 800)\n"
+            "  -H, --height N         frame height (default 600)\n"
+            "  -n, --frames N         number of frames to render (default 1)\n"
+            "  -z, --camera-z Z       camera z position (default -1.5)\n"
+            "  -t, --threads N        rasterize with the tile binner on N threads (0: hardware concurrency)\n"
+            "  -p, --pipeline N       frame buffers in flight; frames render while earlier ones are written\n"
+            "                         (default 2, 1 renders and writes in turn)\n"
+            "  -m, --mode MODE        solid, wireframe, gouraud, textured or translucent (default solid)\n"
+            "      --wireframe        same as --mode wireframe\n"
+            "      --no-depth         disable the depth buffer\n"
+            "      --lazy-clear       clear 64x64 tiles only when first drawn to\n"
+            "      --msaa             4x multisample anti-aliasing\n"
+            "      --cull MODE        cull none, cw or ccw triangles in screen space (default none)\n"
+            "      --dirty            redraw only the regions that changed since a buffer was last drawn\n"
+            "  -o, --output PATH      .ppm or .png file; a pattern with one %%d or %%0Nd (e.g. frame%%04d.png)\n"
+            "                         writes one file per frame; '-' streams frames to stdout (default out.ppm)\n"
+            "  -f, --format FMT       stream format for '-o -': raw (bgra pixels), ppm, or dirty (per frame:\n"
+            "                         'M3DR', width, height, rect count, x/y/w/h per rect as little-endian\n"
+            "                         uint32, then the bgra rows of each changed rect) (default raw)\n"
+            "      --stats PATH       write counters and per-stage timings as JSON\n"
+            "      --trace PATH       write a Chrome trace (chrome://tracing, Perfetto)\n");
+}
+
+int main(int argc, char** argv)
+{
+    int width = 800;
+    int height = 600;
+    int frames = 1;
+    int threads = -1;
+    int pipeline_depth = 2;
+    render_mode_t mode = RENDER_SOLID;
+    bool depth = true;
+    bool lazy_clear = false;
+    bool msaa = false;
+    bool dirty = false;
+    cull_mode_t cull_mode = CULL_NONE;
+    const char* output = "out.ppm";
+    image_format_t stream_format = IMAGE_RAW;
+    const char* stats_path = nullptr;
+    const char* trace_path = nullptr;
+
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        bool has_value = true;
+        if (strcmp(arg, "-W") == 0 || strcmp(arg, "--width") == 0) {
+            if (value) width = atoi(value);
+        } else if (strcmp(arg, "-H") == 0 || strcmp(arg, "--height") == 0) {
+            if (value) height = atoi(value);
+        } else if (strcmp(arg, "-n") == 0 || strcmp(arg, "--frames") == 0) {
+            if (value) frames = atoi(value);
+        } else if (strcmp(arg, "-z") == 0 || strcmp(arg, "--camera-z") == 0) {
+            if (value) g_cameraZ = (float)atof(value);
+        } else if (strcmp(arg, "-t") == 0 || strcmp(arg, "--threads") == 0) {
+            if (value) threads = atoi(value);
+        } else if (strcmp(arg, "-p") == 0 || strcmp(arg, "--pipeline") == 0) {
+            if (value) pipeline_depth = atoi(value);
+        } else if (strcmp(arg, "-o") == 0 || strcmp(arg, "--output") == 0) {
+            if (value) output = value;
+        } else if (strcmp(arg, "--stats") == 0) {
+            stats_path = value;
+        } else if (strcmp(arg, "--trace") == 0) {
+            trace_path = value;
+        } else if (strcmp(arg, "-m") == 0 || strcmp(arg, "--mode") == 0) {
+            if (value && strcmp(value, "solid") == 0) {
+                mode = RENDER_SOLID;
+            } else if (value && strcmp(value, "wireframe") == 0) {
+                mode = RENDER_WIREFRAME;
+            } else if (value && strcmp(value, "gouraud") == 0) {
+                mode = RENDER_GOURAUD;
+            } else if (value && strcmp(value, "textured") == 0) {
+                mode = RENDER_TEXTURED;
+            } else if (value && strcmp(value, "translucent") == 0) {
+                mode = RENDER_TRANSLUCENT;
+            } else {
+                value = nullptr;
+            }
+        } else if (strcmp(arg, "--cull") == 0) {
+            if (value && strcmp(value, "none") == 0) {
+                cull_mode = CULL_NONE;
+            } else if (value && strcmp(value, "cw") == 0) {
+                cull_mode = CULL_CW;
+            } else if (value && strcmp(value, "ccw") == 0) {
+                cull_mode = CULL_CCW;
+            } else {
+                value = nullptr;
+            }
+        } else if (strcmp(arg, "-f") == 0 || strcmp(arg, "--format") == 0) {
+            if (value && strcmp(value, "raw") == 0) {
+                stream_format = IMAGE_RAW;
+            } else if (value && strcmp(value, "ppm") == 0) {
+                stream_format = IMAGE_PPM;
+            } else if (value && strcmp(value, "dirty") == 0) {
+                stream_format = IMAGE_DIRTY;
+            } else {
+                value = nullptr;
+            }
+        } else {
+            has_value = false;
+            if (strcmp(arg, "--wireframe") == 0) {
+                mode = RENDER_WIREFRAME;
+            } else if (strcmp(arg, "--no-depth") == 0) {
+                depth = false;
+            } else if (strcmp(arg, "--lazy-clear") == 0) {
+                lazy_clear = true;
+            } else if (strcmp(arg, "--msaa") == 0) {
+                msaa = true;
+            } else if (strcmp(arg, "--dirty") == 0) {
+                dirty = true;
+            } else {
+                usage();
+                return strcmp(arg, "--help") == 0 ? 0 : 1;
+            }
+        }
+        if (has_value) {
+            if (!value) {
+                usage();
+                return 1;
+            }
+            i++;
+        }
+    }
+    if (width <= 0 || height <= 0 || frames < 0 || pipeline_depth <= 0) {
+        usage();
+        return 1;
+    }
+    bool stream = strcmp(output, "-") == 0;
+    bool sequence = !stream && strchr(output, '%') != nullptr;
+    if (sequence && !output_pattern_valid(output)) {
+        fprintf(stderr, "invalid output pattern %s: use exactly one %%d or %%0Nd, and %%%% for a literal %%\n", output);
+        return 1;
+    }
+
+    // 每个流水线 device 的帧缓冲和深度缓冲只分配一次，所有帧复用；帧在同一个渲染线程上依次绘制，共用 binner 和统计
+    std::vector<std::vector<unsigned int> > buffers(pipeline_depth);
+    std::vector<std::vector<float> > zbuffers(pipeline_depth);
+    std::vector<device_t> devices(pipeline_depth);
+    std::vector<device_t*> device_list;
+    binner_t* binner = nullptr;
+    stats_t* stats = nullptr;
+    if (stats_path || trace_path) {
+        stats = stats_create(trace_path != nullptr);
+    }
+    for (int i = 0; i < pipeline_depth; i++) {
+        device_t& device = devices[i];
+        buffers[i].resize((size_t)width * height);
+        device = device_t();
+        device.width = width;
+        device.height = height;
+        device.buffer = buffers[i].data();
+        device.cull_mode = cull_mode;
+        if (depth) {
+            zbuffers[i].resize((size_t)width * height);
+            device.zbuffer = zbuffers[i].data();
+            device.hiz = hiz_create(&device);
+        }
+        if (lazy_clear) {
+            device.lazy_clear = lazy_clear_create(&device, 64);
+        }
+        if (msaa) {
+            device.msaa = msaa_create(&device);
+        }
+        if (threads >= 0 && !binner) {
+            binner = binner_create(&device, 64, threads);
+        }
+        device.binner = binner;
+        device.stats = stats;
+        device_list.push_back(&device);
+    }
+    // 脏矩形的变化历史由所有流水线 device 共用
+    dirty_t* dirty_tracker = dirty ? dirty_create(device_list.data(), pipeline_depth) : nullptr;
+    for (int i = 0; i < pipeline_depth; i++) {
+        devices[i].dirty = dirty_tracker;
+    }
+    frame_pipeline_t* pipeline = frame_pipeline_create(device_list.data(), pipeline_depth, render_frame, &mode);
+
+    FILE* out = nullptr;
+    if (stream) {
+#if defined(_WIN32)
+        _setmode(_fileno(stdout), _O_BINARY);
+#else
+        // 管道另一端的编码器退出时让 fwrite 返回错误，而不是被 SIGPIPE 终止
+        signal(SIGPIPE, SIG_IGN);
+#endif
+        out = stdout;
+        fprintf(stderr, "streaming %d frames: %dx%d %s\n", frames, width, height,
+                stream_format == IMAGE_RAW ? "bgra" : stream_format == IMAGE_DIRTY ? "dirty" : "ppm");
+    }
+
+    image_writer_t writer;
+    image_writer_init(&writer);
+    std::vector<char> path(strlen(output) + 32);
+    int status = 0;
+    int submitted = 0;
+    for (int frame = 0; frame < frames; frame++) {
+        // 让所有空闲的 device 都在渲染或排队；写出比渲染慢时这里不会阻塞，由空闲 device 的数量限制排队的帧数
+        while (submitted < frames && submitted < frame + pipeline_depth) {
+            frame_pipeline_submit(pipeline, &g_cameraZ, sizeof(g_cameraZ), true);
+            submitted++;
+        }
+        int slot = frame_pipeline_acquire(pipeline, true);
+        const device_t* device = &devices[slot];
+
+        bool ok;
+        if (stream) {
+            ok = image_write(&writer, out, device, stream_format);
+        } else if (sequence) {
+            snprintf(path.data(), path.size(), output, frame);
+            ok = image_save(&writer, path.data(), device);
+        } else if (frame == frames - 1) {
+            ok = image_save(&writer, output, device);
+        } else {
+            ok = true;
+        }
+        frame_pipeline_release(pipeline, slot);
+        if (!ok) {
+            fprintf(stderr, "failed to write frame %d to %s\n", frame, stream ? "stdout" : output);
+            status = 1;
+            break;
+        }
+    }
+    // 等待正在绘制的帧完成，之后的统计只由主线程读取
+    frame_pipeline_destroy(pipeline);
+    if (stream && fflush(out) != 0) {
+        status = 1;
+    }
+
+    if (stats) {
+        FILE* file;
+        if (stats_path && (file = fopen(stats_path, "w")) != nullptr) {
+            stats_write_json(stats, &devices[0], file);
+            fclose(file);
+        }
+        if (trace_path && (file = fopen(trace_path, "w")) != nullptr) {
+            stats_write_trace(stats, file);
+            fclose(file);
+        }
+    }
+
+    binner_destroy(binner);
+    dirty_destroy(dirty_tracker);
+    for (int i = 0; i < pipeline_depth; i++) {
+        hiz_destroy(devices[i].hiz);
+        lazy_clear_destroy(devices[i].lazy_clear);
+        msaa_destroy(devices[i].msaa);
+    }
+    stats_destroy(stats);
+    return status;
+}
\ No newline at end of file
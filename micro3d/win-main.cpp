@@ -1,34 +1,48 @@
 #include <Windows.h>
 #include <chrono>
-#include <cmath>
 
 #include "../micro3d.h"
 
 // 声明窗口过程函数
 LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam);
 
-// 渲染函数
-void Render();
-
-// 自定义绘制函数
-void DrawPixel(int x, int y, COLORREF color);
-void DrawLine(int x1, int y1, int x2, int y2, COLORREF color);
-void ClearScreen(COLORREF color);
-
 // 全局变量
 int g_windowWidth = 800;
 int g_windowHeight = 600;
-bool g_wireframeMode = true;
+render_mode_t g_renderMode = RENDER_WIREFRAME;
 // 摄像机 Z 轴位置（越接近 0 越靠近物体）
 float g_cameraZ = -1.5f;
 
 // DIB相关变量
-HBITMAP g_hBitmap = nullptr;
-void* g_pixels = nullptr;
-HDC g_memDC = nullptr;
 BITMAPINFO g_bmi = {};
 
-device_t g_device;
+// 帧流水线：每个缓冲一个 DIB Section 和 device_t，渲染线程绘制下一帧时主线程把上一帧 BitBlt 到窗口。
+// 脏矩形：渲染线程只重绘变化的区域，主线程也只把变化的矩形 BitBlt 到窗口
+const int FRAME_COUNT = 2;
+
+struct FrameBuffer {
+    HBITMAP bitmap;
+    HDC memDC;
+    device_t device;
+};
+
+FrameBuffer g_frames[FRAME_COUNT] = {};
+frame_pipeline_t* g_pipeline = nullptr;
+dirty_t* g_dirty = nullptr;
+bool g_presentFull = true; // 窗口内容需要整个重画（首次显示、被遮挡后露出），只在主线程上读写
+
+// 提交给渲染线程的参数：按键随时会修改全局状态，每帧提交时取快照
+struct FrameParams {
+    render_mode_t mode;
+    float cameraZ;
+};
+
+// 在渲染线程上绘制一帧
+void RenderFrame(device_t* device, const void* params, void*)
+{
+    const FrameParams* frame = (const FrameParams*)params;
+    render3d(device, frame->mode, frame->cameraZ);
+}
 
 int WINAPI WinMain(
     HINSTANCE hInstance,
@@ -80,15 +94,34 @@ int WINAPI WinMain(
     g_bmi.bmiHeader.biCompression = BI_RGB;
     g_bmi.bmiHeader.biSizeImage = 0;
 
-	g_device.width = g_windowWidth;
-	g_device.height = g_windowHeight;
-
-    // 创建DIB Section
-    g_hBitmap = CreateDIBSection(hdc, &g_bmi, DIB_RGB_COLORS, (void**)(&g_device.buffer), NULL, 0);
-    
-    // 创建内存DC
-    g_memDC = CreateCompatibleDC(hdc);
-    SelectObject(g_memDC, g_hBitmap);
+    device_t* devices[FRAME_COUNT];
+    for (int i = 0; i < FRAME_COUNT; i++)
+    {
+        FrameBuffer* frame = &g_frames[i];
+        frame->device.width = g_windowWidth;
+        frame->device.height = g_windowHeight;
+
+        // 创建DIB Section
+        frame->bitmap = CreateDIBSection(hdc, &g_bmi, DIB_RGB_COLORS, (void**)(&frame->device.buffer), NULL, 0);
+
+        // 深度缓冲
+        frame->device.zbuffer = new float[g_windowWidth * g_windowHeight];
+        frame->device.hiz = hiz_create(&frame->device);
+        // 大部分 tile 为空，延迟清除只清除被绘制到的 tile
+        frame->device.lazy_clear = lazy_clear_create(&frame->device, 64);
+
+        // 创建内存DC
+        frame->memDC = CreateCompatibleDC(hdc);
+        SelectObject(frame->memDC, frame->bitmap);
+        devices[i] = &frame->device;
+    }
+    // 两个缓冲轮流绘制，共用一份变化历史
+    g_dirty = dirty_create(devices, FRAME_COUNT);
+    for (int i = 0; i < FRAME_COUNT; i++)
+    {
+        g_frames[i].device.dirty = g_dirty;
+    }
+    g_pipeline = frame_pipeline_create(devices, FRAME_COUNT, RenderFrame, nullptr);
     
     ReleaseDC(hwnd, hdc);
 
@@ -111,154 +144,57 @@ int WINAPI WinMain(
         }
         else
         {
-            auto currentTime = std::chrono::high_resolution_clock::now();
-            auto deltaTime = std::chrono::duration_cast<std::chrono::milliseconds>(currentTime - lastTime).count();
-
-            if (deltaTime > 16) // ~60 FPS
+            // 有绘制完成的帧就更新到屏幕：每帧都按顺序呈现，窗口上是上一帧，只需复制相对上一帧变化的矩形
+            int slot = frame_pipeline_acquire(g_pipeline, false);
+            if (slot >= 0)
             {
-                lastTime = currentTime;
-
-                // 清屏
-                //ClearScreen(RGB(240, 240, 240));
-
-                // 自定义渲染
-                //Render();
-				render3d(&g_device, g_wireframeMode);
-
-                // 更新到屏幕
                 HDC hdc = GetDC(hwnd);
-                BitBlt(hdc, 0, 0, g_windowWidth, g_windowHeight, g_memDC, 0, 0, SRCCOPY);
+                const std::vector<rect_t>* changed = dirty_changed(&g_frames[slot].device);
+                if (g_presentFull || !changed)
+                {
+                    BitBlt(hdc, 0, 0, g_windowWidth, g_windowHeight, g_frames[slot].memDC, 0, 0, SRCCOPY);
+                    g_presentFull = false;
+                }
+                else
+                {
+                    for (size_t i = 0; i < changed->size(); i++)
+                    {
+                        const rect_t& r = (*changed)[i];
+                        BitBlt(hdc, r.x0, r.y0, r.x1 - r.x0 + 1, r.y1 - r.y0 + 1, g_frames[slot].memDC, r.x0, r.y0, SRCCOPY);
+                    }
+                }
                 ReleaseDC(hwnd, hdc);
+                frame_pipeline_release(g_pipeline, slot);
             }
-        }
-    }
-
-    // 清理资源
-    if (g_memDC) DeleteDC(g_memDC);
-    if (g_hBitmap) DeleteObject(g_hBitmap);
-
-    return (int)msg.wParam;
-}
-
-// 绘制像素函数
-void DrawPixel(int x, int y, COLORREF color)
-{
-    if (x < 0 || x >= g_windowWidth || y < 0 || y >= g_windowHeight)
-        return;
 
-    // 计算像素位置（32位，每个像素4字节）
-    int offset = y * g_windowWidth + x;
-    BYTE* pixel = (BYTE*)g_pixels + offset * 4;
-    
-    // 设置颜色（BGR格式）
-    pixel[0] = GetBValue(color); // Blue
-    pixel[1] = GetGValue(color); // Green
-    pixel[2] = GetRValue(color); // Red
-    pixel[3] = 0;               // Alpha (未使用)
-}
-
-// 绘制线函数（Bresenham算法）
-void DrawLine(int x1, int y1, int x2, int y2, COLORREF color)
-{
-    int dx = abs(x2 - x1);
-    int dy = abs(y2 - y1);
-    int sx = (x1 < x2) ? 1 : -1;
-    int sy = (y1 < y2) ? 1 : -1;
-    int err = dx - dy;
+            auto currentTime = std::chrono::high_resolution_clock::now();
+            auto deltaTime = std::chrono::duration_cast<std::chrono::milliseconds>(currentTime - lastTime).count();
 
-    while (true)
-    {
-        // 绘制线宽为3的线
-        for (int i = -1; i <= 1; i++)
-        {
-            for (int j = -1; j <= 1; j++)
+            if (deltaTime > 16) // ~60 FPS
             {
-                DrawPixel(x1 + i, y1 + j, color);
-            }
-        }
-
-        if (x1 == x2 && y1 == y2)
-            break;
+                lastTime = currentTime;
 
-        int e2 = 2 * err;
-        if (e2 > -dy)
-        {
-            err -= dy;
-            x1 += sx;
-        }
-        if (e2 < dx)
-        {
-            err += dx;
-            y1 += sy;
+                // 提交下一帧，由渲染线程绘制；缓冲都在使用中（绘制慢于 60 FPS）时跳过这一帧，不堆积延迟
+                FrameParams params = { g_renderMode, g_cameraZ };
+                frame_pipeline_submit(g_pipeline, &params, sizeof(params), false);
+            }
         }
     }
-}
-
-// 清屏函数
-void ClearScreen(COLORREF color)
-{
-    BYTE r = GetRValue(color);
-    BYTE g = GetGValue(color);
-    BYTE b = GetBValue(color);
 
-    // 直接操作整个像素缓冲区
-    BYTE* pixel = (BYTE*)g_pixels;
-    int totalPixels = g_windowWidth * g_windowHeight;
-
-    for (int i = 0; i < totalPixels; i++)
+    // 清理资源：先等渲染线程退出
+    frame_pipeline_destroy(g_pipeline);
+    dirty_destroy(g_dirty);
+    for (int i = 0; i < FRAME_COUNT; i++)
     {
-        pixel[0] = b; // Blue
-        pixel[1] = g; // Green
-        pixel[2] = r; // Red
-        pixel[3] = 0; // Alpha
-        
-        pixel += 4;
+        FrameBuffer* frame = &g_frames[i];
+        if (frame->memDC) DeleteDC(frame->memDC);
+        if (frame->bitmap) DeleteObject(frame->bitmap);
+        hiz_destroy(frame->device.hiz);
+        lazy_clear_destroy(frame->device.lazy_clear);
+        delete[] frame->device.zbuffer;
     }
-}
-
-// 自定义渲染函数
-void Render()
-{
-    static int frameCount = 0;
-    frameCount++;
 
-    // 1. 绘制一个红色的点（会动）
-    int pointX = 100 + 50 * sin(frameCount * 0.05f);
-    int pointY = 100 + 50 * cos(frameCount * 0.05f);
-    
-    // 绘制大一点的点
-    for (int i = -3; i <= 3; i++)
-    {
-        for (int j = -3; j <= 3; j++)
-        {
-            DrawPixel(pointX + i, pointY + j, RGB(255, 0, 0));
-        }
-    }
-
-    // 2. 绘制一条蓝色的线（也会动）
-    int startX = 200;
-    int startY = 150;
-    int endX = 400 + 50 * sin(frameCount * 0.03f);
-    int endY = 300 + 50 * cos(frameCount * 0.03f);
-    
-    DrawLine(startX, startY, endX, endY, RGB(0, 0, 255));
-
-    // 3. 绘制一些文字信息（使用GDI，因为文字渲染用DIB比较麻烦）
-    HFONT hFont = CreateFont(16, 0, 0, 0, FW_NORMAL, FALSE, FALSE, FALSE,
-        DEFAULT_CHARSET, OUT_DEFAULT_PRECIS, CLIP_DEFAULT_PRECIS,
-        DEFAULT_QUALITY, DEFAULT_PITCH | FF_DONTCARE, L"Arial");
-
-    HFONT hOldFont = (HFONT)SelectObject(g_memDC, hFont);
-    SetTextColor(g_memDC, RGB(0, 0, 0));
-    SetBkMode(g_memDC, TRANSPARENT);
-
-    wchar_t info[256];
-    swprintf_s(info, L"micro3d - 点: (%d, %d) 线: (%d, %d)到(%d, %d) FPS: 60", 
-               pointX, pointY, startX, startY, endX, endY);
-    TextOut(g_memDC, 10, g_windowHeight - 30, info, wcslen(info));
-
-    SelectObject(g_memDC, hOldFont);
-    DeleteObject(hFont);
+    return (int)msg.wParam;
 }
 
 // 窗口过程函数
@@ -273,16 +209,26 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
     case WM_ERASEBKGND:
         return 1; // 阻止系统擦除背景
 
+    case WM_PAINT:
+    {
+        // 窗口被遮挡的部分露出来时，下次呈现整帧（缓冲中总是完整的画面）
+        PAINTSTRUCT ps;
+        BeginPaint(hwnd, &ps);
+        EndPaint(hwnd, &ps);
+        g_presentFull = true;
+        return 0;
+    }
+
     case WM_KEYDOWN:
         if (wParam == VK_ESCAPE) {
             PostQuitMessage(0);
         } else if (wParam == VK_SPACE) {
-            // 空格：在线框和实心模式之间切换
-            g_wireframeMode = !g_wireframeMode;
+            // 空格：依次切换线框、实心、半透明、纹理贴图和 Gouraud 着色模式
+            g_renderMode = (render_mode_t)((g_renderMode + RENDER_MODE_COUNT - 1) % RENDER_MODE_COUNT);
         } else if (wParam == VK_UP) {
             // 向上键：向前移动（靠近物体）
             g_cameraZ += 0.1f;
-            if (g_cameraZ > -0.3f) g_cameraZ = -0.3f; // 防止穿过近裁剪平面
+            if (g_cameraZ > -0.1f) g_cameraZ = -0.1f; // 有近平面裁剪，可以进入物体内部；只需保持在观察目标之前
         } else if (wParam == VK_DOWN) {
             // 向下键：向后移动（远离物体）
             g_cameraZ -= 0.1f;
@@ -0,0 +1,273 @@
+#pragma once
+
+// 帧输出：把 device_t 的颜色缓冲写成 PPM/PNG 图像，或以原始像素流写入管道（供视频编码器读取），
+// 脏矩形模式下也可以只写出每帧变化的区域
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "micro3d.h"
+
+typedef enum {
+    IMAGE_PPM = 0, // 二进制 PPM (P6)，RGB
+    IMAGE_PNG,     // 24 位 RGB PNG，未压缩（deflate 存储块），不依赖 zlib
+    IMAGE_RAW,     // 颜色缓冲原样写出：每像素 4 字节，按字节为 B、G、R、A（ffmpeg 的 bgra；只要颜色时按 bgr0 读取）
+    IMAGE_DIRTY    // 增量流：每帧只写出相对上一帧变化的矩形，格式见 image_write_dirty
+} image_format_t;
+
+// 根据文件扩展名选择格式，未知扩展名按 PPM 处理
+inline image_format_t image_format_from_path(const char* path)
+{
+    const char* dot = strrchr(path, '.');
+    if (dot && (strcmp(dot, ".png") == 0 || strcmp(dot, ".PNG") == 0)) {
+        return IMAGE_PNG;
+    }
+    if (dot && (strcmp(dot, ".raw") == 0 || strcmp(dot, ".RAW") == 0)) {
+        return IMAGE_RAW;
+    }
+    return IMAGE_PPM;
+}
+
+// 帧写出器：行缓冲在第一帧分配后复用，连续写帧时不再分配内存
+typedef struct {
+    std::vector<unsigned char> row;
+    uint32_t crc_table[256];
+} image_writer_t;
+
+inline void image_writer_init(image_writer_t* writer)
+{
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++) {
+            c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        }
+        writer->crc_table[n] = c;
+    }
+}
+
+// 把一行 0xAARRGGBB 像素转换为 RGB 字节，丢弃 alpha
+inline void image_convert_row(unsigned char* out, const unsigned int* pixels, int width)
+{
+    for (int x = 0; x < width; x++) {
+        unsigned int c = pixels[x];
+        out[x * 3 + 0] = (unsigned char)(c >> 16);
+        out[x * 3 + 1] = (unsigned char)(c >> 8);
+        out[x * 3 + 2] = (unsigned char)c;
+    }
+}
+
+inline bool image_write_ppm(image_writer_t* writer, FILE* file, const device_t* device)
+{
+    int width = device->width;
+    int height = device->height;
+    writer->row.resize((size_t)width * 3);
+    if (fprintf(file, "P6\n%d %d\n255\n", width, height) < 0) {
+        return false;
+    }
+    for (int y = 0; y < height; y++) {
+        image_convert_row(writer->row.data(), device->buffer + (size_t)y * width, width);
+        if (fwrite(writer->row.data(), 1, writer->row.size(), file) != writer->row.size()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// PNG 数据块按流写出：边写边计算 CRC32，IDAT 中的 zlib 数据同时计算 Adler-32
+// 并按 65535 字节切分成 deflate 存储块
+typedef struct {
+    FILE* file;
+    const uint32_t* crc_table;
+    uint32_t crc;
+    uint32_t adler_a, adler_b;
+    size_t block_left;  // 当前存储块剩余字节数
+    size_t stream_left; // 未压缩数据剩余字节数
+    bool ok;
+} png_stream_t;
+
+inline void png_write(png_stream_t* s, const void* data, size_t size)
+{
+    const unsigned char* p = (const unsigned char*)data;
+    uint32_t crc = s->crc;
+    for (size_t i = 0; i < size; i++) {
+        crc = s->crc_table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+    }
+    s->crc = crc;
+    if (s->ok && fwrite(p, 1, size, s->file) != size) {
+        s->ok = false;
+    }
+}
+
+inline void png_write_u32(png_stream_t* s, uint32_t v)
+{
+    unsigned char b[4] = { (unsigned char)(v >> 24), (unsigned char)(v >> 16), (unsigned char)(v >> 8), (unsigned char)v };
+    png_write(s, b, 4);
+}
+
+inline void png_begin_chunk(png_stream_t* s, uint32_t length, const char* type)
+{
+    unsigned char b[4] = { (unsigned char)(length >> 24), (unsigned char)(length >> 16), (unsigned char)(length >> 8), (unsigned char)length };
+    if (s->ok && fwrite(b, 1, 4, s->file) != 4) {
+        s->ok = false;
+    }
+    s->crc = 0xFFFFFFFFu;
+    png_write(s, type, 4);
+}
+
+inline void png_end_chunk(png_stream_t* s)
+{
+    png_write_u32(s, s->crc ^ 0xFFFFFFFFu);
+}
+
+// 写入未压缩数据：更新 Adler-32，需要时插入新存储块的块头
+inline void png_write_deflate(png_stream_t* s, const unsigned char* data, size_t size)
+{
+    uint32_t a = s->adler_a, b = s->adler_b;
+    for (size_t i = 0; i < size; i++) {
+        a += data[i];
+        if (a >= 65521) {
+            a -= 65521;
+        }
+        b += a;
+        if (b >= 65521) {
+            b -= 65521;
+        }
+    }
+    s->adler_a = a;
+    s->adler_b = b;
+
+    while (size > 0) {
+        if (s->block_left == 0) {
+            size_t n = s->stream_left < 65535 ? s->stream_left : 65535;
+            unsigned char header[5] = {
+                (unsigned char)(s->stream_left == n ? 1 : 0), // BFINAL，BTYPE = 00（存储）
+                (unsigned char)n, (unsigned char)(n >> 8),
+                (unsigned char)~n, (unsigned char)(~n >> 8)
+            };
+            png_write(s, header, 5);
+            s->block_left = n;
+        }
+        size_t n = size < s->block_left ? size : s->block_left;
+        png_write(s, data, n);
+        data += n;
+        size -= n;
+        s->block_left -= n;
+        s->stream_left -= n;
+    }
+}
+
+inline bool image_write_png(image_writer_t* writer, FILE* file, const device_t* device)
+{
+    int width = device->width;
+    int height = device->height;
+    size_t row_size = (size_t)width * 3 + 1; // 每行前有一个过滤类型字节（0：无过滤）
+    size_t raw_size = row_size * height;
+    size_t block_count = raw_size == 0 ? 1 : (raw_size + 65534) / 65535;
+    writer->row.resize(row_size);
+    writer->row[0] = 0;
+
+    png_stream_t s;
+    s.file = file;
+    s.crc_table = writer->crc_table;
+    s.crc = 0;
+    s.adler_a = 1;
+    s.adler_b = 0;
+    s.block_left = 0;
+    s.stream_left = raw_size;
+    s.ok = true;
+
+    static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    if (fwrite(signature, 1, 8, file) != 8) {
+        return false;
+    }
+
+    png_begin_chunk(&s, 13, "IHDR");
+    png_write_u32(&s, (uint32_t)width);
+    png_write_u32(&s, (uint32_t)height);
+    static const unsigned char ihdr[5] = { 8, 2, 0, 0, 0 }; // 8 位、RGB、deflate、标准过滤、不隔行
+    png_write(&s, ihdr, 5);
+    png_end_chunk(&s);
+
+    // zlib 头 2 字节 + 每个存储块 5 字节块头 + 数据 + Adler-32
+    png_begin_chunk(&s, (uint32_t)(2 + block_count * 5 + raw_size + 4), "IDAT");
+    static const unsigned char zlib_header[2] = { 0x78, 0x01 };
+    png_write(&s, zlib_header, 2);
+    if (raw_size == 0) {
+        static const unsigned char empty_block[5] = { 1, 0, 0, 0xFF, 0xFF };
+        png_write(&s, empty_block, 5);
+    }
+    for (int y = 0; y < height && s.ok; y++) {
+        image_convert_row(writer->row.data() + 1, device->buffer + (size_t)y * width, width);
+        png_write_deflate(&s, writer->row.data(), row_size);
+    }
+    png_write_u32(&s, (s.adler_b << 16) | s.adler_a);
+    png_end_chunk(&s);
+
+    png_begin_chunk(&s, 0, "IEND");
+    png_end_chunk(&s);
+    return s.ok;
+}
+
+// 原始像素：直接写出颜色缓冲，不做转换
+inline bool image_write_raw(FILE* file, const device_t* device)
+{
+    size_t count = (size_t)device->width * device->height;
+    return fwrite(device->buffer, sizeof(unsigned int), count, file) == count;
+}
+
+inline bool image_write_u32(FILE* file, uint32_t v)
+{
+    unsigned char b[4] = { (unsigned char)v, (unsigned char)(v >> 8), (unsigned char)(v >> 16), (unsigned char)(v >> 24) };
+    return fwrite(b, 1, 4, file) == 4;
+}
+
+// 增量流：每帧为 "M3DR"、宽、高、矩形数，接着每个矩形的 x、y、宽、高（都是小端 uint32），
+// 然后按矩形顺序逐行写出矩形内的像素（与 IMAGE_RAW 相同的 bgra）。矩形为 device 最近一次绘制时变化的区域
+// （dirty_changed），第一帧是整个画面，画面不变的帧只有帧头；device 没有使用脏矩形时每帧都写出整个画面。
+// 读取方把矩形依次贴到上一帧上，就得到这一帧
+inline bool image_write_dirty(FILE* file, const device_t* device)
+{
+    const std::vector<rect_t>* changed = dirty_changed(device);
+    rect_t full = { 0, 0, device->width - 1, device->height - 1 };
+    const rect_t* rects = changed ? changed->data() : &full;
+    size_t count = changed ? changed->size() : 1;
+    bool ok = fwrite("M3DR", 1, 4, file) == 4 && image_write_u32(file, (uint32_t)device->width) &&
+              image_write_u32(file, (uint32_t)device->height) && image_write_u32(file, (uint32_t)count);
+    for (size_t i = 0; i < count && ok; i++) {
+        const rect_t* r = &rects[i];
+        ok = image_write_u32(file, (uint32_t)r->x0) && image_write_u32(file, (uint32_t)r->y0) &&
+             image_write_u32(file, (uint32_t)(r->x1 - r->x0 + 1)) && image_write_u32(file, (uint32_t)(r->y1 - r->y0 + 1));
+    }
+    for (size_t i = 0; i < count && ok; i++) {
+        const rect_t* r = &rects[i];
+        size_t width = (size_t)(r->x1 - r->x0 + 1);
+        for (int y = r->y0; y <= r->y1 && ok; y++) {
+            ok = fwrite(device->buffer + (size_t)y * device->width + r->x0, sizeof(unsigned int), width, file) == width;
+        }
+    }
+    return ok;
+}
+
+inline bool image_write(image_writer_t* writer, FILE* file, const device_t* device, image_format_t format)
+{
+    switch (format) {
+    case IMAGE_PNG: return image_write_png(writer, file, device);
+    case IMAGE_RAW: return image_write_raw(file, device);
+    case IMAGE_DIRTY: return image_write_dirty(file, device);
+    default: return image_write_ppm(writer, file, device);
+    }
+}
+
+// 写出到文件，格式由扩展名决定
+inline bool image_save(image_writer_t* writer, const char* path, const device_t* device)
+{
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        return false;
+    }
+    bool ok = image_write(writer, file, device, image_format_from_path(path));
+    ok = fclose(file) == 0 && ok;
+    return ok;
+}
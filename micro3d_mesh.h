@@ -0,0 +1,474 @@
+#pragma once
+
+// 网格加载：Wavefront OBJ 解析，以及可以直接内存映射使用的紧凑二进制网格格式
+// 加载结果为 draw_indexed 使用的顶点/下标缓冲
+
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include <sys/stat.h>
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "micro3d.h"
+
+// 只读文件映射：文件内容通过 data 直接访问，不复制
+typedef struct {
+    const char* data;
+    size_t size;
+#if defined(_WIN32)
+    HANDLE file;
+    HANDLE mapping;
+#endif
+} file_map_t;
+
+inline bool file_map_open(file_map_t* map, const char* path)
+{
+    map->data = nullptr;
+    map->size = 0;
+#if defined(_WIN32)
+    map->mapping = nullptr;
+    map->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (map->file == INVALID_HANDLE_VALUE) {
+        map->file = nullptr;
+        return false;
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(map->file, &size)) {
+        CloseHandle(map->file);
+        map->file = nullptr;
+        return false;
+    }
+    map->size = (size_t)size.QuadPart;
+    if (map->size == 0) {
+        return true;
+    }
+    map->mapping = CreateFileMappingA(map->file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (map->mapping) {
+        map->data = (const char*)MapViewOfFile(map->mapping, FILE_MAP_READ, 0, 0, 0);
+    }
+    if (!map->data) {
+        if (map->mapping) {
+            CloseHandle(map->mapping);
+        }
+        CloseHandle(map->file);
+        map->mapping = nullptr;
+        map->file = nullptr;
+        map->size = 0;
+        return false;
+    }
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return false;
+    }
+    map->size = (size_t)st.st_size;
+    if (map->size == 0) {
+        close(fd);
+        return true;
+    }
+    // 映射建立后文件描述符即可关闭
+    void* data = mmap(nullptr, map->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        map->size = 0;
+        return false;
+    }
+    map->data = (const char*)data;
+#endif
+    return true;
+}
+
+inline void file_map_close(file_map_t* map)
+{
+#if defined(_WIN32)
+    if (map->data) {
+        UnmapViewOfFile(map->data);
+    }
+    if (map->mapping) {
+        CloseHandle(map->mapping);
+    }
+    if (map->file) {
+        CloseHandle(map->file);
+    }
+    map->mapping = nullptr;
+    map->file = nullptr;
+#else
+    if (map->data) {
+        munmap((void*)map->data, map->size);
+    }
+#endif
+    map->data = nullptr;
+    map->size = 0;
+}
+
+// 网格：vertices/indices 指向 vertex_data/index_data（从 OBJ 解析）或文件映射（二进制格式）
+// 使用前用 mesh_t mesh = {} 初始化，使用完调用 mesh_free
+typedef struct {
+    const vec4_t* vertices;
+    int vertex_count;
+    const unsigned int* indices; // 每 3 个下标组成一个三角形
+    int index_count;
+
+    std::vector<vec4_t> vertex_data;
+    std::vector<unsigned int> index_data;
+    file_map_t map;
+} mesh_t;
+
+inline void mesh_free(mesh_t* mesh)
+{
+    file_map_close(&mesh->map);
+    std::vector<vec4_t>().swap(mesh->vertex_data);
+    std::vector<unsigned int>().swap(mesh->index_data);
+    mesh->vertices = nullptr;
+    mesh->vertex_count = 0;
+    mesh->indices = nullptr;
+    mesh->index_count = 0;
+}
+
+// OBJ 解析：直接在映射的文件内容上扫描，不依赖结尾的 '\0'，解析过程中不分配内存
+inline const char* obj_skip_space(const char* p, const char* end)
+{
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) {
+        p++;
+    }
+    return p;
+}
+
+inline const char* obj_next_line(const char* p, const char* end)
+{
+    const char* nl = (const char*)memchr(p, '\n', end - p);
+    return nl ? nl + 1 : end;
+}
+
+// 十进制整数；绝对值超过 INT_MAX 时返回 false（不会是合法的下标），不再继续累加以免溢出
+inline bool obj_parse_int(const char** pp, const char* end, long long* out)
+{
+    const char* p = *pp;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        p++;
+    }
+    if (p >= end || *p < '0' || *p > '9') {
+        return false;
+    }
+    long long value = 0;
+    while (p < end && *p >= '0' && *p <= '9') {
+        value = value * 10 + (*p - '0');
+        if (value > INT_MAX) {
+            return false;
+        }
+        p++;
+    }
+    *out = negative ? -value : value;
+    *pp = p;
+    return true;
+}
+
+// 十进制浮点数：尾数先按整数累加（最多 19 位有效数字），最后乘以 10 的幂次一次换算
+inline bool obj_parse_float(const char** pp, const char* end, float* out)
+{
+    static const double powers[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+        1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    const char* p = *pp;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        p++;
+    }
+    unsigned long long mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    bool any = false;
+    while (p < end && *p >= '0' && *p <= '9') {
+        if (digits < 19) {
+            mantissa = mantissa * 10 + (*p - '0');
+            if (mantissa) {
+                digits++;
+            }
+        } else {
+            exponent++;
+        }
+        any = true;
+        p++;
+    }
+    if (p < end && *p == '.') {
+        p++;
+        while (p < end && *p >= '0' && *p <= '9') {
+            if (digits < 19) {
+                mantissa = mantissa * 10 + (*p - '0');
+                if (mantissa) {
+                    digits++;
+                }
+                exponent--;
+            }
+            any = true;
+            p++;
+        }
+    }
+    if (!any) {
+        return false;
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        const char* q = p + 1;
+        bool exponent_negative = false;
+        if (q < end && (*q == '-' || *q == '+')) {
+            exponent_negative = *q == '-';
+            q++;
+        }
+        if (q < end && *q >= '0' && *q <= '9') {
+            // 指数超过 1000 时结果必然溢出或下溢，累加到 1000 为止
+            int e = 0;
+            while (q < end && *q >= '0' && *q <= '9') {
+                e = e * 10 + (*q - '0');
+                e = e > 1000 ? 1000 : e;
+                q++;
+            }
+            exponent += exponent_negative ? -e : e;
+            p = q;
+        }
+    }
+
+    double value = (double)mantissa;
+    while (exponent > 22) {
+        value *= 1e22;
+        exponent -= 22;
+    }
+    while (exponent < -22) {
+        value /= 1e22;
+        exponent += 22;
+    }
+    value = exponent >= 0 ? value * powers[exponent] : value / powers[-exponent];
+    *out = (float)(negative ? -value : value);
+    *pp = p;
+    return true;
+}
+
+// 读取 OBJ 文件的顶点位置（v）和面（f），多边形面按扇形拆成三角形，其他语句忽略。
+// 面的下标可以是 v、v/vt、v//vn、v/vt/vn 形式，负数表示相对当前已读取顶点的位置。
+// 文件无法打开、数字格式错误或面引用了不存在的顶点时返回 false
+inline bool mesh_load_obj(mesh_t* mesh, const char* path)
+{
+    mesh_free(mesh);
+
+    file_map_t file;
+    if (!file_map_open(&file, path)) {
+        return false;
+    }
+    const char* begin = file.data;
+    const char* end = file.data + file.size;
+
+    // 先数出顶点行和面行，一次性分配好缓冲，避免大文件解析时反复扩容复制
+    size_t vertex_lines = 0, face_lines = 0;
+    for (const char* p = begin; p < end; p = obj_next_line(p, end)) {
+        const char* q = obj_skip_space(p, end);
+        if (q + 1 < end && (q[1] == ' ' || q[1] == '\t')) {
+            if (q[0] == 'v') {
+                vertex_lines++;
+            } else if (q[0] == 'f') {
+                face_lines++;
+            }
+        }
+    }
+    std::vector<vec4_t>& vertices = mesh->vertex_data;
+    std::vector<unsigned int>& indices = mesh->index_data;
+    vertices.reserve(vertex_lines);
+    indices.reserve(face_lines * 3);
+
+    bool ok = true;
+    for (const char* p = begin; ok && p < end; p = obj_next_line(p, end)) {
+        p = obj_skip_space(p, end);
+        if (p + 1 >= end || (p[1] != ' ' && p[1] != '\t')) {
+            continue;
+        }
+        if (p[0] == 'v') {
+            // v x y z [w]
+            vec4_t v = { 0.0f, 0.0f, 0.0f, 1.0f };
+            const char* q = p + 1;
+            float* xyzw[4] = { &v.x, &v.y, &v.z, &v.w };
+            for (int i = 0; i < 4; i++) {
+                q = obj_skip_space(q, end);
+                if (!obj_parse_float(&q, end, xyzw[i])) {
+                    ok = i == 3;
+                    break;
+                }
+            }
+            vertices.push_back(v);
+        } else if (p[0] == 'f') {
+            // f v1 v2 v3 ...：(v1, vi, vi+1) 组成三角形
+            const char* q = p + 1;
+            long long count = (long long)vertices.size();
+            unsigned int first = 0, prev = 0;
+            int n = 0;
+            while (true) {
+                q = obj_skip_space(q, end);
+                long long index;
+                if (q >= end || *q == '\n' || *q == '#') {
+                    break;
+                }
+                if (!obj_parse_int(&q, end, &index)) {
+                    ok = false;
+                    break;
+                }
+                index = index > 0 ? index - 1 : count + index;
+                if (index < 0 || index >= count) {
+                    ok = false;
+                    break;
+                }
+                // 跳过纹理坐标和法线下标
+                while (q < end && *q != ' ' && *q != '\t' && *q != '\r' && *q != '\n') {
+                    q++;
+                }
+                unsigned int cur = (unsigned int)index;
+                if (n == 0) {
+                    first = cur;
+                } else if (n >= 2) {
+                    indices.push_back(first);
+                    indices.push_back(prev);
+                    indices.push_back(cur);
+                }
+                prev = cur;
+                n++;
+            }
+        }
+    }
+    file_map_close(&file);
+
+    if (!ok || vertices.size() > (size_t)0x7FFFFFFF || indices.size() > (size_t)0x7FFFFFFF) {
+        mesh_free(mesh);
+        return false;
+    }
+    mesh->vertices = vertices.data();
+    mesh->vertex_count = (int)vertices.size();
+    mesh->indices = indices.data();
+    mesh->index_count = (int)indices.size();
+    return true;
+}
+
+// 二进制网格格式（按本机字节序，即小端）：
+//   偏移 0：mesh_file_header_t
+//   偏移 16：vertex_count 个 vec4_t
+//   随后：index_count 个 uint32 下标
+// 映射地址按页对齐，顶点数组 16 字节对齐、下标数组 4 字节对齐，加载时直接指向映射的内存
+static const uint32_t MESH_FILE_MAGIC = 0x4D44334D; // "M3DM"
+static const uint32_t MESH_FILE_VERSION = 1;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t vertex_count;
+    uint32_t index_count;
+} mesh_file_header_t;
+
+inline bool mesh_save_binary(const mesh_t* mesh, const char* path)
+{
+    FILE* f = fopen(path, "wb");
+    if (!f) {
+        return false;
+    }
+    mesh_file_header_t header = { MESH_FILE_MAGIC, MESH_FILE_VERSION, (uint32_t)mesh->vertex_count, (uint32_t)mesh->index_count };
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+    if (ok && mesh->vertex_count > 0) {
+        ok = fwrite(mesh->vertices, sizeof(vec4_t), (size_t)mesh->vertex_count, f) == (size_t)mesh->vertex_count;
+    }
+    if (ok && mesh->index_count > 0) {
+        ok = fwrite(mesh->indices, sizeof(unsigned int), (size_t)mesh->index_count, f) == (size_t)mesh->index_count;
+    }
+    ok = fclose(f) == 0 && ok;
+    if (!ok) {
+        remove(path);
+    }
+    return ok;
+}
+
+// 映射二进制网格文件，零拷贝；文件头或大小不匹配、下标超出顶点数时返回 false。
+// 下标在映射时顺序检查一遍（只读，不复制），之后绘制时不会越界访问顶点
+inline bool mesh_load_binary(mesh_t* mesh, const char* path)
+{
+    mesh_free(mesh);
+
+    file_map_t* map = &mesh->map;
+    if (!file_map_open(map, path)) {
+        return false;
+    }
+    mesh_file_header_t header;
+    if (map->size < sizeof(header)) {
+        file_map_close(map);
+        return false;
+    }
+    memcpy(&header, map->data, sizeof(header));
+    uint64_t expected = sizeof(header) + (uint64_t)header.vertex_count * sizeof(vec4_t) + (uint64_t)header.index_count * sizeof(unsigned int);
+    if (header.magic != MESH_FILE_MAGIC || header.version != MESH_FILE_VERSION ||
+        header.vertex_count > 0x7FFFFFFF || header.index_count > 0x7FFFFFFF || expected != map->size) {
+        file_map_close(map);
+        return false;
+    }
+    const unsigned int* indices = (const unsigned int*)(map->data + sizeof(header) + (size_t)header.vertex_count * sizeof(vec4_t));
+    unsigned int max_index = 0;
+    for (uint32_t i = 0; i < header.index_count; i++) {
+        max_index = std::max(max_index, indices[i]);
+    }
+    if (header.index_count > 0 && max_index >= header.vertex_count) {
+        file_map_close(map);
+        return false;
+    }
+    mesh->vertices = (const vec4_t*)(map->data + sizeof(header));
+    mesh->vertex_count = (int)header.vertex_count;
+    mesh->indices = indices;
+    mesh->index_count = (int)header.index_count;
+    return true;
+}
+
+inline bool file_modified_time(const char* path, long long* time)
+{
+#if defined(_WIN32)
+    struct _stat64 st;
+    if (_stat64(path, &st) != 0) {
+        return false;
+    }
+#else
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        return false;
+    }
+#endif
+    *time = (long long)st.st_mtime;
+    return true;
+}
+
+// 优先映射缓存的二进制文件；缓存不存在、比 OBJ 旧或无效时解析 OBJ 并重新写出缓存
+// （写缓存失败不影响本次加载）
+inline bool mesh_load_cached(mesh_t* mesh, const char* obj_path, const char* cache_path)
+{
+    long long obj_time = 0, cache_time = 0;
+    bool has_obj = file_modified_time(obj_path, &obj_time);
+    if (file_modified_time(cache_path, &cache_time) && (!has_obj || cache_time >= obj_time) &&
+        mesh_load_binary(mesh, cache_path)) {
+        return true;
+    }
+    if (!mesh_load_obj(mesh, obj_path)) {
+        return false;
+    }
+    mesh_save_binary(mesh, cache_path);
+    return true;
+}
@@ -0,0 +1,495 @@
+#pragma once
+
+// 场景：网格实例的集合，用包围体层次（BVH）做视锥剔除。
+// 每帧先按视锥遍历 BVH，整棵在视锥外的子树直接跳过，只有可见的实例才变换顶点并绘制。
+// 场景记录实例的变化，scene_draw_dirty 只重绘变化的实例在屏幕上覆盖的区域
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "micro3d.h"
+
+// 轴对齐包围盒
+typedef struct {
+    float min[3];
+    float max[3];
+} aabb_t;
+
+inline void aabb_empty(aabb_t* box)
+{
+    for (int i = 0; i < 3; i++) {
+        box->min[i] = INFINITY;
+        box->max[i] = -INFINITY;
+    }
+}
+
+inline void aabb_union(aabb_t* box, const aabb_t* other)
+{
+    for (int i = 0; i < 3; i++) {
+        box->min[i] = fminf(box->min[i], other->min[i]);
+        box->max[i] = fmaxf(box->max[i], other->max[i]);
+    }
+}
+
+// 局部包围盒经过仿射矩阵 m（行向量，p' = p * m）变换后的包围盒：中心直接变换，半长按 |m| 累加
+inline void aabb_transform(aabb_t* out, const aabb_t* box, const matrix_t* m)
+{
+    float c[3], e[3];
+    for (int i = 0; i < 3; i++) {
+        c[i] = 0.5f * (box->min[i] + box->max[i]);
+        e[i] = 0.5f * (box->max[i] - box->min[i]);
+    }
+    for (int j = 0; j < 3; j++) {
+        float center = m->m[3][j];
+        float extent = 0.0f;
+        for (int i = 0; i < 3; i++) {
+            center += c[i] * m->m[i][j];
+            extent += e[i] * fabsf(m->m[i][j]);
+        }
+        out->min[j] = center - extent;
+        out->max[j] = center + extent;
+    }
+}
+
+// 视锥：6 个平面 (a, b, c, d)，a * x + b * y + c * z + d >= 0 为内侧。
+// 由 view * projection 的列组合得到，与 clip_outcode 的裁剪范围一致：-w <= x, y <= w，0 <= z <= w
+typedef struct {
+    float planes[6][4];
+} frustum_t;
+
+inline void frustum_extract(frustum_t* frustum, const matrix_t* view_projection)
+{
+    const matrix_t* m = view_projection;
+    for (int i = 0; i < 4; i++) {
+        float x = m->m[i][0], y = m->m[i][1], z = m->m[i][2], w = m->m[i][3];
+        frustum->planes[0][i] = w + x; // 左
+        frustum->planes[1][i] = w - x; // 右
+        frustum->planes[2][i] = w + y; // 下
+        frustum->planes[3][i] = w - y; // 上
+        frustum->planes[4][i] = z;     // 近
+        frustum->planes[5][i] = w - z; // 远
+    }
+}
+
+// 包围盒与视锥相交测试，mask 的第 i 位表示还需要测试平面 i。
+// 返回 -1 表示完全在某个平面外，否则返回包围盒仍跨过的平面（为 0 时完全在视锥内，子结点不再需要测试）
+inline int frustum_test(const frustum_t* frustum, const aabb_t* box, int mask)
+{
+    int result = 0;
+    for (int i = 0; i < 6; i++) {
+        if (!(mask & (1 << i))) {
+            continue;
+        }
+        const float* p = frustum->planes[i];
+        // 法线方向上最远和最近的角点
+        float far_d = p[3], near_d = p[3];
+        for (int k = 0; k < 3; k++) {
+            float lo = p[k] * box->min[k], hi = p[k] * box->max[k];
+            far_d += fmaxf(lo, hi);
+            near_d += fminf(lo, hi);
+        }
+        if (far_d < 0.0f) {
+            return -1;
+        }
+        if (near_d < 0.0f) {
+            result |= 1 << i;
+        }
+    }
+    return result;
+}
+
+// 场景中的网格：顶点、下标和颜色缓冲由调用者持有，与 draw_indexed 的参数相同
+typedef struct {
+    const vec4_t* vertices;
+    int vertex_count;
+    const unsigned int* indices;
+    int index_count;
+    const unsigned int* colors;
+    unsigned int clr;
+    aabb_t bounds; // 局部坐标
+} scene_mesh_t;
+
+typedef struct {
+    int mesh;
+    matrix_t world;
+    int slot; // 在 scene_t::order 和 scene_t::bounds 中的位置
+    int leaf; // 所在的 BVH 叶结点
+} scene_instance_t;
+
+// BVH 结点按先序存放，父结点的下标总是小于子结点
+typedef struct {
+    aabb_t bounds;
+    int parent;
+    int left, right;  // 子结点，叶结点为 -1
+    int first, count; // 叶结点包含 order[first, first + count) 的实例
+    int axis;         // 内部结点的划分轴，right 子树在这一轴上的坐标较大
+    bool dirty;       // 已加入 scene_t::dirty，等待重新计算包围盒
+} bvh_node_t;
+
+static const int BVH_LEAF_SIZE = 4;
+static const int SCENE_MAX_CHANGES = 256; // 两次 scene_draw_dirty 之间记录的变化包围盒数，超出时整帧重绘
+
+struct scene_t {
+    std::vector<scene_mesh_t> meshes;
+    std::vector<scene_instance_t> instances;
+    std::vector<bvh_node_t> nodes;
+    std::vector<int> order;   // 实例下标，按叶结点排列
+    std::vector<aabb_t> bounds; // 实例在世界坐标中的包围盒，与 order 顺序相同：叶结点的实例连续存放，剔除和更新时顺序访问
+    std::vector<int> dirty;   // 实例移动后需要重新计算包围盒的结点
+    std::vector<int> visible; // scene_draw 的可见实例，每帧复用
+    std::vector<aabb_t> changes; // 上次 scene_draw_dirty 以来变化的实例在变化前后的包围盒（世界坐标）
+    bool changes_overflow;       // 变化太多，没有全部记录
+    bool built;               // 为 false 时下次使用前重建 BVH
+};
+
+inline scene_t* scene_create()
+{
+    scene_t* scene = new scene_t;
+    scene->changes_overflow = false;
+    scene->built = false;
+    return scene;
+}
+
+// 记录包围盒内的画面发生了变化
+inline void scene_add_change(scene_t* scene, const aabb_t* bounds)
+{
+    if (scene->changes.size() >= (size_t)SCENE_MAX_CHANGES) {
+        scene->changes_overflow = true;
+        return;
+    }
+    scene->changes.push_back(*bounds);
+}
+
+inline void scene_destroy(scene_t* scene)
+{
+    delete scene;
+}
+
+// 添加网格，返回网格编号；网格数据不复制，需要保持到场景销毁
+inline int scene_add_mesh(scene_t* scene, const vec4_t* vertices, int vertex_count,
+                          const unsigned int* indices, int index_count, const unsigned int* colors, unsigned int clr)
+{
+    scene_mesh_t mesh = { vertices, vertex_count, indices, index_count, colors, clr, {} };
+    aabb_empty(&mesh.bounds);
+    for (int i = 0; i < vertex_count; i++) {
+        aabb_t point = { { vertices[i].x, vertices[i].y, vertices[i].z }, { vertices[i].x, vertices[i].y, vertices[i].z } };
+        aabb_union(&mesh.bounds, &point);
+    }
+    scene->meshes.push_back(mesh);
+    return (int)scene->meshes.size() - 1;
+}
+
+// 添加网格 mesh 的一个实例，返回实例编号；之后的第一次绘制会重建 BVH
+inline int scene_add_instance(scene_t* scene, int mesh, const matrix_t* world)
+{
+    scene_instance_t instance;
+    instance.mesh = mesh;
+    instance.world = *world;
+    instance.slot = (int)scene->order.size();
+    instance.leaf = -1;
+    aabb_t bounds;
+    aabb_transform(&bounds, &scene->meshes[mesh].bounds, world);
+    scene->instances.push_back(instance);
+    scene->order.push_back((int)scene->instances.size() - 1);
+    scene->bounds.push_back(bounds);
+    scene_add_change(scene, &bounds);
+    scene->built = false;
+    return (int)scene->instances.size() - 1;
+}
+
+// 建树时按中心点划分的实例，连续存放，划分时不需要间接访问
+typedef struct {
+    float center[3];
+    int instance;
+} bvh_item_t;
+
+inline int scene_build_node(scene_t* scene, bvh_item_t* items, const aabb_t* bounds, int first, int count, int parent)
+{
+    int index = (int)scene->nodes.size();
+    scene->nodes.push_back(bvh_node_t());
+    bvh_node_t node = {};
+    node.parent = parent;
+    node.left = node.right = -1;
+    node.first = first;
+    node.count = count;
+    aabb_empty(&node.bounds);
+    if (count > BVH_LEAF_SIZE) {
+        // 在中心点范围最大的轴上按中位数划分，两边实例数相等，树高为 log2(n / BVH_LEAF_SIZE)
+        aabb_t centers;
+        aabb_empty(&centers);
+        for (int i = first; i < first + count; i++) {
+            for (int k = 0; k < 3; k++) {
+                centers.min[k] = fminf(centers.min[k], items[i].center[k]);
+                centers.max[k] = fmaxf(centers.max[k], items[i].center[k]);
+            }
+        }
+        int axis = 0;
+        for (int k = 1; k < 3; k++) {
+            if (centers.max[k] - centers.min[k] > centers.max[axis] - centers.min[axis]) {
+                axis = k;
+            }
+        }
+        int half = count / 2;
+        std::nth_element(items + first, items + first + half, items + first + count,
+                         [axis](const bvh_item_t& a, const bvh_item_t& b) { return a.center[axis] < b.center[axis]; });
+        node.axis = axis;
+        node.count = 0;
+        node.left = scene_build_node(scene, items, bounds, first, half, index);
+        node.right = scene_build_node(scene, items, bounds, first + half, count - half, index);
+        node.bounds = scene->nodes[node.left].bounds;
+        aabb_union(&node.bounds, &scene->nodes[node.right].bounds);
+    } else {
+        for (int i = first; i < first + count; i++) {
+            scene->instances[items[i].instance].leaf = index;
+            aabb_union(&node.bounds, &bounds[items[i].instance]);
+        }
+    }
+    scene->nodes[index] = node;
+    return index;
+}
+
+// 按当前的实例包围盒重建整个 BVH。实例移动后 scene_refit 只更新包围盒、不改变树的结构，
+// 移动幅度很大时树会变得松散，可以定期调用 scene_build
+inline void scene_build(scene_t* scene)
+{
+    int count = (int)scene->instances.size();
+    std::vector<aabb_t> bounds(count); // 按实例下标
+    std::vector<bvh_item_t> items(count);
+    for (int i = 0; i < count; i++) {
+        const aabb_t* b = &scene->bounds[scene->instances[i].slot];
+        bounds[i] = *b;
+        for (int k = 0; k < 3; k++) {
+            items[i].center[k] = 0.5f * (b->min[k] + b->max[k]);
+        }
+        items[i].instance = i;
+    }
+    scene->nodes.clear();
+    scene->dirty.clear();
+    if (count > 0) {
+        scene->nodes.reserve((size_t)count * 2 / BVH_LEAF_SIZE + 1);
+        scene_build_node(scene, items.data(), bounds.data(), 0, count, -1);
+    }
+    // 包围盒按叶结点的顺序重新排列
+    for (int k = 0; k < count; k++) {
+        int instance = items[k].instance;
+        scene->order[k] = instance;
+        scene->instances[instance].slot = k;
+        scene->bounds[k] = bounds[instance];
+    }
+    scene->built = true;
+}
+
+// 修改实例的世界矩阵：重新计算实例的包围盒，并标记它所在的叶结点到根的路径，由 scene_refit 更新。
+// 变化前后的包围盒都记录为变化区域
+inline void scene_set_transform(scene_t* scene, int instance, const matrix_t* world)
+{
+    scene_instance_t* inst = &scene->instances[instance];
+    inst->world = *world;
+    scene_add_change(scene, &scene->bounds[inst->slot]);
+    aabb_transform(&scene->bounds[inst->slot], &scene->meshes[inst->mesh].bounds, world);
+    scene_add_change(scene, &scene->bounds[inst->slot]);
+    if (!scene->built) {
+        return;
+    }
+    for (int node = inst->leaf; node >= 0 && !scene->nodes[node].dirty; node = scene->nodes[node].parent) {
+        scene->nodes[node].dirty = true;
+        scene->dirty.push_back(node);
+    }
+}
+
+// 只重新计算被标记的结点：先序存放时子结点的下标大于父结点，按下标从大到小处理即可自底向上
+inline void scene_refit(scene_t* scene)
+{
+    if (scene->dirty.empty()) {
+        return;
+    }
+    std::sort(scene->dirty.begin(), scene->dirty.end(), [](int a, int b) { return a > b; });
+    for (size_t i = 0; i < scene->dirty.size(); i++) {
+        bvh_node_t* node = &scene->nodes[scene->dirty[i]];
+        if (node->left >= 0) {
+            node->bounds = scene->nodes[node->left].bounds;
+            aabb_union(&node->bounds, &scene->nodes[node->right].bounds);
+        } else {
+            aabb_empty(&node->bounds);
+            for (int k = node->first; k < node->first + node->count; k++) {
+                aabb_union(&node->bounds, &scene->bounds[k]);
+            }
+        }
+        node->dirty = false;
+    }
+    scene->dirty.clear();
+}
+
+// 收集与视锥相交的实例（按 BVH 的遍历顺序）。完全在视锥内的子树不再逐个测试；
+// view 为 matrix_look_at 的结果，子结点按视线方向由近到远遍历，让近处的实例先绘制
+inline void scene_cull(scene_t* scene, const matrix_t* view, const matrix_t* projection, std::vector<int>* visible)
+{
+    visible->clear();
+    if (!scene->built) {
+        scene_build(scene);
+    }
+    scene_refit(scene);
+    if (scene->nodes.empty()) {
+        return;
+    }
+    matrix_t view_projection;
+    matrix_multiply(&view_projection, view, projection);
+    frustum_t frustum;
+    frustum_extract(&frustum, &view_projection);
+    // matrix_look_at 的第 2 列为 -forward
+    float forward[3] = { -view->m[0][2], -view->m[1][2], -view->m[2][2] };
+
+    int stack[128][2]; // 结点、还需要测试的平面
+    int top = 0;
+    stack[top][0] = 0;
+    stack[top][1] = 0x3F;
+    top++;
+    while (top > 0) {
+        top--;
+        int index = stack[top][0];
+        const bvh_node_t* node = &scene->nodes[index];
+        int mask = stack[top][1];
+        if (mask) {
+            mask = frustum_test(&frustum, &node->bounds, mask);
+            if (mask < 0) {
+                continue;
+            }
+        }
+        if (node->left < 0) {
+            for (int k = node->first; k < node->first + node->count; k++) {
+                if (!mask || frustum_test(&frustum, &scene->bounds[k], mask) >= 0) {
+                    visible->push_back(scene->order[k]);
+                }
+            }
+            continue;
+        }
+        // 先压入远的子结点，近的先出栈
+        bool right_first = forward[node->axis] < 0.0f;
+        stack[top][0] = right_first ? node->left : node->right;
+        stack[top][1] = mask;
+        stack[top + 1][0] = right_first ? node->right : node->left;
+        stack[top + 1][1] = mask;
+        top += 2;
+    }
+}
+
+// 绘制 scene->visible 中的实例；每个实例只做一次矩阵乘法（world * view * projection），
+// 之后的网格剔除、裁剪和光栅化与 draw_indexed 相同
+inline void scene_draw_visible(scene_t* scene, device_t* device, const matrix_t* view_projection)
+{
+    for (size_t i = 0; i < scene->visible.size(); i++) {
+        const scene_instance_t* inst = &scene->instances[scene->visible[i]];
+        const scene_mesh_t* mesh = &scene->meshes[inst->mesh];
+        matrix_t wvp;
+        matrix_multiply(&wvp, &inst->world, view_projection);
+        draw_indexed_wvp(device, &wvp, mesh->vertices, mesh->vertex_count, mesh->indices, mesh->index_count,
+                         mesh->colors, mesh->clr);
+    }
+}
+
+// 绘制场景中与视锥相交的实例。分块模式下需要再调用 binner_flush
+inline void scene_draw(scene_t* scene, device_t* device, const matrix_t* view, const matrix_t* projection)
+{
+    MICRO3D_STATS_SCOPE(device, STATS_SCENE);
+    scene_cull(scene, view, projection, &scene->visible);
+    MICRO3D_STATS_ADD(device, instances_culled, scene->instances.size() - scene->visible.size());
+
+    matrix_t view_projection;
+    matrix_multiply(&view_projection, view, projection);
+    scene_draw_visible(scene, device, &view_projection);
+}
+
+// 世界坐标包围盒投影到屏幕上覆盖的像素范围，向外多留一个像素（顶点吸附、采样位置和舍入都在这之内）。
+// 有角点在相机平面附近或后方时投影没有上界，返回整个屏幕
+inline rect_t scene_screen_rect(const aabb_t* box, const matrix_t* view_projection, int width, int height)
+{
+    rect_t full = { 0, 0, width - 1, height - 1 };
+    float min_x = INFINITY, min_y = INFINITY, max_x = -INFINITY, max_y = -INFINITY;
+    for (int i = 0; i < 8; i++) {
+        vec4_t p = { (i & 1) ? box->max[0] : box->min[0], (i & 2) ? box->max[1] : box->min[1],
+                     (i & 4) ? box->max[2] : box->min[2], 1.0f };
+        vec4_t c;
+        vector_transform(&c, &p, view_projection);
+        if (!(c.w > 1e-6f)) {
+            return full;
+        }
+        float x = (c.x / c.w + 1.0f) * 0.5f * width;
+        float y = (1.0f - c.y / c.w) * 0.5f * height;
+        min_x = fminf(min_x, x);
+        max_x = fmaxf(max_x, x);
+        min_y = fminf(min_y, y);
+        max_y = fmaxf(max_y, y);
+    }
+    // 先限制在屏幕附近，避免远在屏幕外的坐标转换为整数时溢出
+    rect_t r = { (int)floorf(fmaxf(min_x, -2.0f)) - 1, (int)floorf(fmaxf(min_y, -2.0f)) - 1,
+                 (int)ceilf(fminf(max_x, (float)width + 1.0f)) + 1, (int)ceilf(fminf(max_y, (float)height + 1.0f)) + 1 };
+    return r;
+}
+
+// 把屏幕上的像素矩形 r（向外留一个像素）放大到整个裁剪空间的矩阵：projection * crop 的视锥只包含 r，
+// 用它做 BVH 剔除就只剩下可能覆盖 r 的实例
+inline void scene_crop_matrix(matrix_t* crop, const rect_t* r, int width, int height)
+{
+    float x0 = 2.0f * (float)(r->x0 - 1) / (float)width - 1.0f;
+    float x1 = 2.0f * (float)(r->x1 + 2) / (float)width - 1.0f;
+    float y0 = 1.0f - 2.0f * (float)(r->y1 + 2) / (float)height;
+    float y1 = 1.0f - 2.0f * (float)(r->y0 - 1) / (float)height;
+    matrix_identity(crop);
+    crop->m[0][0] = 2.0f / (x1 - x0);
+    crop->m[3][0] = -(x1 + x0) / (x1 - x0);
+    crop->m[1][1] = 2.0f / (y1 - y0);
+    crop->m[3][1] = -(y1 + y0) / (y1 - y0);
+}
+
+// 脏矩形绘制（device->dirty 需要已创建）：只重绘上次绘制这个 device 以来有实例移动或加入的区域。
+// 每个重绘矩形先用 clr、z 清除，再用只包含这个矩形的视锥剔除 BVH，绘制剩下的实例；相机、投影或清除值变化时整帧重绘。
+// 实例的变化由 scene_add_instance/scene_set_transform 记录，每次调用后清空。分块模式下需要再调用 binner_flush
+inline void scene_draw_dirty(scene_t* scene, device_t* device, const matrix_t* view, const matrix_t* projection,
+                             unsigned int clr, float z)
+{
+    MICRO3D_STATS_SCOPE(device, STATS_SCENE);
+    matrix_t view_projection;
+    matrix_multiply(&view_projection, view, projection);
+    struct {
+        matrix_t view, projection;
+        unsigned int clr;
+        float z;
+    } state = { *view, *projection, clr, z };
+    dirty_begin(device);
+    dirty_state(device, &state, sizeof(state));
+    if (scene->changes_overflow) {
+        dirty_add_full(device);
+    } else {
+        // 完全在视锥外的包围盒不影响画面
+        frustum_t frustum;
+        frustum_extract(&frustum, &view_projection);
+        for (size_t i = 0; i < scene->changes.size(); i++) {
+            if (frustum_test(&frustum, &scene->changes[i], 0x3F) >= 0) {
+                rect_t r = scene_screen_rect(&scene->changes[i], &view_projection, device->width, device->height);
+                dirty_add(device, r.x0, r.y0, r.x1, r.y1);
+            }
+        }
+    }
+    scene->changes.clear();
+    scene->changes_overflow = false;
+    const std::vector<rect_t>* rects = dirty_resolve(device);
+
+    bool scissor_test = device->scissor_test;
+    rect_t scissor = device->scissor;
+    for (size_t i = 0; i < rects->size(); i++) {
+        const rect_t* r = &(*rects)[i];
+        device->scissor_test = true;
+        device->scissor = *r;
+        clear_color(device, clr);
+        clear_depth(device, z);
+        matrix_t crop, cropped;
+        scene_crop_matrix(&crop, r, device->width, device->height);
+        matrix_multiply(&cropped, projection, &crop);
+        scene_cull(scene, view, &cropped, &scene->visible);
+        MICRO3D_STATS_ADD(device, instances_culled, scene->instances.size() - scene->visible.size());
+        scene_draw_visible(scene, device, &view_projection);
+    }
+    device->scissor_test = scissor_test;
+    device->scissor = scissor;
+}